@@ -1,25 +1,68 @@
 #pragma once
 
-#include <math.h>
 #include <string>
 #include <vector>
 #include <eosiolib/eosio.hpp>
 #include <eosiolib/asset.hpp>
 #include <eosiolib/symbol.hpp>
 #include <eosiolib/singleton.hpp>
+#include <eosiolib/db.h>
+#include "text.hpp"
 
 using std::string;
 using std::vector;
 using std::make_tuple;
-using std::stoi;
 using namespace eosio;
 
 #define EOS_PRECISION 4
 #define EOS_SYMBOL symbol("EOS", EOS_PRECISION)
 #define MAX_AMOUNT asset::max_amount
 #define MAX_RATE 1000000 /* up to 1M tokens per EOS */
+#define VAULT_DEPOSIT_MEMO "deposit" /* transfer to the network vault */
+#define VAULT_WITHDRAW_MEMO "vault withdraw" /* transfer from the network vault */
+#define RATE_DECIMALS 18 /* fixed point rates are scaled by 10^RATE_DECIMALS */
 #define STAKE_ACCOUNT "eosio.stake"_n
 #define RAM_ACCOUNT "eosio.ram"_n
+#define MAX_TRANSFER_DATA_SIZE 512 /* from, to, quantity and a memo of up to 256 bytes */
+#define SCHEMA_VERSION 1 /* tables layout version, kept in the high bits of state flags */
+#define SCHEMA_VERSION_SHIFT 4
+
+/* reason a reserve reports along with its conversion rate, a 0 rate always comes with a non ok reason. */
+#define RATE_OK 0
+#define RATE_NOT_READY 1 /* not initialized, or tables not migrated */
+#define RATE_DISABLED 2
+#define RATE_NO_PARAMS 3
+#define RATE_OUT_OF_BAND 4 /* rate outside the allowed min/max */
+#define RATE_CAP_EXCEEDED 5
+#define RATE_LOW_BALANCE 6 /* not enough dest tokens */
+#define RATE_UNKNOWN 255 /* reserve does not report a reason */
+
+/* powers of ten up to 10^19, symbol precision is at most 18. */
+constexpr uint64_t POW10[] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+constexpr uint128_t RATE_UNIT = POW10[RATE_DECIMALS];
+constexpr uint128_t MAX_FIXED_RATE = uint128_t(MAX_RATE) * RATE_UNIT;
 
 struct account {
     asset    balance;
@@ -27,7 +70,7 @@ struct account {
 };
 typedef eosio::multi_index<"accounts"_n, account> accounts;
 
-asset get_balance(name user, name token_contract, symbol symbol) {
+inline asset get_balance(name user, name token_contract, symbol symbol) {
     accounts fromAcc(token_contract, user.value);
     auto itr = fromAcc.find(symbol.code().raw());
     if (itr == fromAcc.end()) {
@@ -37,72 +80,159 @@ asset get_balance(name user, name token_contract, symbol symbol) {
     return itr->balance;
 }
 
-void async_pay(name from, name to, asset quantity, name dest_contract, string memo) {
-    action {
-        permission_level{from, "active"_n},
-        dest_contract,
-        "transfer"_n,
-        std::make_tuple(from, to, quantity, memo)
-    }.send();
+/* the transfer is packed by hand, so the memo goes straight into the action data without a string copy. */
+inline void async_pay(name from, name to, asset quantity, name dest_contract, string_view memo) {
+    action pay;
+    pay.account = dest_contract;
+    pay.name = "transfer"_n;
+    pay.authorization.emplace_back(from, "active"_n);
+
+    unsigned_int memo_size = uint32_t(memo.length());
+    pay.data.resize(pack_size(from) + pack_size(to) + pack_size(quantity) + pack_size(memo_size) + memo.length());
+    datastream<char*> ds(pay.data.data(), pay.data.size());
+    ds << from << to << quantity << memo_size;
+    ds.write(memo.data(), memo.length());
+    pay.send();
 }
 
-vector<string> split(const string& str, const string& delim) {
-    vector<string> tokens;
-    size_t prev = 0, pos = 0;
-    do {
-        pos = str.find(delim, prev);
-        if (pos == string::npos) pos = str.length();
-        string token = str.substr(prev, pos-prev);
-        tokens.push_back(token);
-        prev = pos + delim.length();
-    } while (pos < str.length() && prev < str.length());
-    return tokens;
+/*
+ * Dispatches a token transfer notification to handler with the memo as a view into the action data,
+ * where execute_action would copy it into a heap allocated string.
+ */
+template<typename T>
+void execute_transfer(name receiver, name code, void (T::*handler)(name, name, asset, string_view)) {
+    char buffer[MAX_TRANSFER_DATA_SIZE];
+    size_t size = action_data_size();
+    eosio_assert(size <= sizeof(buffer), "transfer data too large");
+    read_action_data(buffer, size);
+
+    datastream<const char*> ds(buffer, size);
+    name from, to;
+    asset quantity;
+    unsigned_int memo_size;
+    ds >> from >> to >> quantity >> memo_size;
+    eosio_assert(memo_size.value <= ds.remaining(), "invalid transfer data");
+
+    T contract(receiver, code, datastream<const char*>(buffer, size));
+    (contract.*handler)(from, to, quantity, string_view(ds.pos(), memo_size.value));
 }
 
-float stof(const char* s) {
-    float rez = 0, fact = 1;
-    if (*s == '-') {
-        s++;
-        fact = -1;
-    }
+/*
+ * Early filter of transfer notifications, called by apply() before the handler reads state or the memo.
+ * Only the fixed size head of the transfer is read, and the token is looked up in the "accepted"
+ * table of receiver, scoped by token contract and keyed by symbol code. Transfers to receiver of
+ * a token not in the table are rejected, and notifications receiver is not a party of are dropped.
+ * Before init there is no state row, so anyone can still deposit anything.
+ * Returns whether the handler should run.
+ */
+inline bool accept_transfer(name receiver, name code) {
+    struct {
+        uint64_t    from;
+        uint64_t    to;
+        int64_t     amount;
+        uint64_t    symbol_raw; /* symbol code in the high 56 bits, precision in the low 8 */
+    } head;
+    if (action_data_size() < sizeof(head)) return true; /* malformed, left to the handler to fail */
+    read_action_data(&head, sizeof(head));
+
+    if (head.from != receiver.value && head.to != receiver.value) return false;
+    if (head.to != receiver.value) return true;
+    if (db_find_i64(receiver.value, receiver.value, "state"_n.value, "state"_n.value) < 0) return true;
+    eosio_assert(db_find_i64(receiver.value, code.value, "accepted"_n.value, head.symbol_raw >> 8) >= 0,
+                 "unlisted token");
+    return true;
+}
 
-    for (int point_seen = 0; *s; s++) {
-        if (*s == '.') {
-            point_seen = 1;
-            continue;
-        }
-
-        int d = *s - '0';
-        if (d >= 0 && d <= 9) {
-            if (point_seen) fact /= 10.0f;
-            rez = rez * 10.0f + (float)d;
-        }
+/* parses a decimal rate into a fixed point rate, digits beyond RATE_DECIMALS are dropped. */
+inline uint128_t parse_fixed_rate(string_view str) {
+    auto point = str.find('.');
+    if (point != string_view::npos && str.length() - point - 1 > RATE_DECIMALS) {
+        str = str.substr(0, point + 1 + RATE_DECIMALS);
     }
-
-    return rez * fact;
+    return parse_decimal<uint128_t>(str, RATE_DECIMALS, 38);
 }
 
-int64_t to_int64(double x) {
+inline int64_t to_int64(double x) {
     eosio_assert(x <= MAX_AMOUNT, "fail max amount overflow validation");
     return int64_t(x);
 }
 
-double amount_to_damount(int64_t amount, uint64_t precision) {
-    return (double(amount) / double(pow(10, precision)));
+inline double amount_to_damount(int64_t amount, uint64_t precision) {
+    return (double(amount) / double(POW10[precision]));
 }
 
-double asset_to_damount(asset quantity) {
-    return (double(quantity.amount) / double(pow(10, quantity.symbol.precision())));
+inline double asset_to_damount(asset quantity) {
+    return (double(quantity.amount) / double(POW10[quantity.symbol.precision()]));
 }
 
-int64_t damount_to_amount(double damount, uint64_t precision) {
-    return to_int64(damount * double(pow(10, precision)));
+inline int64_t damount_to_amount(double damount, uint64_t precision) {
+    return to_int64(damount * double(POW10[precision]));
 }
 
-asset calc_dest(double rate, asset src, symbol dest_symbol) {
+inline asset calc_dest(double rate, asset src, symbol dest_symbol) {
     double src_damount = amount_to_damount(src.amount, src.symbol.precision());
     double dest_damount = src_damount * rate;
     int64_t dest_amount = damount_to_amount(dest_damount, dest_symbol.precision());
 
     return asset(dest_amount, dest_symbol);
 }
+
+inline uint128_t to_fixed_rate(double rate) {
+    if (!(rate > 0)) return 0;
+    if (rate > double(MAX_RATE) * 2) return MAX_FIXED_RATE * 2; /* out of range either way */
+    return uint128_t(rate * double(RATE_UNIT));
+}
+
+inline double from_fixed_rate(uint128_t rate) {
+    return double(rate) / double(RATE_UNIT);
+}
+
+/*
+ * calc_dest with a fixed point rate, in integers only.
+ * src.amount * rate may not fit 128 bits, so the rate is split to whole * RATE_UNIT + fraction.
+ */
+inline asset calc_dest_fixed(uint128_t rate, asset src, symbol dest_symbol) {
+    /* dest amount = src.amount * rate / 10^shift */
+    int shift = RATE_DECIMALS + src.symbol.precision() - dest_symbol.precision();
+    eosio_assert(shift >= 0 && shift <= 2 * RATE_DECIMALS, "unsupported precision");
+    eosio_assert(src.amount >= 0, "src amount can not be negative");
+
+    uint128_t whole = uint128_t(src.amount) * (rate / RATE_UNIT);
+    uint128_t fraction = uint128_t(src.amount) * (rate % RATE_UNIT);
+    uint128_t dest_amount;
+    if (shift >= RATE_DECIMALS) {
+        /* floor((whole * RATE_UNIT + fraction) / 10^shift), floored in two steps */
+        dest_amount = (whole + fraction / RATE_UNIT) / POW10[shift - RATE_DECIMALS];
+    } else {
+        uint128_t scale = POW10[RATE_DECIMALS - shift];
+        eosio_assert(whole <= uint128_t(MAX_AMOUNT) / scale, "fail max amount overflow validation");
+        dest_amount = whole * scale + fraction / POW10[shift];
+    }
+    eosio_assert(dest_amount <= uint128_t(MAX_AMOUNT), "fail max amount overflow validation");
+    return asset(int64_t(dest_amount), dest_symbol);
+}
+
+/* a * b / c of non negative amounts, rounded down or up, the product does not overflow. */
+inline int64_t muldiv(int64_t a, int64_t b, int64_t c, bool round_up = false) {
+    eosio_assert(a >= 0 && b >= 0 && c > 0, "invalid amounts");
+    uint128_t product = uint128_t(a) * uint128_t(b);
+    uint128_t res = product / uint128_t(c);
+    if (round_up && (product % uint128_t(c))) res++;
+    eosio_assert(res <= uint128_t(MAX_AMOUNT), "fail max amount overflow validation");
+    return int64_t(res);
+}
+
+/* fixed point rate of a trade, rounded down, saturated above MAX_FIXED_RATE. */
+inline uint128_t calc_fixed_rate(asset src, asset dest) {
+    eosio_assert(src.amount > 0 && dest.amount >= 0, "invalid trade amounts");
+
+    uint128_t rate = uint128_t(dest.amount) * RATE_UNIT / uint128_t(src.amount);
+    int src_precision = src.symbol.precision();
+    int dest_precision = dest.symbol.precision();
+    if (src_precision >= dest_precision) {
+        uint128_t scale = POW10[src_precision - dest_precision];
+        if (rate > MAX_FIXED_RATE / scale) return MAX_FIXED_RATE + 1;
+        return rate * scale;
+    }
+    return rate / POW10[dest_precision - src_precision];
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <eosiolib/eosio.hpp>
+#include <eosiolib/print.hpp>
+
+/*
+ * Heap statistics of an action, for debug builds compiled with -DHEAP_STATS
+ * (HEAP_STATS=1 scripts/compile.sh). The global operator new/delete are replaced
+ * to count allocations and the peak of live bytes, and heap_report prints them to
+ * the console of the action, where scripts/profiler/profile.js picks them up.
+ * Every action runs in a fresh wasm instance, so the counters start at zero.
+ *
+ * Defines the replacement operators, so include it from one translation unit per contract.
+ * Without HEAP_STATS nothing is replaced and heap_report is empty.
+ */
+
+#ifdef HEAP_STATS
+
+#include <cstdlib>
+
+#define HEAP_HEADER_SIZE 8 /* holds the block size, and keeps the 8 byte alignment of malloc */
+
+struct heap_stats {
+    uint32_t    allocs;
+    uint32_t    live; /* bytes */
+    uint32_t    peak;
+};
+
+static heap_stats heap_stats_inst = {0, 0, 0};
+
+void* operator new(size_t size) {
+    char *block = (char*)malloc(size + HEAP_HEADER_SIZE);
+    eosio_assert(block != nullptr, "out of memory");
+    *(size_t*)block = size;
+
+    heap_stats_inst.allocs++;
+    heap_stats_inst.live += size;
+    if (heap_stats_inst.live > heap_stats_inst.peak) heap_stats_inst.peak = heap_stats_inst.live;
+    return block + HEAP_HEADER_SIZE;
+}
+
+void operator delete(void *ptr) noexcept {
+    if (!ptr) return;
+    char *block = (char*)ptr - HEAP_HEADER_SIZE;
+    heap_stats_inst.live -= *(size_t*)block;
+    free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { operator delete(ptr); }
+
+inline void heap_report() {
+    eosio::print("heap allocs=", heap_stats_inst.allocs, " peak=", heap_stats_inst.peak, "\n");
+}
+
+#else
+
+inline void heap_report() {}
+
+#endif
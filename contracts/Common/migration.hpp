@@ -0,0 +1,64 @@
+#pragma once
+
+#include <eosiolib/eosio.hpp>
+#include <eosiolib/datastream.hpp>
+#include <eosiolib/db.h>
+
+using namespace eosio;
+
+/*
+ * Helpers for in-place table schema migrations.
+ * Rows are read and rewritten through the raw db api, since a multi_index of the
+ * current layout can not deserialize rows that are still in the legacy layout.
+ * A row is only converted when its size matches the legacy layout, so a migration
+ * can be safely resumed or repeated.
+ */
+
+template<typename Legacy, typename Current>
+int64_t bytes_saved_per_row() {
+    return int64_t(pack_size(Legacy())) - int64_t(pack_size(Current()));
+}
+
+template<typename Legacy, typename Current, typename Convert>
+bool migrate_row(int32_t itr, name payer, Convert convert) {
+    auto size = db_get_i64(itr, nullptr, 0);
+    if (size != pack_size(Legacy())) return false;
+
+    vector<char> buffer(size);
+    db_get_i64(itr, buffer.data(), size);
+    Current current = convert(unpack<Legacy>(buffer));
+
+    auto packed = pack(current);
+    db_update_i64(itr, payer.value, packed.data(), packed.size());
+    return true;
+}
+
+/* convert a singleton row, returns whether it was in the legacy layout. */
+template<typename Legacy, typename Current, typename Convert>
+bool migrate_singleton(name code, name singleton_name, Convert convert) {
+    auto itr = db_find_i64(code.value, code.value, singleton_name.value, singleton_name.value);
+    if (itr < 0) return false;
+    return migrate_row<Legacy, Current>(itr, code, convert);
+}
+
+/*
+ * Convert up to limit rows of a table, starting from primary key cursor.
+ * Returns whether the end of the table was reached, otherwise cursor is set to the next key.
+ */
+template<typename Legacy, typename Current, typename Convert>
+bool migrate_table(name code,
+                   uint64_t scope,
+                   name table,
+                   uint64_t &cursor,
+                   uint32_t limit,
+                   uint64_t &migrated,
+                   Convert convert) {
+    auto itr = db_lowerbound_i64(code.value, scope, table.value, cursor);
+    for (uint32_t i = 0; (itr >= 0) && (i < limit); i++) {
+        if (migrate_row<Legacy, Current>(itr, code, convert)) migrated++;
+        uint64_t next_key = 0;
+        itr = db_next_i64(itr, &next_key);
+        cursor = next_key;
+    }
+    return (itr < 0);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <eosiolib/eosio.hpp>
+#include <eosiolib/print.hpp>
+#include <eosiolib/db.h>
+
+using namespace eosio;
+
+/*
+ * RAM usage of a page of one table scope, for the ramreport action of the contracts.
+ * Counts up to limit rows from primary key cursor, sums their serialized sizes, and prints
+ * "ramreport rows=<n> bytes=<b> next=<key>", with next=done once the scope is exhausted.
+ * Rows are read through the raw db api, so any table is reported without knowing its layout.
+ * Secondary index rows are not counted. scripts/ramreport walks every table scope and sums the pages.
+ */
+inline void ram_report(name code, name table, uint64_t scope, uint64_t cursor, uint32_t limit) {
+    eosio_assert(limit > 0, "limit must be positive");
+
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+    auto itr = db_lowerbound_i64(code.value, scope, table.value, cursor);
+    for (uint32_t i = 0; (itr >= 0) && (i < limit); i++) {
+        bytes += db_get_i64(itr, nullptr, 0);
+        rows++;
+        itr = db_next_i64(itr, &cursor);
+    }
+
+    print("ramreport rows=", rows, " bytes=", bytes, " next=");
+    if (itr >= 0) {
+        print(cursor);
+    } else {
+        print("done");
+    }
+    print("\n");
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <eosiolib/eosio.hpp>
+#include <eosiolib/symbol.hpp>
+#include <eosiolib/asset.hpp>
+
+using std::string_view;
+
+/*
+ * Memo parsing on string_view, without heap allocations.
+ * Fields are views into the memo, which must outlive them.
+ */
+
+/* up to N fields of a delimited string, size counts all fields found, even beyond N. */
+template<size_t N>
+struct fields {
+    string_view part[N];
+    size_t      size;
+
+    const string_view& operator[](size_t i) const { return part[i]; }
+};
+
+template<size_t N>
+fields<N> split_fields(string_view str, char delim) {
+    fields<N> res = {};
+    for (size_t prev = 0;;) {
+        size_t pos = str.find(delim, prev);
+        if (res.size < N) res.part[res.size] = str.substr(prev, pos - prev);
+        res.size++;
+        if (pos == string_view::npos) return res;
+        prev = pos + 1;
+    }
+}
+
+/*
+ * parses a decimal string such as "12.34" into an integer of the given precision, without rounding.
+ * max_digits bounds the digits, integer and padded fraction together, so the result can not overflow T.
+ */
+template<typename T>
+T parse_decimal(string_view str, uint8_t precision, size_t max_digits) {
+    size_t point = str.find('.');
+    string_view whole = str.substr(0, point);
+    string_view fraction = (point == string_view::npos) ? string_view() : str.substr(point + 1);
+    eosio_assert(fraction.find('.') == string_view::npos, "invalid amount");
+    eosio_assert(fraction.length() <= precision, "amount precision too high");
+
+    size_t digits = whole.length() + precision;
+    eosio_assert(digits > 0 && digits <= max_digits, "invalid amount");
+
+    T amount = 0;
+    auto add_digits = [&](string_view part) {
+        for (char c : part) {
+            eosio_assert(c >= '0' && c <= '9', "invalid amount");
+            amount = amount * 10 + T(c - '0');
+        }
+    };
+    add_digits(whole);
+    add_digits(fraction);
+    for (size_t i = fraction.length(); i < precision; i++) amount *= 10;
+    return amount;
+}
+
+inline int64_t parse_amount(string_view str, uint8_t precision) {
+    return parse_decimal<int64_t>(str, precision, 18);
+}
+
+/* "<precision> <code>", such as "4 EOS". */
+inline eosio::symbol parse_symbol(string_view str) {
+    auto parts = split_fields<2>(str, ' ');
+    eosio_assert(parts.size == 2, "wrong num of symbol parts");
+    uint8_t precision = uint8_t(parse_decimal<uint32_t>(parts[0], 0, 2));
+    eosio::symbol sym = eosio::symbol(parts[1], precision);
+    eosio_assert(precision <= 18 && sym.is_valid(), "invalid symbol");
+    return sym;
+}
+
+/* "<amount> <code>", such as "1.2345 EOS", the precision is the number of decimals. */
+inline eosio::asset parse_asset(string_view str) {
+    auto parts = split_fields<2>(str, ' ');
+    eosio_assert(parts.size == 2, "invalid asset");
+    size_t point = parts[0].find('.');
+    size_t precision = (point == string_view::npos) ? 0 : parts[0].length() - point - 1;
+    eosio_assert(precision <= 18, "invalid asset");
+    eosio::symbol sym = eosio::symbol(parts[1], uint8_t(precision));
+    eosio_assert(sym.is_valid(), "invalid asset");
+    return eosio::asset(parse_amount(parts[0], uint8_t(precision)), sym);
+}
+
+/* fixed capacity string on the stack, for composing memos without heap allocations. */
+template<size_t N>
+struct fixed_string {
+    char    data[N];
+    size_t  size = 0;
+
+    void push_back(char c) {
+        eosio_assert(size < N, "string too long");
+        data[size++] = c;
+    }
+
+    fixed_string& operator+=(string_view str) {
+        eosio_assert(str.length() <= N - size, "string too long");
+        for (char c : str) data[size++] = c;
+        return *this;
+    }
+
+    fixed_string& operator+=(char c) {
+        push_back(c);
+        return *this;
+    }
+
+    operator string_view() const { return string_view(data, size); }
+};
+
+/* appends the decimal digits of value, for composing memos without std::to_string. */
+template<typename S>
+void append_uint(S &str, uint64_t value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = char('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) str.push_back(digits[--n]);
+}
+
+/* appends a non negative quantity in the format parse_asset reads. */
+template<typename S>
+void append_asset(S &str, const eosio::asset &quantity) {
+    eosio_assert(quantity.amount >= 0, "negative quantity");
+    uint8_t precision = quantity.symbol.precision();
+
+    /* digits from the least significant, padded so there is one before the point */
+    char digits[20];
+    size_t n = 0;
+    uint64_t value = uint64_t(quantity.amount);
+    do {
+        digits[n++] = char('0' + value % 10);
+        value /= 10;
+    } while (value || n <= precision);
+    while (n) {
+        if (n == precision) str.push_back('.');
+        str.push_back(digits[--n]);
+    }
+
+    str.push_back(' ');
+    uint64_t code = quantity.symbol.code().raw();
+    for (; code; code >>= 8) str.push_back(char(code & 0xff));
+}
+
+/* appends the account name as name::to_string writes it, without its string. */
+template<typename S>
+void append_name(S &str, eosio::name account) {
+    static const char charmap[] = ".12345abcdefghijklmnopqrstuvwxyz";
+    char chars[13];
+    uint64_t value = account.value;
+    for (int i = 12; i >= 0; i--) {
+        /* the 13th char has 4 bits, the others 5 */
+        uint64_t mask = (i == 12) ? 0x0f : 0x1f;
+        chars[i] = charmap[value & mask];
+        value >>= (i == 12) ? 4 : 5;
+    }
+    size_t length = 13;
+    while (length && chars[length - 1] == '.') length--;
+    for (size_t i = 0; i < length; i++) str.push_back(chars[i]);
+}
@@ -6,59 +6,56 @@
 #include <eosiolib/asset.hpp>
 #include <eosiolib/singleton.hpp>
 #include "../Common/common.hpp"
+#include "maintenance.hpp"
 
 CONTRACT ClearAmmReserve : public contract {
     public:
         using contract::contract;
 
-        TABLE state {
-            name        admin;
-            name        network_contract;
-            symbol      token_symbol;
-            name        token_contract;
-            name        eos_contract;
-            bool        trade_enabled;
-        };
+        /**
+         * Erase all reserve tables, up to limit rows per call.
+         * Should be called repeatedly until it reports "clear done".
+         *
+         * @param limit - maximum number of rows to erase in this call.
+         */
+        ACTION clear(uint32_t limit) {
+            require_auth(_self);
+            eosio_assert(limit > 0, "limit must be positive");
 
-        TABLE params {
-            double      r;
-            double      p_min;
-            asset       max_eos_cap_buy;
-            asset       max_eos_cap_sell;
-            double      profit_percent;
-            double      ram_fee;
-            double      max_buy_rate;
-            double      min_buy_rate;
-            double      max_sell_rate;
-            double      min_sell_rate;
-            name        fee_wallet;
-        };
+            uint32_t budget = limit;
+            uint64_t erased = 0;
 
-        TABLE rate {
-            double      stored_rate;
-            asset       dest;
-        };
-
-        typedef eosio::singleton<"state"_n, state> state_type;
-        typedef eosio::singleton<"params"_n, params> params_type;
-        typedef eosio::singleton<"rate"_n, rate> rate_type;
-
-        ACTION clear() {
-
-            state_type state_inst(_self, _self.value);
-            if(state_inst.exists()) {
-                state_inst.remove();
+            /* accepted is scoped by token contract, state holds those of the primary token and eos */
+            bool done = true;
+            uint64_t head[5]; /* admin, network, token symbol, token contract, eos contract */
+            auto state_itr = db_find_i64(_self.value, _self.value, "state"_n.value, "state"_n.value);
+            if (state_itr >= 0) {
+                db_get_i64(state_itr, head, sizeof(head));
+                done = erase_row(_self, head[3], "accepted"_n, head[2] >> 8, budget, erased) &&
+                       erase_row(_self, head[4], "accepted"_n, EOS_SYMBOL.code().raw(), budget, erased);
             }
+            done = done && erase_singleton(_self, "state"_n, budget, erased) &&
+                           erase_singleton(_self, "params"_n, budget, erased) &&
+                           erase_singleton(_self, "rate"_n, budget, erased) &&
+                           erase_singleton(_self, "maxsrc"_n, budget, erased) &&
+                           erase_singleton(_self, "srcamt"_n, budget, erased) &&
+                           erase_singleton(_self, "inventory"_n, budget, erased) &&
+                           erase_singleton(_self, "spot"_n, budget, erased) &&
+                           erase_singleton(_self, "configseq"_n, budget, erased);
 
-            params_type params_inst(_self, _self.value);
-            if(params_inst.exists()) {
-                params_inst.remove();
+            /* curves added with addcurve, after the rows in their scope */
+            uint64_t key;
+            while (done && first_key_from(_self, _self.value, "curves"_n, 0, key)) {
+                db_get_i64(db_find_i64(_self.value, _self.value, "curves"_n.value, key), head, 2 * sizeof(uint64_t));
+                done = erase_row(_self, head[1], "accepted"_n, key >> 8, budget, erased) &&
+                       erase_singleton(_self, key, "params"_n, budget, erased) &&
+                       erase_singleton(_self, key, "inventory"_n, budget, erased) &&
+                       erase_singleton(_self, key, "spot"_n, budget, erased) &&
+                       erase_row(_self, _self.value, "curves"_n, key, budget, erased);
             }
 
-            rate_type rate_inst(_self, _self.value);
-            if(rate_inst.exists()) {
-                rate_inst.remove();
-            }
+            print("erased ", erased, " rows\n");
+            print(done ? "clear done\n" : "clear in progress\n");
         }
 };
 
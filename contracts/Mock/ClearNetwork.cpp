@@ -6,71 +6,236 @@
 #include <eosiolib/asset.hpp>
 #include <eosiolib/singleton.hpp>
 #include "../Common/common.hpp"
+#include "maintenance.hpp"
+
+#define CLEAR_EOS_VAULT 0
+#define CLEAR_TOKEN_VAULT 1
+#define CLEAR_TOKENSTATS 2
+#define CLEAR_RESHEALTH 3
+#define CLEAR_ACCEPTED 4
+#define CLEAR_RESERVESPERT 5
+#define CLEAR_RESERVE 6
+#define CLEAR_TRUSTEDRES 7
+#define CLEAR_CANDLES 8
+#define CLEAR_PRICEFEED 9
+#define CLEAR_TICKETS 10
+#define CLEAR_TRADEFEED 11
+#define CLEAR_BATCH_ORDERS 12
+#define CLEAR_BATCHES 13
+#define CLEAR_SINGLETONS 14
+#define CLEAR_DONE 15
 
 CONTRACT ClearNetwork : public contract {
     public:
         using contract::contract;
 
-        TABLE state {
-            name        admin;
-            name        eos_contract;
-            name        listener;
-            bool        enabled;
-            bool        during_trade;
-        };
-
-        TABLE reserve {
-            name        contract;
-            uint64_t    num_tokens;
-            uint64_t    primary_key() const { return contract.value; }
+        /* progress of clear, persisted between calls. */
+        TABLE clearprog {
+            uint8_t     stage;
+            uint64_t    scope;
+            uint64_t    cursor;
+            uint64_t    erased;
         };
 
-        TABLE reservespert {
-            symbol          symbol;
-            name            token_contract;
-            vector<name>    reserve_contracts;
-            uint64_t        primary_key() const { return symbol.raw(); }
+        /* progress of prune, persisted between calls. */
+        TABLE pruneprog {
+            uint64_t    cursor;
+            uint64_t    erased;
         };
 
-        TABLE tokenstats {
-            asset           token_counter;
-            asset           eos_counter;
-            uint64_t        primary_key() const { return token_counter.symbol.raw(); }
-        };
+        typedef eosio::singleton<"clearprog"_n, clearprog> clearprog_type;
+        typedef eosio::singleton<"pruneprog"_n, pruneprog> pruneprog_type;
 
-        TABLE rate {
-            double      stored_rate;
-            asset       dest;
-        };
+        /**
+         * Erase all network tables, up to limit rows per call.
+         * Should be called repeatedly until it reports "clear done".
+         *
+         * @param limit - maximum number of rows to erase in this call.
+         */
+        ACTION clear(uint32_t limit) {
+            require_auth(_self);
+            eosio_assert(limit > 0, "limit must be positive");
 
-        typedef eosio::singleton<"state"_n, state> state_type;
-        typedef eosio::multi_index<"reserve"_n, reserve> reserves_type;
-        typedef eosio::multi_index<"reservespert"_n, reservespert> reservespert_type;
-        typedef eosio::multi_index<"tokenstats"_n, tokenstats> tokenstats_type;
-        typedef eosio::singleton<"rate"_n, rate> rate_type;
+            clearprog_type clearprog_inst(_self, _self.value);
+            auto progress = clearprog_inst.get_or_default();
+            uint64_t erased_before = progress.erased;
+            uint32_t budget = limit;
 
-        ACTION clear() {
+            while (progress.stage < CLEAR_DONE) {
+                if (!clear_stage(progress, budget)) break;
+                progress.stage++;
+            }
 
-            state_type state_inst(_self, _self.value);
-            if(state_inst.exists()) {
-                state_inst.remove();
+            print("erased ", progress.erased - erased_before, " rows, ", progress.erased, " in total\n");
+            if (progress.stage == CLEAR_DONE) {
+                if (clearprog_inst.exists()) clearprog_inst.remove();
+                print("clear done\n");
+            } else {
+                clearprog_inst.set(progress, _self);
+                print("clear in progress, at stage ", uint32_t(progress.stage), "\n");
             }
+        }
+
+        /**
+         * Erase token stats, price feed and candles of tokens that are no longer listed,
+         * examining up to limit rows per call.
+         * Should be called repeatedly until it reports "prune done".
+         *
+         * @param limit - maximum number of rows to examine or erase in this call.
+         */
+        ACTION prune(uint32_t limit) {
+            require_auth(_self);
+            eosio_assert(limit > 0, "limit must be positive");
 
-            rate_type rate_inst(_self, _self.value);
-            if(rate_inst.exists()) {
-                rate_inst.remove();
+            pruneprog_type pruneprog_inst(_self, _self.value);
+            auto progress = pruneprog_inst.get_or_default();
+            uint64_t erased_before = progress.erased;
+            uint32_t budget = limit;
+
+            bool done = false;
+            uint64_t symbol_raw;
+            while (budget) {
+                if (!first_key_from(_self, _self.value, "tokenstats"_n, progress.cursor, symbol_raw)) {
+                    done = true;
+                    break;
+                }
+                if (db_find_i64(_self.value, _self.value, "reservespert"_n.value, symbol_raw) >= 0 ||
+                    db_lowerbound_i64(_self.value, symbol_raw, "vault"_n.value, 0) >= 0) {
+                    /* still listed, or still held in the vault, keep it */
+                    budget--;
+                    progress.cursor = symbol_raw + 1;
+                    continue;
+                }
+
+                uint64_t candles_cursor = 0;
+                if (!erase_rows(_self, symbol_raw, "candles"_n, candles_cursor, budget, progress.erased)) break;
+
+                auto feed_itr = db_find_i64(_self.value, _self.value, "pricefeed"_n.value, symbol_raw);
+                if (feed_itr >= 0) {
+                    db_remove_i64(feed_itr);
+                    progress.erased++;
+                }
+
+                db_remove_i64(db_find_i64(_self.value, _self.value, "tokenstats"_n.value, symbol_raw));
+                progress.erased++;
+                if (budget) budget--;
+                progress.cursor = symbol_raw + 1;
             }
 
-            tokenstats_type tokenstats_table_inst(_self, _self.value);
-            auto itr = tokenstats_table_inst.find(symbol("CUSD",2).raw());
-            if (itr != tokenstats_table_inst.end()){
-                tokenstats_table_inst.erase(itr);
-            };
+            print("erased ", progress.erased - erased_before, " rows, ", progress.erased, " in total\n");
+            if (done) {
+                if (pruneprog_inst.exists()) pruneprog_inst.remove();
+                print("prune done\n");
+            } else {
+                pruneprog_inst.set(progress, _self);
+                print("prune in progress, next key ", progress.cursor, "\n");
+            }
+        }
 
-            itr = tokenstats_table_inst.find(symbol("IQ",3).raw());
-            if (itr != tokenstats_table_inst.end()){
-                tokenstats_table_inst.erase(itr);
-            };
+    private:
+        /* returns whether the stage is done, otherwise the budget ran out. */
+        bool clear_stage(clearprog &progress, uint32_t &budget) {
+            switch (progress.stage) {
+                case CLEAR_EOS_VAULT:
+                    return erase_rows(_self, EOS_SYMBOL.raw(), "vault"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_TOKEN_VAULT: {
+                    /* vault is scoped by token symbol, token stats are kept for every token ever listed. */
+                    uint64_t symbol_raw;
+                    while (first_key_from(_self, _self.value, "tokenstats"_n, progress.scope, symbol_raw)) {
+                        if (!erase_rows(_self, symbol_raw, "vault"_n, progress.cursor, budget, progress.erased)) {
+                            progress.scope = symbol_raw;
+                            return false;
+                        }
+                        progress.scope = symbol_raw + 1;
+                    }
+                    progress.scope = 0;
+                    return true;
+                }
+                case CLEAR_TOKENSTATS:
+                    return erase_rows(_self, _self.value, "tokenstats"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_RESHEALTH: {
+                    /* health is scoped by token symbol, and only kept for listed pairs. */
+                    uint64_t symbol_raw;
+                    while (first_key_from(_self, _self.value, "reservespert"_n, progress.scope, symbol_raw)) {
+                        if (!erase_rows(_self, symbol_raw, "reshealth"_n, progress.cursor, budget, progress.erased)) {
+                            progress.scope = symbol_raw;
+                            return false;
+                        }
+                        progress.scope = symbol_raw + 1;
+                    }
+                    progress.scope = 0;
+                    return true;
+                }
+                case CLEAR_ACCEPTED: {
+                    /* accepted is scoped by token contract, the second field of a reservespert row and of state. */
+                    uint64_t symbol_raw;
+                    uint64_t head[2];
+                    while (first_key_from(_self, _self.value, "reservespert"_n, progress.scope, symbol_raw)) {
+                        db_get_i64(db_find_i64(_self.value, _self.value, "reservespert"_n.value, symbol_raw),
+                                   head, sizeof(head));
+                        if (!erase_row(_self, head[1], "accepted"_n, symbol_raw >> 8, budget, progress.erased)) {
+                            progress.scope = symbol_raw;
+                            return false;
+                        }
+                        progress.scope = symbol_raw + 1;
+                    }
+                    progress.scope = 0;
+                    auto state_itr = db_find_i64(_self.value, _self.value, "state"_n.value, "state"_n.value);
+                    if (state_itr < 0) return true;
+                    db_get_i64(state_itr, head, sizeof(head));
+                    return erase_row(_self, head[1], "accepted"_n, EOS_SYMBOL.code().raw(), budget, progress.erased);
+                }
+                case CLEAR_RESERVESPERT:
+                    return erase_rows(_self, _self.value, "reservespert"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_RESERVE:
+                    return erase_rows(_self, _self.value, "reserve"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_TRUSTEDRES:
+                    return erase_rows(_self, _self.value, "trustedres"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_CANDLES: {
+                    /* candles are scoped by token symbol, so walk the symbols in the price feed. */
+                    uint64_t symbol_raw;
+                    while (first_key_from(_self, _self.value, "pricefeed"_n, progress.scope, symbol_raw)) {
+                        if (!erase_rows(_self, symbol_raw, "candles"_n, progress.cursor, budget, progress.erased)) {
+                            progress.scope = symbol_raw;
+                            return false;
+                        }
+                        progress.scope = symbol_raw + 1;
+                    }
+                    progress.scope = 0;
+                    return true;
+                }
+                case CLEAR_PRICEFEED:
+                    return erase_rows(_self, _self.value, "pricefeed"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_TICKETS:
+                    return erase_idx64_rows(_self, _self.value, "tickets"_n, budget, progress.erased) &&
+                           erase_rows(_self, _self.value, "tickets"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_TRADEFEED:
+                    return erase_rows(_self, _self.value, "tradefeed"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_BATCH_ORDERS: {
+                    /* orders and batch quotes are scoped by token symbol, walk the tokens in batch mode. */
+                    uint64_t symbol_raw;
+                    while (first_key_from(_self, _self.value, "batches"_n, progress.scope, symbol_raw)) {
+                        uint64_t quotes_cursor = 0;
+                        if (!erase_rows(_self, symbol_raw, "orders"_n, progress.cursor, budget, progress.erased) ||
+                            !erase_rows(_self, symbol_raw, "batchquotes"_n, quotes_cursor, budget, progress.erased)) {
+                            progress.scope = symbol_raw;
+                            return false;
+                        }
+                        progress.scope = symbol_raw + 1;
+                    }
+                    progress.scope = 0;
+                    return true;
+                }
+                case CLEAR_BATCHES:
+                    return erase_rows(_self, _self.value, "batches"_n, progress.cursor, budget, progress.erased);
+                case CLEAR_SINGLETONS:
+                    return erase_singleton(_self, "state"_n, budget, progress.erased) &&
+                           erase_singleton(_self, "rate"_n, budget, progress.erased) &&
+                           erase_singleton(_self, "maxsrc"_n, budget, progress.erased) &&
+                           erase_singleton(_self, "migration"_n, budget, progress.erased) &&
+                           erase_singleton(_self, "feedseq"_n, budget, progress.erased);
+            }
+            return true;
         }
 };
 
@@ -79,7 +244,7 @@ extern "C" {
     [[noreturn]] void apply(uint64_t receiver, uint64_t code, uint64_t action) {
         if (code == receiver) {
             switch (action) {
-                EOSIO_DISPATCH_HELPER(ClearNetwork, (clear))
+                EOSIO_DISPATCH_HELPER(ClearNetwork, (clear)(prune))
             }
         }
         eosio_exit(0);
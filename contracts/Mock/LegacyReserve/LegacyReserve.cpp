@@ -0,0 +1,39 @@
+#include <eosiolib/eosio.hpp>
+#include <eosiolib/asset.hpp>
+#include <eosiolib/singleton.hpp>
+
+using namespace eosio;
+
+#define LEGACY_RATE 0.000001 /* below any curve in the tests, so trades never pick it */
+
+/*
+ * A reserve deployed before the rate row carried a reason, for testing that the network
+ * still reads its quotes. It quotes LEGACY_RATE for any src, and stores dest as an asset.
+ */
+CONTRACT LegacyReserve : public contract {
+    public:
+        using contract::contract;
+
+        TABLE rate {
+            double      stored_rate;
+            asset       dest;
+        };
+
+        typedef eosio::singleton<"rate"_n, rate> rate_type;
+
+        ACTION getconvrate(asset src, symbol dest_symbol) {
+            rate_type rate_inst(_self, _self.value);
+            rate_inst.set({LEGACY_RATE, asset(int64_t(src.amount * LEGACY_RATE), dest_symbol)}, _self);
+        }
+};
+
+extern "C" {
+    [[noreturn]] void apply(uint64_t receiver, uint64_t code, uint64_t action) {
+        if (code == receiver) {
+            switch (action) {
+                EOSIO_DISPATCH_HELPER( LegacyReserve, (getconvrate))
+            }
+        }
+        eosio_exit(0);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <eosiolib/eosio.hpp>
+#include <eosiolib/db.h>
+
+using namespace eosio;
+
+/*
+ * Chunked table maintenance helpers for the Clear contracts.
+ * They use the raw db api, so rows can be erased regardless of the layout they were
+ * written with, and they stop after a row budget so large tables can be handled over
+ * several transactions, resuming from a persisted cursor.
+ */
+
+/*
+ * Erase rows of table in scope, starting from primary key cursor, while budget lasts.
+ * Returns whether the end of the table was reached (cursor is then reset to 0),
+ * otherwise cursor holds the next primary key to erase.
+ */
+bool erase_rows(name code, uint64_t scope, name table, uint64_t &cursor, uint32_t &budget, uint64_t &erased) {
+    auto itr = db_lowerbound_i64(code.value, scope, table.value, cursor);
+    while (itr >= 0) {
+        if (!budget) return false;
+
+        uint64_t next_key = 0;
+        auto next_itr = db_next_i64(itr, &next_key);
+        db_remove_i64(itr);
+        budget--;
+        erased++;
+
+        itr = next_itr;
+        cursor = next_key;
+    }
+    cursor = 0;
+    return true;
+}
+
+/*
+ * Erase the entries of the first uint64 secondary index of table in scope, while budget lasts.
+ * The raw api does not erase them along with the primary rows, as multi_index does.
+ * Returns whether all entries were erased.
+ */
+bool erase_idx64_rows(name code, uint64_t scope, name table, uint32_t &budget, uint64_t &erased) {
+    uint64_t index_table = table.value & 0xFFFFFFFFFFFFFFF0ULL; /* index number 0, as multi_index names it */
+    uint64_t secondary = 0;
+    uint64_t primary;
+    auto itr = db_idx64_lowerbound(code.value, scope, index_table, &secondary, &primary);
+    while (itr >= 0) {
+        if (!budget) return false;
+
+        auto next_itr = db_idx64_next(itr, &primary);
+        db_idx64_remove(itr);
+        budget--;
+        erased++;
+        itr = next_itr;
+    }
+    return true;
+}
+
+/* erase the row of key if it exists, returns false only when out of budget. */
+bool erase_row(name code, uint64_t scope, name table, uint64_t key, uint32_t &budget, uint64_t &erased) {
+    auto itr = db_find_i64(code.value, scope, table.value, key);
+    if (itr < 0) return true;
+    if (!budget) return false;
+    db_remove_i64(itr);
+    budget--;
+    erased++;
+    return true;
+}
+
+/* erase a singleton row if it exists, returns false only when out of budget. */
+bool erase_singleton(name code, uint64_t scope, name singleton_name, uint32_t &budget, uint64_t &erased) {
+    return erase_row(code, scope, singleton_name, singleton_name.value, budget, erased);
+}
+
+bool erase_singleton(name code, name singleton_name, uint32_t &budget, uint64_t &erased) {
+    return erase_singleton(code, code.value, singleton_name, budget, erased);
+}
+
+/* finds the primary key of the first row at or after cursor, returns false if there is none. */
+bool first_key_from(name code, uint64_t scope, name table, uint64_t cursor, uint64_t &key) {
+    auto itr = db_lowerbound_i64(code.value, scope, table.value, cursor);
+    if (itr < 0) return false;
+
+    /* no api returns the key of an iterator, so step forward and back to read it. */
+    uint64_t ignored;
+    auto next_itr = db_next_i64(itr, &ignored);
+    db_previous_i64(next_itr, &key);
+    return true;
+}
@@ -1,5 +1,4 @@
 #include "Network.hpp"
-#include <math.h>
 
 ACTION Network::init(name admin, name eos_contract, name listener, bool enable) {
     eosio_assert(is_account(admin), "admin account does not exist");
@@ -10,8 +9,10 @@ ACTION Network::init(name admin, name eos_contract, name listener, bool enable)
     state_type state_inst(_self, _self.value);
     eosio_assert(!state_inst.exists(), "init already called");
 
-    state new_state = {admin, eos_contract, listener, enable, false};
+    state new_state = {admin, eos_contract, listener, uint8_t(SCHEMA_VERSION << SCHEMA_VERSION_SHIFT)};
+    new_state.set_flag(STATE_ENABLED, enable);
     state_inst.set(new_state, _self);
+    set_accepted(eos_contract, EOS_SYMBOL.code(), true);
 }
 
 ACTION Network::setadmin(name admin) {
@@ -22,14 +23,16 @@ ACTION Network::setadmin(name admin) {
     auto s = state_inst.get();
     s.admin = admin;
     state_inst.set(s, _self);
+    bump_config_seq();
 }
 
 ACTION Network::setenable(bool enable) {
     auto state_inst = get_state_assert_admin();
 
     auto s = state_inst.get();
-    s.enabled = enable;
+    s.set_flag(STATE_ENABLED, enable);
     state_inst.set(s, _self);
+    bump_config_seq();
 }
 
 ACTION Network::setlistener(name listener) {
@@ -38,6 +41,7 @@ ACTION Network::setlistener(name listener) {
     auto s = state_inst.get();
     s.listener = listener;
     state_inst.set(s, _self);
+    bump_config_seq();
 }
 
 ACTION Network::addreserve(name reserve, bool add) {
@@ -59,66 +63,53 @@ ACTION Network::addreserve(name reserve, bool add) {
         eosio_assert(itr->num_tokens == 0, "reserve has listed tokens");
         reserves_inst.erase(itr);
     }
+    bump_config_seq();
 }
 
-ACTION Network::listpairres(name reserve, symbol token_symbol, name token_contract, bool add) {
-    eosio_assert(is_account(token_contract), "token contract does not exist");
-
+ACTION Network::settrusted(name reserve, bool trusted) {
     get_state_assert_admin();
 
     reserves_type reserves_inst(_self, _self.value);
-    auto res_itr = reserves_inst.find(reserve.value);
-    eosio_assert(res_itr != reserves_inst.end(), "invalid reserve");
-    reserves_inst.modify(res_itr, _self, [&](auto& s) {
-        s.num_tokens += (add ? 1 : -1);
-    });
-
-    reservespert_type reservespert_table_inst(_self, _self.value);
-    auto itr = reservespert_table_inst.find(token_symbol.raw());
-    auto token_exists = (itr != reservespert_table_inst.end());
-
-    if (add) {
-        if (!token_exists) {
-            reservespert_table_inst.emplace(_self, [&](auto& s) {
-               s.symbol = token_symbol;
-               s.token_contract = token_contract;
-               s.reserve_contracts.push_back(reserve);
-            });
-        } else {
-            reservespert_table_inst.modify(itr, _self, [&](auto& s) {
-                auto res_it = find(s.reserve_contracts.begin(), s.reserve_contracts.end(), reserve);
-                eosio_assert(res_it == s.reserve_contracts.end(), "already listed in reserve");
-                s.reserve_contracts.push_back(reserve);
-            });
-        }
-    } else {
-        eosio_assert(token_exists, "not listed at all");
-        bool last_reserve_for_token = false;
-        reservespert_table_inst.modify(itr, _self, [&](auto& s) {
-            auto res_it = find(s.reserve_contracts.begin(), s.reserve_contracts.end(), reserve);
-            eosio_assert(res_it != s.reserve_contracts.end(), "not listed in reserve");
-            s.reserve_contracts.erase(res_it);
-            if (!s.reserve_contracts.size()) {
-                last_reserve_for_token = true;
-            }
+    eosio_assert(reserves_inst.find(reserve.value) != reserves_inst.end(), "invalid reserve");
+
+    trusted_type trusted_table_inst(_self, _self.value);
+    auto itr = trusted_table_inst.find(reserve.value);
+    bool exists = (itr != trusted_table_inst.end());
+    if (trusted && !exists) {
+        trusted_table_inst.emplace(_self, [&](auto& s) {
+            s.reserve = reserve;
         });
-        if (last_reserve_for_token) {
-            reservespert_table_inst.erase(itr);
-        }
+    } else if (!trusted && exists) {
+        trusted_table_inst.erase(itr);
     }
+    bump_config_seq();
+}
 
-    /* Note: token stats entries are never deleted, so we can continue count on re-list. */
-    if (add && !token_exists) {
-        tokenstats_type tokenstats_table_inst(_self, _self.value);
-        if (tokenstats_table_inst.find(token_symbol.raw()) == tokenstats_table_inst.end()) {
-            tokenstats_table_inst.emplace(_self, [&](auto& s) {
-               s.token_counter = asset(0, token_symbol);
-               s.eos_counter = asset(0, EOS_SYMBOL);
-            });
-        }
+ACTION Network::listpairres(name reserve, symbol token_symbol, name token_contract, bool add) {
+    vector<listing> listings = {{reserve, token_symbol, token_contract, add}};
+    list_pairs(listings, false);
+}
+
+ACTION Network::listpairs(vector<listing> listings) {
+    eosio_assert(!listings.empty(), "no listings");
+    eosio_assert(listings.size() <= MAX_LISTINGS_PER_BATCH, "too many listings");
+    list_pairs(listings, true);
+}
+
+ACTION Network::resync() {
+    auto state_inst = get_state_assert_admin();
+    set_accepted(state_inst.get().eos_contract, EOS_SYMBOL.code(), true);
+
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    for (auto itr = reservespert_table_inst.begin(); itr != reservespert_table_inst.end(); itr++) {
+        set_accepted(itr->token_contract, itr->symbol.code(), true);
     }
 }
 
+ACTION Network::ramreport(name table, uint64_t scope, uint64_t cursor, uint32_t limit) {
+    ram_report(_self, table, scope, cursor, limit);
+}
+
 ACTION Network::withdraw(name to, asset quantity, name dest_contract, string memo) {
     eosio_assert(is_account(to), "to account does not exist");
     eosio_assert(is_account(dest_contract), "dest contract does not exist");
@@ -129,6 +120,137 @@ ACTION Network::withdraw(name to, asset quantity, name dest_contract, string mem
     async_pay(_self, to, quantity, dest_contract, memo);
 }
 
+ACTION Network::vaultwd(name owner, asset quantity) {
+    require_auth(owner);
+    eosio_assert(quantity.is_valid() && quantity.amount > 0, "illegal quantity");
+
+    name token_contract = vault_sub(owner, quantity);
+    async_pay(_self, owner, quantity, token_contract, VAULT_WITHDRAW_MEMO);
+}
+
+ACTION Network::tradeint(name owner, asset src, symbol dest_symbol, double min_conversion_rate) {
+    require_auth(owner);
+
+    state_type state_inst(_self, _self.value);
+    eosio_assert(state_inst.exists(), "init not called yet");
+    auto state = state_inst.get();
+    eosio_assert(state.schema_version() == SCHEMA_VERSION, "table migration pending");
+    eosio_assert(state.enabled(), "trade not enabled");
+    reentrancy_check(true);
+
+    eosio_assert(src.is_valid(), "invalid src");
+    eosio_assert(src.amount > 0, "src must be positive");
+    eosio_assert(src.symbol == EOS_SYMBOL || dest_symbol == EOS_SYMBOL, "no eos side");
+    eosio_assert(src.symbol != dest_symbol, "src symbol can not equal dest symbol");
+
+    vault_type vault_table_inst(_self, src.symbol.raw());
+    auto itr = vault_table_inst.find(owner.value);
+    eosio_assert(itr != vault_table_inst.end() && itr->balance >= src, "insufficient vault balance");
+
+    symbol token_symbol = (src.symbol == EOS_SYMBOL) ? dest_symbol : src.symbol;
+    assert_not_batched(token_symbol);
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
+
+    async_search_best_rate(token_entry, src, true);
+    SEND_INLINE_ACTION(*this, tradeint2, {_self, "active"_n},
+                       {owner, src, dest_symbol, to_fixed_rate(min_conversion_rate)});
+}
+
+ACTION Network::tradeint2(name owner, asset src, symbol dest_symbol, uint128_t min_conversion_rate) {
+    require_auth(_self);  // can only be called internally
+    assert_not_batched((src.symbol == EOS_SYMBOL) ? dest_symbol : src.symbol);
+
+    uint128_t best_rate;
+    int64_t best_dest_amount;
+    name best_reserve;
+    get_best_rate_results(src, dest_symbol, best_rate, best_dest_amount, best_reserve);
+    eosio_assert(best_rate != 0, "got 0 rate.");
+    eosio_assert(best_rate >= min_conversion_rate, "rate < min conversion rate.");
+    eosio_assert(best_rate <= MAX_FIXED_RATE, "rate > max rate.");
+
+    asset dest = calc_dest_fixed(best_rate, src, dest_symbol);
+    dest.amount = std::min(dest.amount, best_dest_amount);
+    eosio_assert(dest.amount > 0, "got 0 dest.");
+
+    /* the reserve is paid within the vault, and pays dest from its internal balance with vaultpay. */
+    name src_contract = vault_sub(owner, src);
+    vault_add(best_reserve, src, src_contract);
+    asset balance_pre = vault_balance(owner, dest_symbol);
+
+    action {permission_level{_self, "active"_n},
+            best_reserve,
+            "vaulttrade"_n,
+            make_tuple(owner, src, dest)}.send();
+    SEND_INLINE_ACTION(*this, tradeint3, {_self, "active"_n}, {best_reserve, owner, src, dest, balance_pre});
+}
+
+ACTION Network::tradeint3(name reserve, name owner, asset src, asset dest, asset balance_pre) {
+    require_auth(_self);  // can only be called internally
+
+    /* as in trade2, verify dest was indeed added, here to the owner's internal balance */
+    asset balance_diff = vault_balance(owner, dest.symbol) - balance_pre;
+    eosio_assert(balance_diff >= dest, "trade dest amount not added.");
+
+    record_trade(reserve, owner, src, dest);
+    end_trade(reserve, owner, src, dest);
+}
+
+ACTION Network::vaultpay(name reserve, name to, asset quantity) {
+    require_auth(reserve);
+    eosio_assert(quantity.is_valid() && quantity.amount > 0, "illegal quantity");
+
+    /* only a listed reserve settling a tradeint, see tradeint3 */
+    state_type state_inst(_self, _self.value);
+    eosio_assert(state_inst.exists() && state_inst.get().during_trade(), "not during a trade");
+    reserves_type reserves_table_inst(_self, _self.value);
+    eosio_assert(reserves_table_inst.find(reserve.value) != reserves_table_inst.end(), "not a listed reserve");
+
+    name token_contract = vault_sub(reserve, quantity);
+    vault_add(to, quantity, token_contract);
+}
+
+ACTION Network::migrate(uint32_t limit) {
+    eosio_assert(limit > 0, "limit must be positive");
+
+    auto state_inst = get_state_assert_admin();
+    auto current_state = state_inst.get();
+    eosio_assert(current_state.schema_version() < SCHEMA_VERSION, "already migrated");
+
+    if (migrate_singleton<legacy_rate, rate>(_self, "rate"_n, [](const legacy_rate &l) {
+            return rate{l.stored_rate, l.dest.amount};
+        })) {
+        print("rate: 1 rows converted, ", bytes_saved_per_row<legacy_rate, rate>(),
+              " bytes saved per row\n");
+    }
+
+    migration_type migration_inst(_self, _self.value);
+    auto progress = migration_inst.get_or_default();
+    bool done = migrate_table<legacy_tokenstats, tokenstats>(
+        _self, _self.value, "tokenstats"_n, progress.cursor, limit, progress.rows,
+        [](const legacy_tokenstats &l) {
+            return tokenstats{l.token_counter.symbol, l.token_counter.amount, l.eos_counter.amount};
+        });
+    print("tokenstats: ", progress.rows, " rows converted, ",
+          bytes_saved_per_row<legacy_tokenstats, tokenstats>(), " bytes saved per row\n");
+
+    if (!done) {
+        migration_inst.set(progress, _self);
+        print("migration in progress, next key ", progress.cursor, "\n");
+        return;
+    }
+
+    /* reading a legacy state row yields the enabled flag, during_trade is never set between actions. */
+    current_state.flags = uint8_t((current_state.flags & STATE_ENABLED) |
+                                  (SCHEMA_VERSION << SCHEMA_VERSION_SHIFT));
+    state_inst.set(current_state, _self);
+    print("state: 1 rows converted, ", bytes_saved_per_row<legacy_state, state>(),
+          " bytes saved per row\n");
+
+    if (migration_inst.exists()) migration_inst.remove();
+    print("migration done\n");
+}
+
 ACTION Network::getexprate(asset src, symbol dest_symbol) {
     eosio_assert(src.is_valid(), "invalid transfer");
     eosio_assert(src.amount >= 0, "src amount can not be negative");
@@ -138,37 +260,410 @@ ACTION Network::getexprate(asset src, symbol dest_symbol) {
 
     reservespert_type reservespert_table_inst(_self, _self.value);
     auto token_symbol = (src.symbol == EOS_SYMBOL) ? dest_symbol: src.symbol;
-    auto token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
 
-    async_search_best_rate(token_entry, src);
+    async_search_best_rate(token_entry, src, false);
     SEND_INLINE_ACTION(*this, storeexprate, {_self, "active"_n}, {src, dest_symbol});
 }
 
+ACTION Network::getticket(name owner, asset src, symbol dest_symbol) {
+    require_auth(owner);
+    eosio_assert(src.is_valid(), "invalid src");
+    eosio_assert(src.amount > 0, "src must be positive");
+
+    eosio_assert(src.symbol == EOS_SYMBOL || dest_symbol == EOS_SYMBOL, "src or dest must be EOS");
+    eosio_assert(src.symbol != dest_symbol, "src symbol can not equal dest symbol");
+
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    auto token_symbol = (src.symbol == EOS_SYMBOL) ? dest_symbol: src.symbol;
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
+    assert_not_batched(token_symbol);
+
+    /* the owner pays the RAM of its ticket. only this action has its authority, so the row is
+       reserved here, and storeticket fills it in with the same payer. */
+    tickets_type tickets_table_inst(_self, _self.value);
+    auto reserve_ticket = [&](auto& s) {
+        s.owner = owner;
+        s.reserve = name();
+        s.src = src;
+        s.dest = asset(0, dest_symbol);
+        s.rate = 0;
+        s.expires = now() + TICKET_LIFETIME;
+        s.reserve_src_balance = 0;
+        s.reserve_dest_balance = 0;
+    };
+    auto itr = tickets_table_inst.find(owner.value);
+    if (itr == tickets_table_inst.end()) {
+        tickets_table_inst.emplace(owner, reserve_ticket);
+    } else {
+        tickets_table_inst.modify(itr, owner, reserve_ticket);
+    }
+
+    async_search_best_rate(token_entry, src, false);
+    SEND_INLINE_ACTION(*this, storeticket, {_self, "active"_n}, {owner, src, dest_symbol});
+}
+
 ACTION Network::storeexprate(asset src, symbol dest_symbol) {
     require_auth(_self);  // can only be called internally
 
     state_type state_inst(_self, _self.value);
     eosio_assert(state_inst.exists(), "init not called yet");
 
-    double best_rate;
+    uint128_t best_rate;
+    int64_t best_dest_amount;
     name best_reserve;
-    get_best_rate_results(src, dest_symbol, best_rate, best_reserve);
+    get_best_rate_results(src, dest_symbol, best_rate, best_dest_amount, best_reserve);
 
-    asset dest = calc_dest(best_rate, src, dest_symbol);
+    asset dest = calc_dest_fixed(best_rate, src, dest_symbol);
+    dest.amount = std::min(dest.amount, best_dest_amount);
 
     rate_type rate_inst(_self, _self.value);
-    rate_inst.set({best_rate, dest}, _self);
+    rate_inst.set({from_fixed_rate(best_rate), dest.amount}, _self);
+}
+
+ACTION Network::getmaxsrc(symbol token_symbol, bool buy, double min_rate) {
+    eosio_assert(token_symbol.is_valid(), "invalid symbol");
+    eosio_assert(min_rate > 0, "min rate must be positive");
+
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
+
+    async_search_max_src(token_entry, buy, min_rate);
+    SEND_INLINE_ACTION(*this, storemaxsrc, {_self, "active"_n}, {token_symbol, buy});
+}
+
+ACTION Network::storeticket(name owner, asset src, symbol dest_symbol) {
+    require_auth(_self);  // can only be called internally
+
+    state_type state_inst(_self, _self.value);
+    eosio_assert(state_inst.exists(), "init not called yet");
+
+    uint128_t best_rate;
+    int64_t best_dest_amount;
+    name best_reserve;
+    get_best_rate_results(src, dest_symbol, best_rate, best_dest_amount, best_reserve);
+    eosio_assert(best_rate != 0, "got 0 rate.");
+
+    asset dest = calc_dest_fixed(best_rate, src, dest_symbol);
+    dest.amount = std::min(dest.amount, best_dest_amount);
+    eosio_assert(dest.amount > 0, "got 0 dest.");
+
+    rate_type rate_inst(_self, _self.value);
+    rate_inst.set({from_fixed_rate(best_rate), dest.amount}, _self);
+
+    bool buy = (src.symbol == EOS_SYMBOL);
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    auto token_contract = reservespert_table_inst.get((buy ? dest_symbol : src.symbol).raw()).token_contract;
+    name eos_contract = state_inst.get().eos_contract;
+    int64_t reserve_src_balance = get_balance(best_reserve, buy ? eos_contract : token_contract, src.symbol).amount;
+    int64_t reserve_dest_balance = get_balance(best_reserve, buy ? token_contract : eos_contract, dest_symbol).amount;
+
+    gc_tickets(TICKET_GC_BATCH);
+    tickets_type tickets_table_inst(_self, _self.value);
+    tickets_table_inst.modify(tickets_table_inst.get(owner.value), same_payer, [&](auto& s) {
+        s.reserve = best_reserve;
+        s.src = src;
+        s.dest = dest;
+        s.rate = best_rate;
+        s.expires = now() + TICKET_LIFETIME;
+        s.reserve_src_balance = reserve_src_balance;
+        s.reserve_dest_balance = reserve_dest_balance;
+    });
+}
+
+ACTION Network::storemaxsrc(symbol token_symbol, bool buy) {
+    require_auth(_self);  // can only be called internally
+
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw());
+
+    /* a trade goes to the best reserve, which meets min rate whenever any of them does */
+    maxsrc result = {asset(0, buy ? EOS_SYMBOL : token_symbol), name()};
+    for (int i = 0; i < token_entry.reserve_contracts.size(); i++) {
+        auto reserve = token_entry.reserve_contracts[i];
+        if (reserve_tripped(reserve, token_symbol, buy)) continue;
+
+        auto reserve_result = reserve_maxsrc_type(reserve, reserve.value).get();
+        if (reserve_result.src.amount > result.src.amount) {
+            result = {reserve_result.src, reserve};
+        }
+    }
+
+    maxsrc_type maxsrc_inst(_self, _self.value);
+    maxsrc_inst.set(result, _self);
+}
+
+ACTION Network::setbatch(symbol token_symbol, uint32_t window) {
+    get_state_assert_admin();
+
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    eosio_assert(reservespert_table_inst.find(token_symbol.raw()) != reservespert_table_inst.end(), "unlisted token");
+
+    batches_type batches_table_inst(_self, _self.value);
+    auto itr = batches_table_inst.find(token_symbol.raw());
+    if (!window) {
+        eosio_assert(itr != batches_table_inst.end(), "token is not in batch mode");
+        eosio_assert(!itr->opened, "batch is open");
+        batches_table_inst.erase(itr);
+    } else if (itr == batches_table_inst.end()) {
+        batches_table_inst.emplace(_self, [&](auto& s) {
+            s.token_symbol = token_symbol;
+            s.window = window;
+            s.opened = 0;
+            s.num_orders = 0;
+            s.next_order_id = 0;
+        });
+    } else {
+        batches_table_inst.modify(itr, _self, [&](auto& s) {
+            s.window = window;
+        });
+    }
+    bump_config_seq();
 }
 
-void Network::trade(name from, name to, asset src, string memo, state &state) {
+ACTION Network::clearbatch(symbol token_symbol) {
+    state_type state_inst(_self, _self.value);
+    eosio_assert(state_inst.exists(), "init not called yet");
+    auto state = state_inst.get();
+    eosio_assert(state.schema_version() == SCHEMA_VERSION, "table migration pending");
+    eosio_assert(state.enabled(), "trade not enabled");
+
+    batches_type batches_table_inst(_self, _self.value);
+    const auto& batch_entry = batches_table_inst.get(token_symbol.raw(), "token is not in batch mode");
+    eosio_assert(batch_entry.opened, "no open batch");
+    eosio_assert(now() >= batch_entry.opened + batch_entry.window, "batch window not passed");
     reentrancy_check(true);
 
-    eosio_assert(state.enabled, "trade not enabled");
+    int64_t buy_total, sell_total;
+    batch_totals(token_symbol, buy_total, sell_total);
+
+    /* quote each side for its whole volume, batchquote keeps the buy result before the sell query */
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
+    if (buy_total) {
+        asset src = asset(buy_total, EOS_SYMBOL);
+        async_search_best_rate(token_entry, src, false);
+        SEND_INLINE_ACTION(*this, batchquote, {_self, "active"_n}, {token_symbol, src});
+    }
+    if (sell_total) {
+        asset src = asset(sell_total, token_symbol);
+        async_search_best_rate(token_entry, src, false);
+        SEND_INLINE_ACTION(*this, batchquote, {_self, "active"_n}, {token_symbol, src});
+    }
+    SEND_INLINE_ACTION(*this, clearbatch2, {_self, "active"_n}, {token_symbol});
+}
+
+ACTION Network::cancelbatch(symbol token_symbol) {
+    auto state_inst = get_state_assert_admin();
+    auto current_state = state_inst.get();
+
+    batches_type batches_table_inst(_self, _self.value);
+    const auto& batch_entry = batches_table_inst.get(token_symbol.raw(), "token is not in batch mode");
+    eosio_assert(batch_entry.opened, "no open batch");
+
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    name token_contract = reservespert_table_inst.get(token_symbol.raw()).token_contract;
+    orders_type orders_table_inst(_self, token_symbol.raw());
+    for (auto itr = orders_table_inst.begin(); itr != orders_table_inst.end(); itr = orders_table_inst.erase(itr)) {
+        vault_add(itr->sender, itr->src, (itr->src.symbol == EOS_SYMBOL) ? current_state.eos_contract : token_contract);
+    }
+
+    batches_table_inst.modify(batch_entry, _self, [&](auto& s) {
+        s.opened = 0;
+        s.num_orders = 0;
+    });
+}
+
+ACTION Network::batchquote(symbol token_symbol, asset src) {
+    require_auth(_self);  // can only be called internally
+
+    bool buy = (src.symbol == EOS_SYMBOL);
+    symbol dest_symbol = buy ? token_symbol : EOS_SYMBOL;
+    uint128_t best_rate;
+    int64_t best_dest_amount;
+    name best_reserve;
+    get_best_rate_results(src, dest_symbol, best_rate, best_dest_amount, best_reserve);
+
+    asset dest = asset(0, dest_symbol);
+    if (best_rate) {
+        dest = calc_dest_fixed(best_rate, src, dest_symbol);
+        dest.amount = std::min(dest.amount, best_dest_amount);
+    }
+
+    batchquotes_type batchquotes_table_inst(_self, token_symbol.raw());
+    auto set_quote = [&](auto& s) {
+        s.side = buy;
+        s.reserve = best_reserve;
+        s.src = src;
+        s.dest = dest;
+    };
+    auto itr = batchquotes_table_inst.find(buy);
+    if (itr == batchquotes_table_inst.end()) {
+        batchquotes_table_inst.emplace(_self, set_quote);
+    } else {
+        batchquotes_table_inst.modify(itr, _self, set_quote);
+    }
+}
+
+ACTION Network::clearbatch2(symbol token_symbol) {
+    require_auth(_self);  // can only be called internally
+
+    state_type state_inst(_self, _self.value);
+    auto current_state = state_inst.get();
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    name token_contract = reservespert_table_inst.get(token_symbol.raw()).token_contract;
+
+    /*
+     * a side's quote is for its whole volume, so it bounds the rate the side gets,
+     * whether netted or traded, and whatever is refunded. A side without a quote is refunded.
+     */
+    batchquotes_type batchquotes_table_inst(_self, token_symbol.raw());
+    auto buy_quote = batchquotes_table_inst.find(1);
+    auto sell_quote = batchquotes_table_inst.find(0);
+    uint128_t buy_bound = 0, sell_bound = 0;
+    if (buy_quote != batchquotes_table_inst.end() && buy_quote->dest.amount > 0) {
+        buy_bound = calc_fixed_rate(buy_quote->src, buy_quote->dest);
+    }
+    if (sell_quote != batchquotes_table_inst.end() && sell_quote->dest.amount > 0) {
+        sell_bound = calc_fixed_rate(sell_quote->src, sell_quote->dest);
+    }
+
+    int64_t buy_total = 0, sell_total = 0;
+    orders_type orders_table_inst(_self, token_symbol.raw());
+    for (auto itr = orders_table_inst.begin(); itr != orders_table_inst.end();) {
+        bool buy = (itr->src.symbol == EOS_SYMBOL);
+        uint128_t bound = buy ? buy_bound : sell_bound;
+        if (!bound || itr->min_conversion_rate > bound) {
+            vault_add(itr->sender, itr->src, buy ? current_state.eos_contract : token_contract);
+            itr = orders_table_inst.erase(itr);
+            continue;
+        }
+        (buy ? buy_total : sell_total) += itr->src.amount;
+        itr++;
+    }
+
+    /* the net trade is what one side has beyond what the other covers at the larger side's quote */
+    asset net_src = asset(0, EOS_SYMBOL);
+    asset net_min_dest = asset(0, token_symbol);
+    name reserve;
+    if (buy_total && muldiv(buy_total, buy_quote->dest.amount, buy_quote->src.amount) > sell_total) {
+        int64_t covered = muldiv(sell_total, buy_quote->src.amount, buy_quote->dest.amount, true);
+        net_src = asset(buy_total - covered, EOS_SYMBOL);
+        net_min_dest = asset(muldiv(net_src.amount, buy_quote->dest.amount, buy_quote->src.amount), token_symbol);
+        reserve = buy_quote->reserve;
+    } else if (sell_total && muldiv(sell_total, sell_quote->dest.amount, sell_quote->src.amount) > buy_total) {
+        int64_t covered = muldiv(buy_total, sell_quote->src.amount, sell_quote->dest.amount, true);
+        net_src = asset(sell_total - covered, token_symbol);
+        net_min_dest = asset(muldiv(net_src.amount, sell_quote->dest.amount, sell_quote->src.amount), EOS_SYMBOL);
+        reserve = sell_quote->reserve;
+    }
+    /* a dust imbalance that buys nothing is not traded, it is netted with the rest */
+    if (!net_min_dest.amount) net_src.amount = 0;
+
+    bool buy = (net_src.symbol == EOS_SYMBOL);
+    name dest_contract = buy ? token_contract : current_state.eos_contract;
+    asset balance_pre = get_balance(_self, dest_contract, net_min_dest.symbol);
+    if (net_src.amount) {
+        /* the reserve pays the network, whose transfer handler lets it through while clearing */
+        current_state.set_flag(STATE_BATCH_CLEARING, true);
+        state_inst.set(current_state, _self);
+        async_pay(_self, reserve, net_src, buy ? current_state.eos_contract : token_contract,
+                  reserve_memo(_self, dest_contract, net_min_dest, false));
+    }
+    SEND_INLINE_ACTION(*this, clearbatch3, {_self, "active"_n},
+                       {token_symbol, reserve, net_src, net_min_dest, balance_pre});
+}
+
+ACTION Network::clearbatch3(symbol token_symbol, name reserve, asset net_src, asset net_min_dest, asset balance_pre) {
+    require_auth(_self);  // can only be called internally
+
+    state_type state_inst(_self, _self.value);
+    auto current_state = state_inst.get();
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    name token_contract = reservespert_table_inst.get(token_symbol.raw()).token_contract;
+    name eos_contract = current_state.eos_contract;
+
+    asset net_dest = asset(0, net_min_dest.symbol);
+    if (net_src.amount) {
+        name dest_contract = (net_src.symbol == EOS_SYMBOL) ? token_contract : eos_contract;
+        net_dest = get_balance(_self, dest_contract, net_min_dest.symbol) - balance_pre;
+        eosio_assert(net_dest >= net_min_dest, "batch net trade dest amount not added.");
+        current_state.set_flag(STATE_BATCH_CLEARING, false);
+        state_inst.set(current_state, _self);
+    }
+
+    int64_t buy_total, sell_total;
+    batch_totals(token_symbol, buy_total, sell_total);
+
+    /*
+     * at the uniform rate buyers share all tokens there are, and sellers get the EOS that rate gives,
+     * or the other way around when sells are larger. By default both sides are fully netted.
+     */
+    int64_t buyers_tokens = sell_total;
+    int64_t sellers_eos = buy_total;
+    int64_t buyers_refund = 0;
+    int64_t sellers_refund = 0;
+    if (net_src.amount && net_src.symbol == EOS_SYMBOL) {
+        int64_t available = buy_total - net_src.amount;
+        buyers_tokens = sell_total + net_dest.amount;
+        sellers_eos = std::min(muldiv(sell_total, buy_total, buyers_tokens), available);
+        buyers_refund = available - sellers_eos;
+    } else if (net_src.amount) {
+        int64_t available = sell_total - net_src.amount;
+        sellers_eos = buy_total + net_dest.amount;
+        buyers_tokens = std::min(muldiv(buy_total, sell_total, sellers_eos), available);
+        sellers_refund = available - buyers_tokens;
+    } else if (!buy_total || !sell_total) {
+        /* nothing to net against */
+        buyers_refund = buy_total;
+        sellers_refund = sell_total;
+        buyers_tokens = 0;
+        sellers_eos = 0;
+    }
+
+    /* fills and refunds are credited to the senders' internal balances, no sender can block clearing */
+    orders_type orders_table_inst(_self, token_symbol.raw());
+    for (auto itr = orders_table_inst.begin(); itr != orders_table_inst.end(); itr = orders_table_inst.erase(itr)) {
+        bool buy = (itr->src.symbol == EOS_SYMBOL);
+        int64_t side_total = buy ? buy_total : sell_total;
+        asset fill = buy ? asset(muldiv(itr->src.amount, buyers_tokens, side_total), token_symbol) :
+                           asset(muldiv(itr->src.amount, sellers_eos, side_total), EOS_SYMBOL);
+        asset refund = asset(muldiv(itr->src.amount, buy ? buyers_refund : sellers_refund, side_total),
+                             itr->src.symbol);
+        if (fill.amount) vault_add(itr->sender, fill, buy ? token_contract : eos_contract);
+        if (refund.amount) vault_add(itr->sender, refund, buy ? eos_contract : token_contract);
+    }
+
+    if (buyers_tokens) {
+        record_trade(reserve, _self, asset(buy_total - buyers_refund, EOS_SYMBOL), asset(buyers_tokens, token_symbol));
+    }
+    if (sellers_eos) {
+        record_trade(reserve, _self, asset(sell_total - sellers_refund, token_symbol), asset(sellers_eos, EOS_SYMBOL));
+    }
+
+    batchquotes_type batchquotes_table_inst(_self, token_symbol.raw());
+    for (auto itr = batchquotes_table_inst.begin(); itr != batchquotes_table_inst.end();) {
+        itr = batchquotes_table_inst.erase(itr);
+    }
+    batches_type batches_table_inst(_self, _self.value);
+    batches_table_inst.modify(batches_table_inst.find(token_symbol.raw()), _self, [&](auto& s) {
+        s.opened = 0;
+        s.num_orders = 0;
+    });
+    reentrancy_check(false);
+}
+
+void Network::trade(name from, name to, asset src, string_view memo, state &state) {
+    reentrancy_check(true);
+
+    eosio_assert(state.schema_version() == SCHEMA_VERSION, "table migration pending");
+    eosio_assert(state.enabled(), "trade not enabled");
     eosio_assert(memo.length() > 0, "needs a memo");
 
     /* gather all inputs together, non of them is trusted yet. */
     bool buy = (src.symbol == EOS_SYMBOL);
-    auto info = create_trade_info(memo, from, src, _code);
+    trade_info info;
+    create_trade_info(memo, from, src, _code, info);
 
     /* validate inputs. */
     eosio_assert(info.src.is_valid(), "invalid transfer");
@@ -179,38 +674,100 @@ void Network::trade(name from, name to, asset src, string memo, state &state) {
 
     auto token_symbol = buy ? info.dest.symbol: info.src.symbol;
     reservespert_type reservespert_table_inst(_self, _self.value);
-    auto token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
 
     /* note: this is the check against _code, to prevent fake src token attacks. */
     name expected_src_contract = buy ? state.eos_contract : token_entry.token_contract;
     eosio_assert(info.src_contract == expected_src_contract, "unexpected src contract.");
 
     name expected_dest_contract = buy ? token_entry.token_contract : state.eos_contract;
+    if (info.dest_contract == name()) info.dest_contract = expected_dest_contract; /* omitted in a compact memo */
     eosio_assert(info.dest_contract == expected_dest_contract, "unexpected dest contract.");
 
-    async_search_best_rate(token_entry, info.src);
+    /* in batch mode the trade waits for clearbatch, an exact output can not be kept at a uniform rate */
+    if (info.dest.amount) assert_not_batched(token_symbol);
+    if (!info.dest.amount && add_batch_order(info, token_symbol)) {
+        reentrancy_check(false);
+        return;
+    }
+
+    /* a non zero dest amount means an exact output trade. */
+    if (info.dest.amount) {
+        async_search_best_src(token_entry, info.dest);
+    } else {
+        async_search_best_rate(token_entry, info.src, false);
+    }
     SEND_INLINE_ACTION(*this, trade1, {_self, "active"_n}, {info});
 }
 
 ACTION Network::trade1(trade_info info) {
     require_auth(_self);  // can only be called internally
 
-    double best_rate;
+    uint128_t best_rate;
+    int64_t best_dest_amount;
     name best_reserve;
-    get_best_rate_results(info.src, info.dest.symbol, best_rate, best_reserve);
-    eosio_assert(best_rate != 0, "got 0 rate.");
+    asset src = info.src;
+    asset dest;
+    bool exact_output = (info.dest.amount > 0);
+    if (exact_output) {
+        get_best_src_results(info.dest, info.src.symbol, src, best_reserve);
+        eosio_assert(src.amount > 0, "no reserve can provide dest.");
+        eosio_assert(src <= info.src, "src not enough for dest.");
+        best_rate = calc_fixed_rate(src, info.dest);
+        dest = info.dest;
+    } else {
+        get_best_rate_results(info.src, info.dest.symbol, best_rate, best_dest_amount, best_reserve);
+
+        /*
+         * a trade no single reserve fills, or a large one, is split between the reserves
+         * instead if that gives more than the best single reserve.
+         */
+        asset single_dest = asset(0, info.dest.symbol);
+        if (best_rate && (best_rate >= info.min_conversion_rate) && (best_rate <= MAX_FIXED_RATE)) {
+            single_dest = calc_dest_fixed(best_rate, info.src, info.dest.symbol);
+            single_dest.amount = std::min(single_dest.amount, best_dest_amount);
+        }
+        int64_t eos_amount = (info.src.symbol == EOS_SYMBOL) ? info.src.amount : single_dest.amount;
+        if ((!single_dest.amount || (eos_amount >= SPLIT_MIN_EOS)) &&
+            async_search_split(info, best_reserve, single_dest)) return;
+        eosio_assert(best_rate != 0, "got 0 rate.");
+    }
     eosio_assert(best_rate >= info.min_conversion_rate, "rate < min conversion rate.");
-    eosio_assert(best_rate <= MAX_RATE, "rate > max rate.");
+    eosio_assert(best_rate <= MAX_FIXED_RATE, "rate > max rate.");
+
+    if (!exact_output) {
+        /* reserves compute dest in double, so never expect more than the reserve quoted. */
+        dest = calc_dest_fixed(best_rate, info.src, info.dest.symbol);
+        dest.amount = std::min(dest.amount, best_dest_amount);
+    } else if (src < info.src) {
+        async_pay(_self, info.sender, info.src - src, info.src_contract, "trade refund");
+    }
 
-    asset dest = calc_dest(best_rate, info.src, info.dest.symbol);
+    pay_reserve(info, best_reserve, src, dest, exact_output);
+}
+
+/* sends src to the chosen reserve, and checks it paid dest, with trade2 or within the trusted reserve. */
+void Network::pay_reserve(const trade_info &info, name reserve, asset src, asset dest, bool exact_output) {
+    trusted_type trusted_table_inst(_self, _self.value);
+    bool trusted = (trusted_table_inst.find(reserve.value) != trusted_table_inst.end());
+
+    auto memo = reserve_memo(info.sender, info.dest_contract, dest, exact_output);
+
+    if (trusted) {
+        /* the reserve's own check replaces the one of trade2. */
+        record_trade(reserve, info.sender, src, dest);
+        async_pay(_self, reserve, src, info.src_contract, memo);
+        SEND_INLINE_ACTION(*this, settle, {_self, "active"_n}, {reserve, info.sender, src, dest});
+        return;
+    }
 
     asset balance_pre = get_balance(info.sender, info.dest_contract, info.dest.symbol);
 
     /* do reserve trade */
-    async_pay(_self, best_reserve, info.src, info.src_contract, (name{info.sender}).to_string());
+    async_pay(_self, reserve, src, info.src_contract, memo);
 
     SEND_INLINE_ACTION(*this, trade2, {_self, "active"_n},
-                       {best_reserve, info, info.src, dest, balance_pre});
+                       {reserve, info, src, dest, balance_pre});
 }
 
 ACTION Network::trade2(name reserve, trade_info info, asset src, asset dest, asset balance_pre) {
@@ -222,7 +779,427 @@ ACTION Network::trade2(name reserve, trade_info info, asset src, asset dest, ass
     asset balance_diff = balance_post - balance_pre;
     eosio_assert(balance_diff >= dest, "trade dest amount not added.");
 
-    /* update token stats */
+    record_trade(reserve, info.sender, src, dest);
+    notify_listener(reserve, info.sender, src, dest);
+
+    SEND_INLINE_ACTION(*this, trade3, {_self, "active"_n}, {});
+}
+
+ACTION Network::splitquote(name reserve, asset src, symbol dest_symbol) {
+    require_auth(_self);  // can only be called internally
+
+    uint128_t rate;
+    int64_t dest_amount;
+    get_reserve_rate(reserve, rate, dest_amount);
+
+    asset dest = asset(0, dest_symbol);
+    if (rate && (rate <= MAX_FIXED_RATE)) {
+        dest = calc_dest_fixed(rate, src, dest_symbol);
+        dest.amount = std::min(dest.amount, dest_amount);
+    }
+
+    splitquotes_type splitquotes_table_inst(_self, _self.value);
+    splitquotes_table_inst.emplace(_self, [&](auto& s) {
+        s.id = splitquotes_table_inst.available_primary_key();
+        s.reserve = reserve;
+        s.src = src;
+        s.dest = dest;
+    });
+}
+
+ACTION Network::tradesplit(trade_info info, name single_reserve, asset single_dest) {
+    require_auth(_self);  // can only be called internally
+
+    /* quotes[i][k] is the dest reserve i quoted for k steps, as queried by async_search_split */
+    vector<name> reserves;
+    vector<vector<int64_t>> quotes;
+    splitquotes_type splitquotes_table_inst(_self, _self.value);
+    for (auto itr = splitquotes_table_inst.begin(); itr != splitquotes_table_inst.end();) {
+        if (reserves.empty() || (reserves.back() != itr->reserve)) {
+            reserves.push_back(itr->reserve);
+            quotes.push_back({0});
+        }
+        quotes.back().push_back(itr->dest.amount);
+        itr = splitquotes_table_inst.erase(itr);
+    }
+
+    /* each step goes to the reserve whose next quote adds the most dest, the curves are concave */
+    int64_t step = info.src.amount / SPLIT_STEPS;
+    vector<int> steps(reserves.size());
+    int num_steps = 0;
+    for (; num_steps < SPLIT_STEPS; num_steps++) {
+        int best = -1;
+        int64_t best_added = 0;
+        for (int i = 0; i < reserves.size(); i++) {
+            if (steps[i] == SPLIT_STEPS) continue;
+            int64_t added = quotes[i][steps[i] + 1] - quotes[i][steps[i]];
+            if (added > best_added) {
+                best = i;
+                best_added = added;
+            }
+        }
+        if (best < 0) break;
+        steps[best]++;
+    }
+
+    vector<split_leg> legs;
+    int64_t split_dest = 0;
+    for (int i = 0; i < reserves.size(); i++) {
+        if (!steps[i]) continue;
+        legs.push_back({reserves[i], asset(steps[i] * step, info.src.symbol),
+                        asset(quotes[i][steps[i]], info.dest.symbol)});
+        split_dest += quotes[i][steps[i]];
+    }
+    if ((num_steps < SPLIT_STEPS) || (legs.size() < 2) || (split_dest <= single_dest.amount) ||
+        (calc_fixed_rate(info.src, asset(split_dest, info.dest.symbol)) < info.min_conversion_rate)) {
+        eosio_assert(single_dest.amount > 0, "rate < min conversion rate.");
+        pay_reserve(info, single_reserve, info.src, single_dest, false);
+        return;
+    }
+
+    /*
+     * all slices are paid from here, which keeps the reserves' payouts within the inline depth.
+     * the reserves are quoted in this transaction, and no slice trades on another's reserve.
+     */
+    int64_t dust = info.src.amount - SPLIT_STEPS * step;
+    if (dust) async_pay(_self, info.sender, asset(dust, info.src.symbol), info.src_contract, "trade refund");
+
+    asset balance_pre = get_balance(info.sender, info.dest_contract, info.dest.symbol);
+    trusted_type trusted_table_inst(_self, _self.value);
+    vector<split_leg> untrusted_legs;
+    for (auto& leg : legs) {
+        async_pay(_self, leg.reserve, leg.src, info.src_contract,
+                  reserve_memo(info.sender, info.dest_contract, leg.dest, false));
+        if (trusted_table_inst.find(leg.reserve.value) == trusted_table_inst.end()) {
+            untrusted_legs.push_back(leg);
+            continue;
+        }
+
+        /* as in pay_reserve, the reserve's own check replaces the one of tradesplit2 */
+        record_trade(leg.reserve, info.sender, leg.src, leg.dest);
+        notify_listener(leg.reserve, info.sender, leg.src, leg.dest);
+    }
+    SEND_INLINE_ACTION(*this, tradesplit2, {_self, "active"_n}, {info, untrusted_legs, balance_pre});
+}
+
+ACTION Network::tradesplit2(trade_info info, vector<split_leg> legs, asset balance_pre) {
+    require_auth(_self);  // can only be called internally
+
+    /* same as trade2, for the untrusted slices together */
+    asset dest = asset(0, info.dest.symbol);
+    for (auto& leg : legs) dest += leg.dest;
+    if (dest.amount) {
+        auto balance_post = get_balance(info.sender, info.dest_contract, info.dest.symbol);
+        eosio_assert(balance_post - balance_pre >= dest, "trade dest amount not added.");
+    }
+
+    for (auto& leg : legs) {
+        record_trade(leg.reserve, info.sender, leg.src, leg.dest);
+        notify_listener(leg.reserve, info.sender, leg.src, leg.dest);
+    }
+    SEND_INLINE_ACTION(*this, trade3, {_self, "active"_n}, {});
+}
+
+ACTION Network::trade3() {
+    require_auth(_self);  // can only be called internally
+    reentrancy_check(false);
+} /* end of trade process */
+
+ACTION Network::settle(name reserve, name sender, asset src, asset dest) {
+    require_auth(_self);  // can only be called internally
+    end_trade(reserve, sender, src, dest);
+}
+
+void Network::end_trade(name reserve, name sender, asset src, asset dest) {
+    /* as in the regular flow, stay in trade state while the listener hook runs. */
+    if (notify_listener(reserve, sender, src, dest)) {
+        SEND_INLINE_ACTION(*this, trade3, {_self, "active"_n}, {});
+    } else {
+        reentrancy_check(false);
+    }
+}
+
+void Network::trade_ticket(name from, asset src, name src_contract, state &state) {
+    reentrancy_check(true);
+
+    eosio_assert(state.schema_version() == SCHEMA_VERSION, "table migration pending");
+    eosio_assert(state.enabled(), "trade not enabled");
+
+    tickets_type tickets_table_inst(_self, _self.value);
+    auto itr = tickets_table_inst.find(from.value);
+    eosio_assert(itr != tickets_table_inst.end(), "no quote ticket");
+    eosio_assert(now() < itr->expires, "quote ticket expired");
+    eosio_assert(src == itr->src, "src does not match the quote ticket");
+
+    bool buy = (src.symbol == EOS_SYMBOL);
+    auto token_symbol = buy ? itr->dest.symbol : src.symbol;
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw(), "unlisted token");
+    assert_not_batched(token_symbol);
+
+    /* note: this is the check against _code, to prevent fake src token attacks. */
+    name expected_src_contract = buy ? state.eos_contract : token_entry.token_contract;
+    eosio_assert(src_contract == expected_src_contract, "unexpected src contract.");
+    name dest_contract = buy ? token_entry.token_contract : state.eos_contract;
+
+    /* the quote still holds if the reserve is listed and was not traded with or funded since */
+    auto& reserves = token_entry.reserve_contracts;
+    eosio_assert(std::find(reserves.begin(), reserves.end(), itr->reserve) != reserves.end(),
+                 "quoted reserve no longer listed");
+    eosio_assert(get_balance(itr->reserve, src_contract, src.symbol).amount == itr->reserve_src_balance &&
+                 get_balance(itr->reserve, dest_contract, itr->dest.symbol).amount == itr->reserve_dest_balance,
+                 "reserve changed since the quote");
+
+    trade_info info = {from, src_contract, src, dest_contract, asset(0, itr->dest.symbol), itr->rate};
+    name reserve = itr->reserve;
+    asset dest = itr->dest;
+    tickets_table_inst.erase(itr);
+    gc_tickets(TICKET_GC_BATCH);
+
+    pay_reserve(info, reserve, src, dest, false);
+}
+
+/*
+ * the reserve asserts it pays at least dest from dest contract to receiver, exactly dest if exact,
+ * and trades a buy on its curve of the dest symbol.
+ */
+fixed_string<MAX_RESERVE_MEMO_LENGTH> Network::reserve_memo(name receiver, name dest_contract, asset dest, bool exact) {
+    fixed_string<MAX_RESERVE_MEMO_LENGTH> memo;
+    append_name(memo, receiver);
+    memo += ',';
+    append_name(memo, dest_contract);
+    memo += ',';
+    append_asset(memo, dest);
+    if (exact) memo += ",exact";
+    return memo;
+}
+
+/* escrows the trade as an order if the token is in batch mode, returns whether it did. */
+bool Network::add_batch_order(const trade_info &info, symbol token_symbol) {
+    batches_type batches_table_inst(_self, _self.value);
+    auto itr = batches_table_inst.find(token_symbol.raw());
+    if (itr == batches_table_inst.end()) return false;
+    eosio_assert(itr->num_orders < MAX_BATCH_ORDERS, "batch is full, clearbatch first");
+
+    uint64_t id = itr->next_order_id;
+    batches_table_inst.modify(itr, _self, [&](auto& s) {
+        if (!s.opened) s.opened = now();
+        s.num_orders++;
+        s.next_order_id++;
+    });
+
+    orders_type orders_table_inst(_self, token_symbol.raw());
+    orders_table_inst.emplace(_self, [&](auto& s) {
+        s.id = id;
+        s.sender = info.sender;
+        s.src = info.src;
+        s.min_conversion_rate = info.min_conversion_rate;
+    });
+    return true;
+}
+
+void Network::batch_totals(symbol token_symbol, int64_t &buy_total, int64_t &sell_total) {
+    buy_total = 0;
+    sell_total = 0;
+    orders_type orders_table_inst(_self, token_symbol.raw());
+    for (auto itr = orders_table_inst.begin(); itr != orders_table_inst.end(); itr++) {
+        if (itr->src.symbol == EOS_SYMBOL) {
+            buy_total += itr->src.amount;
+        } else {
+            sell_total += itr->src.amount;
+        }
+    }
+}
+
+/* a token in batch mode only trades through its batch. */
+void Network::assert_not_batched(symbol token_symbol) {
+    batches_type batches_table_inst(_self, _self.value);
+    eosio_assert(batches_table_inst.find(token_symbol.raw()) == batches_table_inst.end(), "token is in batch mode");
+}
+
+/* erases up to limit expired tickets, oldest first. */
+void Network::gc_tickets(uint32_t limit) {
+    tickets_type tickets_table_inst(_self, _self.value);
+    auto expiry_index = tickets_table_inst.get_index<"byexpiry"_n>();
+    auto itr = expiry_index.begin();
+    while (limit-- && itr != expiry_index.end() && itr->expires <= now()) {
+        itr = expiry_index.erase(itr);
+    }
+}
+
+void Network::list_pairs(vector<listing> &listings, bool add_reserves) {
+    auto state_inst = get_state_assert_admin();
+    eosio_assert(state_inst.get().schema_version() == SCHEMA_VERSION, "table migration pending");
+
+    /* group by token so each token row is written once */
+    std::sort(listings.begin(), listings.end(), [](const listing &a, const listing &b) {
+        if (a.token_symbol.raw() != b.token_symbol.raw()) return a.token_symbol.raw() < b.token_symbol.raw();
+        return a.reserve < b.reserve;
+    });
+
+    /* validate the batch and sum up the change in num_tokens per reserve, sorted by reserve */
+    reserves_type reserves_inst(_self, _self.value);
+    vector<std::pair<name, int64_t>> reserve_deltas;
+    for (size_t i = 0; i < listings.size(); i++) {
+        const listing &l = listings[i];
+        eosio_assert(l.token_symbol.is_valid(), "invalid token symbol");
+        eosio_assert(is_account(l.token_contract), "token contract does not exist");
+        if (i > 0 && l.token_symbol == listings[i - 1].token_symbol) {
+            eosio_assert(l.reserve != listings[i - 1].reserve, "duplicate listing");
+            eosio_assert(l.token_contract == listings[i - 1].token_contract, "token contract mismatch");
+        }
+
+        auto delta_itr = std::lower_bound(reserve_deltas.begin(), reserve_deltas.end(), l.reserve,
+                                          [](const std::pair<name, int64_t> &d, name r) { return d.first < r; });
+        if (delta_itr == reserve_deltas.end() || delta_itr->first != l.reserve) {
+            bool exists = (reserves_inst.find(l.reserve.value) != reserves_inst.end());
+            eosio_assert(exists || (add_reserves && l.add && is_account(l.reserve)), "invalid reserve");
+            delta_itr = reserve_deltas.insert(delta_itr, {l.reserve, 0});
+        }
+        delta_itr->second += (l.add ? 1 : -1);
+    }
+
+    for (auto &delta : reserve_deltas) {
+        auto res_itr = reserves_inst.find(delta.first.value);
+        if (res_itr == reserves_inst.end()) {
+            reserves_inst.emplace(_self, [&](auto& s) {
+                s.contract = delta.first;
+                s.num_tokens = delta.second;
+            });
+        } else if (delta.second) {
+            reserves_inst.modify(res_itr, _self, [&](auto& s) {
+                s.num_tokens += delta.second;
+            });
+        }
+    }
+
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    tokenstats_type tokenstats_table_inst(_self, _self.value);
+    size_t end;
+    for (size_t begin = 0; begin < listings.size(); begin = end) {
+        symbol token_symbol = listings[begin].token_symbol;
+        name token_contract = listings[begin].token_contract;
+        for (end = begin + 1; end < listings.size() && listings[end].token_symbol == token_symbol; end++);
+
+        auto itr = reservespert_table_inst.find(token_symbol.raw());
+        bool token_exists = (itr != reservespert_table_inst.end());
+        vector<name> reserve_contracts = token_exists ? itr->reserve_contracts : vector<name>();
+
+        reshealth_type reshealth_table_inst(_self, token_symbol.raw());
+        for (size_t i = begin; i < end; i++) {
+            name reserve = listings[i].reserve;
+            auto res_it = find(reserve_contracts.begin(), reserve_contracts.end(), reserve);
+            if (listings[i].add) {
+                eosio_assert(!token_exists || itr->token_contract == token_contract, "token contract mismatch");
+                eosio_assert(res_it == reserve_contracts.end(), "already listed in reserve");
+                reserve_contracts.push_back(reserve);
+            } else {
+                eosio_assert(token_exists, "not listed at all");
+                eosio_assert(res_it != reserve_contracts.end(), "not listed in reserve");
+                reserve_contracts.erase(res_it);
+
+                auto health_itr = reshealth_table_inst.find(reserve.value);
+                if (health_itr != reshealth_table_inst.end()) reshealth_table_inst.erase(health_itr);
+            }
+        }
+
+        if (token_exists) {
+            if (reserve_contracts.empty()) {
+                set_accepted(itr->token_contract, token_symbol.code(), false);
+                reservespert_table_inst.erase(itr);
+            } else {
+                reservespert_table_inst.modify(itr, _self, [&](auto& s) {
+                    s.reserve_contracts = reserve_contracts;
+                });
+            }
+        } else if (!reserve_contracts.empty()) {
+            reservespert_table_inst.emplace(_self, [&](auto& s) {
+               s.symbol = token_symbol;
+               s.token_contract = token_contract;
+               s.reserve_contracts = reserve_contracts;
+            });
+            set_accepted(token_contract, token_symbol.code(), true);
+
+            /* Note: token stats entries are never deleted, so we can continue count on re-list. */
+            if (tokenstats_table_inst.find(token_symbol.raw()) == tokenstats_table_inst.end()) {
+                tokenstats_table_inst.emplace(_self, [&](auto& s) {
+                   s.token_symbol = token_symbol;
+                   s.token_counter = 0;
+                   s.eos_counter = 0;
+                });
+            }
+        }
+    }
+    bump_config_seq();
+}
+
+void Network::set_accepted(name token_contract, symbol_code sym, bool accept) {
+    accepted_type accepted_table_inst(_self, token_contract.value);
+    auto itr = accepted_table_inst.find(sym.raw());
+    if (accept && itr == accepted_table_inst.end()) {
+        accepted_table_inst.emplace(_self, [&](auto& s) {
+            s.sym = sym;
+        });
+    } else if (!accept && itr != accepted_table_inst.end()) {
+        accepted_table_inst.erase(itr);
+    }
+}
+
+void Network::vault_deposit(name from, asset quantity, name code, state &state) {
+    eosio_assert(quantity.is_valid() && quantity.amount > 0, "illegal quantity");
+
+    /* only EOS and listed tokens, from their own contract */
+    name expected_contract = state.eos_contract;
+    if (quantity.symbol != EOS_SYMBOL) {
+        reservespert_type reservespert_table_inst(_self, _self.value);
+        expected_contract = reservespert_table_inst.get(quantity.symbol.raw(), "unlisted token").token_contract;
+    }
+    eosio_assert(code == expected_contract, "unexpected deposit contract.");
+
+    vault_add(from, quantity, code);
+}
+
+void Network::vault_add(name owner, asset quantity, name token_contract) {
+    vault_type vault_table_inst(_self, quantity.symbol.raw());
+    auto itr = vault_table_inst.find(owner.value);
+    if (itr == vault_table_inst.end()) {
+        vault_table_inst.emplace(_self, [&](auto& s) {
+            s.owner = owner;
+            s.balance = quantity;
+            s.token_contract = token_contract;
+        });
+    } else {
+        eosio_assert(itr->token_contract == token_contract, "unexpected deposit contract.");
+        vault_table_inst.modify(itr, _self, [&](auto& s) {
+            s.balance += quantity;
+        });
+    }
+}
+
+asset Network::vault_balance(name owner, symbol sym) {
+    vault_type vault_table_inst(_self, sym.raw());
+    auto itr = vault_table_inst.find(owner.value);
+    return (itr == vault_table_inst.end()) ? asset(0, sym) : itr->balance;
+}
+
+/* returns the token contract of the balance */
+name Network::vault_sub(name owner, asset quantity) {
+    vault_type vault_table_inst(_self, quantity.symbol.raw());
+    auto itr = vault_table_inst.find(owner.value);
+    eosio_assert(itr != vault_table_inst.end() && itr->balance >= quantity, "insufficient vault balance");
+
+    name token_contract = itr->token_contract;
+    if (itr->balance == quantity) {
+        vault_table_inst.erase(itr);
+    } else {
+        vault_table_inst.modify(itr, _self, [&](auto& s) {
+            s.balance -= quantity;
+        });
+    }
+    return token_contract;
+}
+
+void Network::record_trade(name reserve, name sender, asset src, asset dest) {
     bool buy = (src.symbol == EOS_SYMBOL);
     asset eos = buy ? src : dest;
     asset token = buy ? dest : src;
@@ -230,61 +1207,308 @@ ACTION Network::trade2(name reserve, trade_info info, asset src, asset dest, ass
     tokenstats_type tokenstats_table_inst(_self, _self.value);
     auto itr = tokenstats_table_inst.find(token.symbol.raw());
     tokenstats_table_inst.modify(itr, _self, [&](auto& s) {
-        s.token_counter += token;
-        s.eos_counter += eos;
+        s.token_counter = (s.token_volume() + token).amount;
+        s.eos_counter = (s.eos_volume() + eos).amount;
+    });
+
+    update_price_feed(eos, token);
+
+    /* append to the change feed, dropping the oldest trade once it is full */
+    feedseq_type feedseq_inst(_self, _self.value);
+    auto seq = feedseq_inst.get_or_default();
+    seq.trade_seq++;
+    feedseq_inst.set(seq, _self);
+
+    tradefeed_type tradefeed_table_inst(_self, _self.value);
+    if (seq.trade_seq > TRADE_FEED_SIZE) {
+        auto oldest = tradefeed_table_inst.find(seq.trade_seq - TRADE_FEED_SIZE);
+        if (oldest != tradefeed_table_inst.end()) tradefeed_table_inst.erase(oldest);
+    }
+    tradefeed_table_inst.emplace(_self, [&](auto& s) {
+        s.seq = seq.trade_seq;
+        s.sender = sender;
+        s.reserve = reserve;
+        s.src = src;
+        s.dest = dest;
+        s.time = now();
     });
+}
 
+void Network::bump_config_seq() {
+    feedseq_type feedseq_inst(_self, _self.value);
+    auto seq = feedseq_inst.get_or_default();
+    seq.config_seq++;
+    feedseq_inst.set(seq, _self);
+}
+
+bool Network::notify_listener(name reserve, name sender, asset src, asset dest) {
     state_type state_inst(_self, _self.value);
     name listener = state_inst.get().listener;
-    if ((listener != name()) && (listener != "eosio"_n)) {
+    if ((listener == name()) || (listener == "eosio"_n)) return false;
+
+    action {permission_level{_self, "active"_n},
+            listener,
+            "posttrade"_n,
+            make_tuple(src, dest, reserve, sender)}.send();
+    return true;
+}
+
+void Network::async_search_best_rate(const reservespert &token_entry, asset src, bool from_vault) {
+    bool buy = (src.symbol == EOS_SYMBOL);
+    for (int i = 0; i < token_entry.reserve_contracts.size(); i++) {
+        auto reserve = token_entry.reserve_contracts[i];
+        if (reserve_tripped(reserve, token_entry.symbol, buy)) continue;
         action {permission_level{_self, "active"_n},
-                listener,
-                "posttrade"_n,
-                make_tuple(src, dest, reserve, info.sender)}.send();
+                reserve,
+                "getconvrate"_n,
+                make_tuple(src, buy ? token_entry.symbol : EOS_SYMBOL, from_vault)}.send();
     }
+}
 
-    SEND_INLINE_ACTION(*this, trade3, {_self, "active"_n}, {});
+void Network::async_search_max_src(const reservespert &token_entry, bool buy, double min_rate) {
+    for (int i = 0; i < token_entry.reserve_contracts.size(); i++) {
+        auto reserve = token_entry.reserve_contracts[i];
+        if (reserve_tripped(reserve, token_entry.symbol, buy)) continue;
+        action {permission_level{_self, "active"_n},
+                reserve,
+                "getmaxsrc"_n,
+                make_tuple(token_entry.symbol, buy, min_rate)}.send();
+    }
 }
 
-ACTION Network::trade3() {
-    require_auth(_self);  // can only be called internally
-    reentrancy_check(false);
-} /* end of trade process */
+/* quotes every reserve for each multiple of a split trade's step, returns false if there is nothing to split. */
+bool Network::async_search_split(const trade_info &info, name single_reserve, asset single_dest) {
+    bool buy = (info.src.symbol == EOS_SYMBOL);
+    symbol token_symbol = buy ? info.dest.symbol : info.src.symbol;
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    const auto& token_entry = reservespert_table_inst.get(token_symbol.raw());
 
-void Network::async_search_best_rate(reservespert &token_entry, asset src) {
+    int64_t step = info.src.amount / SPLIT_STEPS;
+    if (!step) return false;
+
+    vector<name> reserves;
     for (int i = 0; i < token_entry.reserve_contracts.size(); i++) {
         auto reserve = token_entry.reserve_contracts[i];
+        if (!reserve_tripped(reserve, token_symbol, buy)) reserves.push_back(reserve);
+    }
+    if (reserves.size() < 2) return false;
+
+    /* a reserve keeps one rate row, so each quote is stored by splitquote before the next one */
+    for (auto reserve : reserves) {
+        for (int k = 1; k <= SPLIT_STEPS; k++) {
+            asset src = asset(k * step, info.src.symbol);
+            action {permission_level{_self, "active"_n},
+                    reserve,
+                    "getconvrate"_n,
+                    make_tuple(src, info.dest.symbol, false)}.send();
+            SEND_INLINE_ACTION(*this, splitquote, {_self, "active"_n}, {reserve, src, info.dest.symbol});
+        }
+    }
+    SEND_INLINE_ACTION(*this, tradesplit, {_self, "active"_n}, {info, single_reserve, single_dest});
+    return true;
+}
+
+void Network::async_search_best_src(const reservespert &token_entry, asset dest) {
+    bool buy = (dest.symbol != EOS_SYMBOL);
+    for (int i = 0; i < token_entry.reserve_contracts.size(); i++) {
+        auto reserve = token_entry.reserve_contracts[i];
+        if (reserve_tripped(reserve, token_entry.symbol, buy)) continue;
         action {permission_level{_self, "active"_n},
                 reserve,
-                "getconvrate"_n,
-                make_tuple(src)}.send();
+                "getsrcamt"_n,
+                make_tuple(dest, buy ? EOS_SYMBOL : token_entry.symbol)}.send();
     }
 }
 
-void Network::get_best_rate_results(asset src, symbol dest_symbol, double &rate, name &reserve) {
-    /* read stored rates from all reserves that hold the pair and decide on the best one */
+void Network::get_best_src_results(asset dest, symbol src_symbol, asset &src, name &reserve) {
+    /* the best reserve is the one that asks for the least src */
     reservespert_type reservespert_table_inst(_self, _self.value);
-    symbol token_symbol = (src.symbol == EOS_SYMBOL) ? dest_symbol : src.symbol;
-    auto reservespert_entry = reservespert_table_inst.get(token_symbol.raw());
+    bool buy = (src_symbol == EOS_SYMBOL);
+    symbol token_symbol = buy ? dest.symbol : src_symbol;
+    const auto& reservespert_entry = reservespert_table_inst.get(token_symbol.raw());
+
+    src = asset(0, src_symbol);
+    for (int i = 0; i < reservespert_entry.reserve_contracts.size(); i++) {
+        auto current_reserve = reservespert_entry.reserve_contracts[i];
+        if (reserve_tripped(current_reserve, token_symbol, buy)) continue;
+
+        auto current_src = reserve_srcamt_type(current_reserve, current_reserve.value).get().src;
+        if (current_src.amount > 0 && (src.amount == 0 || current_src < src)) {
+            reserve = current_reserve;
+            src = current_src;
+        }
+    }
+}
+
+void Network::get_best_rate_results(asset src,
+                                    symbol dest_symbol,
+                                    uint128_t &rate,
+                                    int64_t &dest_amount,
+                                    name &reserve) {
+    /* read stored rates from all queried reserves that hold the pair and decide on the best one */
+    reservespert_type reservespert_table_inst(_self, _self.value);
+    bool buy = (src.symbol == EOS_SYMBOL);
+    symbol token_symbol = buy ? dest_symbol : src.symbol;
+    const auto& reservespert_entry = reservespert_table_inst.get(token_symbol.raw());
 
     rate = 0;
+    dest_amount = 0;
     for (int i = 0; i < reservespert_entry.reserve_contracts.size(); i++) {
         auto current_reserve = reservespert_entry.reserve_contracts[i];
-        auto current_rate_entry = rate_type(current_reserve, current_reserve.value).get();
 
-        if (current_rate_entry.stored_rate > rate) {
+        /* health is not modified since async_search_best_rate, so this skips the same reserves. */
+        if (reserve_tripped(current_reserve, token_symbol, buy)) continue;
+
+        uint128_t current_rate;
+        int64_t current_dest_amount;
+        uint8_t reason = get_reserve_rate(current_reserve, current_rate, current_dest_amount);
+        update_reserve_health(current_reserve, token_symbol, buy, reason);
+
+        if (current_rate > rate) {
             reserve = current_reserve;
-            rate = current_rate_entry.stored_rate;
+            rate = current_rate;
+            dest_amount = current_dest_amount;
+        }
+    }
+}
+
+uint8_t Network::get_reserve_rate(name reserve, uint128_t &rate, int64_t &dest_amount) {
+    auto itr = db_find_i64(reserve.value, reserve.value, "rate"_n.value, "rate"_n.value);
+    eosio_assert(itr >= 0, "reserve rate not found");
+
+    /*
+     * read raw, as reserves that do not report a reason store a shorter row,
+     * and legacy reserves store dest as an asset, which also starts with the amount.
+     * only a row of exactly the current layout has a reason, a legacy row is longer
+     * and its next byte is the precision of dest.
+     */
+    reserverate result;
+    char buffer[sizeof(result.stored_rate) + sizeof(result.dest_amount) + sizeof(result.reason)];
+    auto size = db_get_i64(itr, nullptr, 0);
+    eosio_assert(size >= int(sizeof(result.stored_rate) + sizeof(result.dest_amount)), "reserve rate row too short");
+    db_get_i64(itr, buffer, sizeof(buffer));
+
+    datastream<const char*> ds(buffer, sizeof(buffer));
+    ds >> result.stored_rate >> result.dest_amount;
+    rate = to_fixed_rate(result.stored_rate);
+    dest_amount = result.dest_amount;
+    if (size != sizeof(buffer)) return rate ? RATE_OK : RATE_UNKNOWN;
+
+    ds >> result.reason;
+    return result.reason;
+}
+
+bool Network::reserve_tripped(name reserve, symbol token_symbol, bool buy) {
+    reshealth_type reshealth_table_inst(_self, token_symbol.raw());
+    auto itr = reshealth_table_inst.find(reserve.value);
+    if (itr == reshealth_table_inst.end()) return false;
+
+    auto& side = itr->side(buy);
+    return side.tripped() && (now() < side.retry_after);
+}
+
+void Network::update_reserve_health(name reserve, symbol token_symbol, bool buy, uint8_t reason) {
+    /* cap and balance failures depend on the traded amount, they say nothing of the reserve's health. */
+    if ((reason == RATE_CAP_EXCEEDED) || (reason == RATE_LOW_BALANCE)) return;
+
+    reshealth_type reshealth_table_inst(_self, token_symbol.raw());
+    auto itr = reshealth_table_inst.find(reserve.value);
+
+    if (reason == RATE_OK) {
+        if (itr == reshealth_table_inst.end() || !itr->side(buy).failures) return;
+        if (!itr->side(!buy).failures) {
+            reshealth_table_inst.erase(itr);
+        } else {
+            reshealth_table_inst.modify(itr, _self, [&](auto& s) {
+                s.side(buy) = breaker{0, RATE_OK, 0};
+            });
         }
+        return;
+    }
+
+    auto record_failure = [&](breaker& b) {
+        if (b.failures < UINT8_MAX) b.failures++;
+        b.last_reason = reason;
+        if (b.tripped()) {
+            uint32_t doublings = std::min(b.failures - BREAKER_THRESHOLD, BREAKER_MAX_DOUBLINGS);
+            b.retry_after = now() + (uint32_t(BREAKER_BACKOFF) << doublings);
+        }
+    };
+
+    if (itr == reshealth_table_inst.end()) {
+        reshealth_table_inst.emplace(_self, [&](auto& s) {
+            s.reserve = reserve;
+            s.buy = breaker{0, RATE_OK, 0};
+            s.sell = breaker{0, RATE_OK, 0};
+            record_failure(s.side(buy));
+        });
+    } else {
+        reshealth_table_inst.modify(itr, _self, [&](auto& s) {
+            record_failure(s.side(buy));
+        });
+    }
+}
+
+void Network::update_price_feed(asset eos, asset token) {
+    if (!eos.amount || !token.amount) return;
+
+    uint32_t current_time = now();
+    double price = asset_to_damount(eos) / asset_to_damount(token);
+
+    pricefeed_type pricefeed_table_inst(_self, _self.value);
+    auto itr = pricefeed_table_inst.find(token.symbol.raw());
+    if (itr == pricefeed_table_inst.end()) {
+        pricefeed_table_inst.emplace(_self, [&](auto& s) {
+            s.token_symbol = token.symbol;
+            s.last_update = current_time;
+            s.last_price = price;
+            s.price_cumulative = 0;
+        });
+    } else {
+        pricefeed_table_inst.modify(itr, _self, [&](auto& s) {
+            s.price_cumulative += s.last_price * double(current_time - s.last_update);
+            s.last_update = current_time;
+            s.last_price = price;
+        });
+    }
+
+    /* slots are reused once the ring wraps around, so stale candles are overwritten. */
+    uint32_t interval_start = current_time - (current_time % CANDLE_INTERVAL);
+    uint64_t slot = (interval_start / CANDLE_INTERVAL) % NUM_CANDLES;
+    auto open_candle = [&](auto& c) {
+        c.slot = slot;
+        c.start = interval_start;
+        c.open = price;
+        c.high = price;
+        c.low = price;
+        c.close = price;
+        c.eos_volume = eos;
+        c.token_volume = token;
+    };
+
+    candles_type candles_table_inst(_self, token.symbol.raw());
+    auto candle_itr = candles_table_inst.find(slot);
+    if (candle_itr == candles_table_inst.end()) {
+        candles_table_inst.emplace(_self, open_candle);
+    } else if (candle_itr->start != interval_start) {
+        candles_table_inst.modify(candle_itr, _self, open_candle);
+    } else {
+        candles_table_inst.modify(candle_itr, _self, [&](auto& c) {
+            if (price > c.high) c.high = price;
+            if (price < c.low) c.low = price;
+            c.close = price;
+            c.eos_volume += eos;
+            c.token_volume += token;
+        });
     }
 }
 
 void Network::reentrancy_check(bool enter) {
     state_type state_inst(_self, _self.value);
     auto s = state_inst.get();
-    eosio_assert(((!s.during_trade && enter) || (s.during_trade && !enter)),
+    eosio_assert(((!s.during_trade() && enter) || (s.during_trade() && !enter)),
                   "re-entrancy during a trade");
-    s.during_trade = enter;
+    s.set_flag(STATE_DURING_TRADE, enter);
     state_inst.set(s, _self);
 }
 
@@ -295,29 +1519,39 @@ Network::state_type Network::get_state_assert_admin() {
     return state_inst;
 }
 
-void Network::parse_memo(string memo, trade_info &res) {
-    auto parts = split(memo, ",");
-    eosio_assert(parts.size() == EXPECTED_MEMO_LENGTH, "wrong memo length");
+void Network::parse_memo(string_view memo, trade_info &res) {
+    if (is_compact_memo(memo)) {
+        auto compact = decode_compact_memo(memo);
+        res.dest = asset(compact.exact_dest_amount, compact.dest_symbol);
+        res.dest_contract = compact.dest_contract;
+        res.min_conversion_rate = compact.min_conversion_rate;
+        return;
+    }
 
-    auto sym_parts = split(parts[0], " ");
-    eosio_assert(sym_parts.size() == EXPECTED_SYMBOL_PARTS, "wrong num of symbol parts");
-    res.dest = asset(0, symbol(sym_parts[1].c_str(), stoi(sym_parts[0].c_str())));
+    auto parts = split_fields<EXACT_OUTPUT_MEMO_LENGTH>(memo, ',');
+    eosio_assert(parts.size == EXPECTED_MEMO_LENGTH || parts.size == EXACT_OUTPUT_MEMO_LENGTH,
+                 "wrong memo length");
 
-    res.dest_contract = name(parts[1].c_str());
-    res.min_conversion_rate = stof(parts[2].c_str());
+    res.dest = asset(0, parse_symbol(parts[0]));
+    res.dest_contract = name(parts[1]);
+    res.min_conversion_rate = parse_fixed_rate(parts[2]);
+
+    if (parts.size == EXACT_OUTPUT_MEMO_LENGTH) {
+        res.dest.amount = parse_amount(parts[3], res.dest.symbol.precision());
+        eosio_assert(res.dest.amount > 0, "exact dest must be positive");
+    }
 }
 
-trade_info Network::create_trade_info(string memo, name from, asset src, name src_contract) {
-    auto res = trade_info();
+void Network::create_trade_info(string_view memo, name from, asset src, name src_contract, trade_info &res) {
+    res = trade_info();
     res.sender = from;
     res.src = src;
     res.src_contract = src_contract;
 
     parse_memo(memo, res);
-    return res;
 }
 
-void Network::transfer(name from, name to, asset quantity, string memo) {
+void Network::transfer(name from, name to, asset quantity, string_view memo) {
     if (to != _self) return;
 
     state_type state_inst(_self, _self.value);
@@ -327,9 +1561,18 @@ void Network::transfer(name from, name to, asset quantity, string memo) {
     }
 
     auto state = state_inst.get();
-    if (from == state.admin || from == STAKE_ACCOUNT || from == RAM_ACCOUNT) {
+    if (state.during_trade() && state.batch_clearing()) {
+        /* dest of the net trade of a clearing batch, counted by clearbatch3 */
+        return;
+    } else if (from == state.admin || from == STAKE_ACCOUNT || from == RAM_ACCOUNT) {
         /* admin and system accounts can deposit funds, but not trade */
         return;
+    } else if (memo == VAULT_DEPOSIT_MEMO) {
+        vault_deposit(from, quantity, _code, state);
+        return;
+    } else if (memo == TICKET_MEMO) {
+        trade_ticket(from, quantity, _code, state);
+        return;
     } else {
         /* this is a trade */
         trade(from, to, quantity, memo, state);
@@ -341,14 +1584,21 @@ void Network::transfer(name from, name to, asset quantity, string memo) {
 extern "C" {
     [[noreturn]] void apply(uint64_t receiver, uint64_t code, uint64_t action) {
         if (action == "transfer"_n.value && code != receiver) {
-            eosio::execute_action(eosio::name(receiver), eosio::name(code), &Network::transfer);
+            if (accept_transfer(eosio::name(receiver), eosio::name(code))) {
+                execute_transfer(eosio::name(receiver), eosio::name(code), &Network::transfer);
+            }
         } else if (code == receiver) {
             switch (action) {
                 EOSIO_DISPATCH_HELPER( Network, (init)(setadmin)(setenable)(setlistener)(addreserve)
-                                                (listpairres)(withdraw)(trade1)(trade2)(trade3)
-                                                (getexprate)(storeexprate))
+                                                (listpairres)(listpairs)(settrusted)(withdraw)(vaultwd)(vaultpay)(tradeint)(migrate)
+                                                (resync)(ramreport)
+                                                (trade1)(trade2)(trade3)(settle)(tradeint2)(tradeint3)
+                                                (splitquote)(tradesplit)(tradesplit2)
+                                                (getexprate)(storeexprate)(getticket)(storeticket)(getmaxsrc)(storemaxsrc)
+                                                (setbatch)(clearbatch)(cancelbatch)(batchquote)(clearbatch2)(clearbatch3))
             }
         }
+        heap_report();
         eosio_exit(0);
     }
 }
@@ -2,14 +2,36 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <eosiolib/eosio.hpp>
 #include <eosiolib/print.hpp>
 #include <eosiolib/asset.hpp>
 #include <eosiolib/time.hpp>
 #include "../Common/common.hpp"
+#include "../Common/migration.hpp"
+#include "../Common/heapstats.hpp"
+#include "../Common/ramreport.hpp"
+#include "compact_memo.hpp"
 
 #define EXPECTED_MEMO_LENGTH 3
-#define EXPECTED_SYMBOL_PARTS 2
+#define EXACT_OUTPUT_MEMO_LENGTH 4
+#define STATE_ENABLED 0x01
+#define STATE_DURING_TRADE 0x02
+#define STATE_BATCH_CLEARING 0x04 /* the net trade of a batch is paid to the network */
+#define CANDLE_INTERVAL 3600 /* seconds */
+#define NUM_CANDLES 24
+#define BREAKER_THRESHOLD 3 /* consecutive failed rate queries that trip a reserve */
+#define BREAKER_BACKOFF 300 /* seconds, doubled on every failed probe */
+#define BREAKER_MAX_DOUBLINGS 8
+#define MAX_LISTINGS_PER_BATCH 100
+#define TRADE_FEED_SIZE 1000 /* trades kept in the change feed */
+#define TICKET_MEMO "ticket" /* trade memo of a trade against the sender's quote ticket */
+#define TICKET_LIFETIME 3 /* seconds, about 6 blocks */
+#define TICKET_GC_BATCH 2 /* expired tickets erased by each ticket issue or trade */
+#define MAX_RESERVE_MEMO_LENGTH 64 /* receiver,dest contract,dest asset,exact */
+#define MAX_BATCH_ORDERS 50 /* orders in an open batch, bounds the cost of clearing it */
+#define SPLIT_STEPS 4 /* slices a split trade is sized in, each goes to the reserve with the best marginal rate */
+#define SPLIT_MIN_EOS 100000 /* 10.0000 EOS, a smaller trade that a single reserve fills is not split */
 
 using namespace eosio;
 
@@ -19,7 +41,14 @@ struct trade_info {
     asset       src;
     name        dest_contract;
     asset       dest;
-    double      min_conversion_rate;
+    uint128_t   min_conversion_rate; /* fixed point, see RATE_DECIMALS */
+};
+
+/* a reserve's slice of a split trade */
+struct split_leg {
+    name        reserve;
+    asset       src;
+    asset       dest;       /* as the reserve quoted it */
 };
 
 CONTRACT Network : public contract {
@@ -30,8 +59,13 @@ CONTRACT Network : public contract {
             name        admin;
             name        eos_contract;
             name        listener;
-            bool        enabled;
-            bool        during_trade;
+            uint8_t     flags;
+
+            bool enabled() const { return flags & STATE_ENABLED; }
+            bool during_trade() const { return flags & STATE_DURING_TRADE; }
+            bool batch_clearing() const { return flags & STATE_BATCH_CLEARING; }
+            uint8_t schema_version() const { return flags >> SCHEMA_VERSION_SHIFT; }
+            void set_flag(uint8_t flag, bool on) { flags = uint8_t(on ? (flags | flag) : (flags & ~flag)); }
         };
 
         TABLE reserve {
@@ -48,14 +82,216 @@ CONTRACT Network : public contract {
         };
 
         TABLE tokenstats {
-            asset           token_counter;
-            asset           eos_counter;
-            uint64_t        primary_key() const { return token_counter.symbol.raw(); }
+            symbol          token_symbol;
+            int64_t         token_counter;
+            int64_t         eos_counter;
+            uint64_t        primary_key() const { return token_symbol.raw(); }
+
+            asset token_volume() const { return asset(token_counter, token_symbol); }
+            asset eos_volume() const { return asset(eos_counter, EOS_SYMBOL); }
         };
 
+        /*
+         * dest symbol is known to the caller from the queried pair, so only the amount is kept.
+         * Rates are handled in fixed point, stored_rate is kept as double for readers of the table.
+         */
         TABLE rate {
             double      stored_rate;
+            int64_t     dest_amount;
+        };
+
+        /* result of getmaxsrc, reserve is empty if no listed reserve meets the rate. */
+        TABLE maxsrc {
+            asset       src;
+            name        reserve;
+        };
+
+        /*
+         * Per token price accumulator, in EOS per token, updated on every trade.
+         * TWAP between two observations is (cumulative2 - cumulative1) / (time2 - time1),
+         * where the cumulative at time t is price_cumulative + last_price * (t - last_update).
+         */
+        TABLE pricefeed {
+            symbol          token_symbol;
+            uint32_t        last_update;
+            double          last_price;
+            double          price_cumulative;
+            uint64_t        primary_key() const { return token_symbol.raw(); }
+        };
+
+        /* Ring of NUM_CANDLES per interval candles, scoped by token symbol. */
+        TABLE candle {
+            uint64_t        slot;
+            uint32_t        start;
+            double          open;
+            double          high;
+            double          low;
+            double          close;
+            asset           eos_volume;
+            asset           token_volume;
+            uint64_t        primary_key() const { return slot; }
+        };
+
+        /* reserves that settle synchronously within their transfer handler, see settrusted. */
+        TABLE trusted {
+            name        reserve;
+            uint64_t    primary_key() const { return reserve.value; }
+        };
+
+        /* rate query failures of a reserve in one trade direction. */
+        struct breaker {
+            uint8_t     failures;
+            uint8_t     last_reason;
+            uint32_t    retry_after;
+
+            bool tripped() const { return failures >= BREAKER_THRESHOLD; }
+        };
+
+        /*
+         * Circuit breaker per listed reserve, scoped by token symbol.
+         * A tripped reserve is not queried until retry_after, then a single failing
+         * query (the probe) trips it again for twice as long, and a successful one resets it.
+         */
+        TABLE reshealth {
+            name        reserve;
+            breaker     buy;
+            breaker     sell;
+            uint64_t    primary_key() const { return reserve.value; }
+
+            breaker& side(bool is_buy) { return is_buy ? buy : sell; }
+            const breaker& side(bool is_buy) const { return is_buy ? buy : sell; }
+        };
+
+        /* reserve rate row, reason is only present for reserves that report it. */
+        struct reserverate {
+            double      stored_rate;
+            int64_t     dest_amount;
+            uint8_t     reason;
+        };
+
+        /*
+         * Internal balances held by the network for an owner, scoped by token symbol.
+         * Users deposit with a transfer memo of VAULT_DEPOSIT_MEMO and trade them with tradeint,
+         * reserves deposit the same way to serve such trades.
+         */
+        TABLE vaultbal {
+            name        owner;
+            asset       balance;
+            name        token_contract;
+            uint64_t    primary_key() const { return owner.value; }
+        };
+
+        /* a listpairs entry, same as the listpairres arguments. */
+        struct listing {
+            name        reserve;
+            symbol      token_symbol;
+            name        token_contract;
+            bool        add;
+        };
+
+        /* reserve getmaxsrc and getsrcamt result row. */
+        struct reservesrc {
+            asset       src;
+        };
+
+        /*
+         * A quote locked by getticket, one per owner, used once by a trade with a memo of TICKET_MEMO.
+         * The reserve's src and dest balances at quote time fingerprint its state, while they are
+         * unchanged the reserve still quotes the same rate. Expired tickets are erased incrementally.
+         */
+        TABLE ticket {
+            name        owner;
+            name        reserve;
+            asset       src;
+            asset       dest;
+            uint128_t   rate; /* fixed point, see RATE_DECIMALS */
+            uint32_t    expires;
+            int64_t     reserve_src_balance;
+            int64_t     reserve_dest_balance;
+            uint64_t    primary_key() const { return owner.value; }
+            uint64_t    by_expiry() const { return expires; }
+        };
+
+        /* sequence numbers of the change feed, both start from 1. */
+        TABLE feedseq {
+            uint64_t    trade_seq; /* of the last trade appended to tradefeed */
+            uint64_t    config_seq; /* bumped by every listing, reserve or network configuration change */
+        };
+
+        /*
+         * Change feed of the last TRADE_FEED_SIZE trades, keyed by sequence number,
+         * so indexers only read the rows after the last sequence they saw.
+         */
+        TABLE tradefeed {
+            uint64_t    seq;
+            name        sender;
+            name        reserve;
+            asset       src;
             asset       dest;
+            uint32_t    time;
+            uint64_t    primary_key() const { return seq; }
+        };
+
+        /*
+         * Batch mode of a token, set with setbatch. Trades of the token are escrowed as orders
+         * while a batch is open, and cleared together by clearbatch once window seconds passed.
+         */
+        TABLE batch {
+            symbol      token_symbol;
+            uint32_t    window; /* seconds */
+            uint32_t    opened; /* time of the first order of the open batch, 0 if there is none */
+            uint32_t    num_orders;
+            uint64_t    next_order_id;
+            uint64_t    primary_key() const { return token_symbol.raw(); }
+        };
+
+        /* an escrowed trade of an open batch, scoped by token symbol. */
+        TABLE order {
+            uint64_t    id;
+            name        sender;
+            asset       src;
+            uint128_t   min_conversion_rate; /* fixed point, see RATE_DECIMALS */
+            uint64_t    primary_key() const { return id; }
+        };
+
+        /*
+         * Quotes of each reserve for multiples of a step of a split trade, stored by splitquote
+         * in the order they were queried. Erased by tradesplit within the same trade.
+         */
+        TABLE splitquote {
+            uint64_t    id;
+            name        reserve;
+            asset       src;
+            asset       dest;
+            uint64_t    primary_key() const { return id; }
+        };
+
+        /*
+         * Best reserve quote of a whole side of a clearing batch, scoped by token symbol,
+         * keyed by 1 for the buy side and 0 for the sell side. Erased once the batch is cleared.
+         */
+        TABLE batchquote {
+            uint64_t    side;
+            name        reserve;
+            asset       src;
+            asset       dest;
+            uint64_t    primary_key() const { return side; }
+        };
+
+        /*
+         * Token contracts the network accepts transfers of, scoped by token contract, one row per
+         * symbol code. Kept with the listed tokens by listpairres, and read by apply() to reject
+         * transfers of other tokens before the handler runs, see accept_transfer.
+         */
+        TABLE accepted {
+            symbol_code sym;
+            uint64_t    primary_key() const { return sym.raw(); }
+        };
+
+        /* progress of an ongoing migrate, removed when done. */
+        TABLE migration {
+            uint64_t    cursor;
+            uint64_t    rows;
         };
 
         typedef eosio::singleton<"state"_n, state> state_type;
@@ -63,6 +299,43 @@ CONTRACT Network : public contract {
         typedef eosio::multi_index<"reservespert"_n, reservespert> reservespert_type;
         typedef eosio::multi_index<"tokenstats"_n, tokenstats> tokenstats_type;
         typedef eosio::singleton<"rate"_n, rate> rate_type;
+        typedef eosio::singleton<"maxsrc"_n, maxsrc> maxsrc_type;
+        typedef eosio::multi_index<"pricefeed"_n, pricefeed> pricefeed_type;
+        typedef eosio::multi_index<"candles"_n, candle> candles_type;
+        typedef eosio::multi_index<"trustedres"_n, trusted> trusted_type;
+        typedef eosio::multi_index<"reshealth"_n, reshealth> reshealth_type;
+        typedef eosio::multi_index<"vault"_n, vaultbal> vault_type;
+        typedef eosio::singleton<"maxsrc"_n, reservesrc> reserve_maxsrc_type;
+        typedef eosio::singleton<"srcamt"_n, reservesrc> reserve_srcamt_type;
+        typedef eosio::singleton<"migration"_n, migration> migration_type;
+        typedef eosio::multi_index<"accepted"_n, accepted> accepted_type;
+        typedef eosio::singleton<"feedseq"_n, feedseq> feedseq_type;
+        typedef eosio::multi_index<"tradefeed"_n, tradefeed> tradefeed_type;
+        typedef eosio::multi_index<"tickets"_n, ticket,
+            indexed_by<"byexpiry"_n, const_mem_fun<ticket, uint64_t, &ticket::by_expiry>>> tickets_type;
+        typedef eosio::multi_index<"batches"_n, batch> batches_type;
+        typedef eosio::multi_index<"orders"_n, order> orders_type;
+        typedef eosio::multi_index<"batchquotes"_n, batchquote> batchquotes_type;
+        typedef eosio::multi_index<"splitquotes"_n, splitquote> splitquotes_type;
+
+        /* layouts before schema version 1, only used by migrate. */
+        struct legacy_state {
+            name        admin;
+            name        eos_contract;
+            name        listener;
+            bool        enabled;
+            bool        during_trade;
+        };
+
+        struct legacy_tokenstats {
+            asset       token_counter;
+            asset       eos_counter;
+        };
+
+        struct legacy_rate {
+            double      stored_rate;
+            asset       dest;
+        };
 
         /**
          * Init the contract.
@@ -112,6 +385,18 @@ CONTRACT Network : public contract {
          */
         ACTION addreserve(name reserve, bool add);
 
+        /**
+         * Mark/Unmark a reserve as trusted for settlement.
+         * Trades through a trusted reserve skip the balance comparison of trade2,
+         * instead the reserve is told the expected dest and asserts it pays at least that
+         * while handling the src transfer. Only for reserves that pay synchronously, such as AmmReserve.
+         * Can only be called by the admin.
+         *
+         * @param reserve - account of the reserve contract.
+         * @param trusted - mark or unmark.
+         */
+        ACTION settrusted(name reserve, bool trusted);
+
         /**
         * List/Unlist a trade pair on the network.
         * Can only be called by the admin.
@@ -123,6 +408,18 @@ CONTRACT Network : public contract {
         */
         ACTION listpairres(name reserve, symbol token_symbol, name token_contract, bool add);
 
+        /**
+        * List/Unlist many trade pairs in one action, for onboarding reserves in bulk.
+        * The whole batch is validated before any row is written, and each affected
+        * reserve and token row is written once. A reserve that is not added yet is
+        * added by its first listing, so no separate addreserve is needed.
+        * Can only be called by the admin.
+        *
+        * @param listings - up to MAX_LISTINGS_PER_BATCH pairs, each as in listpairres.
+        * A reserve and token pair can only appear once in a batch.
+        */
+        ACTION listpairs(vector<listing> listings);
+
         /**
          * Withdraw funds from the network account. Can only be called by the admin.
          *
@@ -133,6 +430,69 @@ CONTRACT Network : public contract {
          */
         ACTION withdraw(name to, asset quantity, name dest_contract, string memo);
 
+        /**
+         * Withdraw from the internal balance of owner.
+         * Can be called by the owner, a reserve can call it inline to take out what it earned.
+         *
+         * @param owner - account of the internal balance.
+         * @param quantity - asset to withdraw, it is sent to the owner.
+         */
+        ACTION vaultwd(name owner, asset quantity);
+
+        /**
+         * Pay from a reserve's internal balance to another's, by the reserve settling a tradeint.
+         * Can only be called by a listed reserve, during a trade.
+         *
+         * @param reserve - the paying reserve.
+         * @param to - account of the internal balance that is paid.
+         * @param quantity - asset to pay.
+         */
+        ACTION vaultpay(name reserve, name to, asset quantity);
+
+        /**
+         * Trade internal balances, the same as a trade but without token transfers.
+         * src is taken from the owner's internal balance and added to the best reserve's, which
+         * is quoted on what its own internal balance can pay. The reserve then pays dest to the
+         * owner's internal balance with vaultpay, and the network verifies it was added.
+         * Can only be called by the owner.
+         *
+         * @param owner - account of the internal balances.
+         * @param src - src asset to trade.
+         * @param dest_symbol - symbol of the dest token.
+         * @param min_conversion_rate - as in the trade memo.
+         */
+        ACTION tradeint(name owner, asset src, symbol dest_symbol, double min_conversion_rate);
+
+        /**
+         * Convert tables written by a previous contract version to the current compact layout.
+         * Can only be called by the admin, trading is blocked until the migration is done.
+         * Converts up to limit tokenstats rows per call, resuming where the previous call stopped,
+         * and prints the number of converted rows and the bytes saved per row for each table.
+         *
+         * @param limit - maximum number of tokenstats rows to convert in this call.
+         */
+        ACTION migrate(uint32_t limit);
+
+        /**
+         * Rebuild the accepted table from eos and the listed tokens.
+         * Needed when upgrading a network deployed before the table existed, transfers to the
+         * network are rejected as unlisted until it is called. Can only be called by the admin.
+         */
+        ACTION resync();
+
+        /**
+         * Report the RAM used by a table scope, a page of up to limit rows at a time.
+         * Prints the row count and serialized bytes of the page, and the primary key to continue
+         * from. Anyone can call it, nothing is written. scripts/ramreport walks all table scopes
+         * of the contract with it and aggregates the report.
+         *
+         * @param table - table name, of a multi_index or a singleton.
+         * @param scope - scope of the table.
+         * @param cursor - primary key to start from, 0 for the first page.
+         * @param limit - maximum number of rows in the page.
+         */
+        ACTION ramreport(name table, uint64_t scope, uint64_t cursor, uint32_t limit);
+
         /**
          * Get expected rate for a specific pair.
          * Result is written to the “rate” table.
@@ -144,6 +504,68 @@ CONTRACT Network : public contract {
          */
         ACTION getexprate(asset src, symbol dest_symbol);
 
+        /**
+         * Same as getexprate, and also lock the quote for the owner for TICKET_LIFETIME seconds.
+         * A trade of exactly src with a memo of TICKET_MEMO then goes to the quoted reserve
+         * without searching again, as long as the reserve's balances did not change.
+         * An owner has a single ticket, a new one replaces it, and pays its RAM.
+         * Tokens in batch mode have no tickets.
+         *
+         * @param owner - account that will trade against the ticket.
+         * @param src - src asset of the trade.
+         * @param dest_symbol - destination token symbol.
+         */
+        ACTION getticket(name owner, asset src, symbol dest_symbol);
+
+        /**
+         * Get the largest src amount that a single trade can have while getting
+         * a rate of at least min_rate, in one query instead of searching with getexprate.
+         * Result is written to the “maxsrc” table, along with the reserve that would serve it.
+         * Same as getexprate, the table can only be read atomically by on-chain integrations.
+         *
+         * @param token_symbol - the token traded against EOS.
+         * @param buy - whether src is EOS (buying the token) or the token.
+         * @param min_rate - minimum conversion rate, as in the trade memo.
+         */
+        ACTION getmaxsrc(symbol token_symbol, bool buy, double min_rate);
+
+        /**
+         * Set a token to batch mode, or back to immediate trades.
+         * In batch mode a trade of the token is escrowed as an order instead of trading,
+         * until clearbatch clears the open batch. Clearing nets the buys against the sells,
+         * only the imbalance trades on the best reserve, and every order is filled at one
+         * uniform rate. Exact output trades, quote tickets and trades of internal balances
+         * are rejected while a token is in batch mode.
+         * Can only be called by the admin.
+         *
+         * @param token_symbol - a listed token.
+         * @param window - seconds from the first order of a batch until it can be cleared,
+         * 0 to leave batch mode, which requires that no batch is open.
+         */
+        ACTION setbatch(symbol token_symbol, uint32_t window);
+
+        /**
+         * Clear the open batch of a token, once its window passed. Can be called by anyone.
+         * Each side is quoted for its whole volume, and orders with a min conversion rate
+         * above their side's quote are refunded. If buys exceed what the sells cover at the
+         * buy quote, the EOS that the sells do not cover trades on the best buy reserve, and the
+         * other way around for sells. Buyers share all tokens and sellers get EOS at the same rate,
+         * any leftover of the quote being conservative is refunded to the larger side pro rata.
+         * Fills and refunds are credited to the senders' internal balances, withdrawn with vaultwd.
+         *
+         * @param token_symbol - token of the batch.
+         */
+        ACTION clearbatch(symbol token_symbol);
+
+        /**
+         * Cancel the open batch of a token, for when it can not be cleared.
+         * Every order's src is credited back to its sender's internal balance.
+         * Can only be called by the admin.
+         *
+         * @param token_symbol - token of the batch.
+         */
+        ACTION cancelbatch(symbol token_symbol);
+
         /*
          * The following functions are internal actions.
          * They are purposed to only be called internally by the network contract.
@@ -155,6 +577,12 @@ CONTRACT Network : public contract {
         /** internal */
         ACTION storeexprate(asset src, symbol dest_symbol);
 
+        /** internal */
+        ACTION storemaxsrc(symbol token_symbol, bool buy);
+
+        /** internal */
+        ACTION storeticket(name owner, asset src, symbol dest_symbol);
+
         /** internal */
         ACTION trade1(trade_info info);
 
@@ -164,36 +592,134 @@ CONTRACT Network : public contract {
         /** internal */
         ACTION trade3();
 
+        /** internal, stores a reserve's quote for a multiple of the step of a split trade */
+        ACTION splitquote(name reserve, asset src, symbol dest_symbol);
+
+        /**
+         * internal, splits a trade between the reserves in SPLIT_STEPS slices of src. Each slice goes
+         * to the reserve whose quotes say it adds the most dest, its marginal rate, so the reserves end
+         * at similar marginal rates up to the slice size. The split is traded only if its total dest
+         * is more than single_dest, what the best single reserve gives, and meets the min conversion
+         * rate. Otherwise the trade goes to that reserve as usual. The few units of src that do not
+         * divide into slices are refunded.
+         */
+        ACTION tradesplit(trade_info info, name single_reserve, asset single_dest);
+
+        /** internal, verifies the slices of a split trade that untrusted reserves paid */
+        ACTION tradesplit2(trade_info info, vector<split_leg> legs, asset balance_pre);
+
+        /** internal */
+        ACTION tradeint2(name owner, asset src, symbol dest_symbol, uint128_t min_conversion_rate);
+
+        /** internal, verifies the reserve paid dest to the owner's internal balance */
+        ACTION tradeint3(name reserve, name owner, asset src, asset dest, asset balance_pre);
+
+        /** internal, ends a trade through a trusted reserve */
+        ACTION settle(name reserve, name sender, asset src, asset dest);
+
+        /** internal, stores the best quote of a batch side */
+        ACTION batchquote(symbol token_symbol, asset src);
+
+        /** internal, refunds orders below their side's quote and sends the net trade */
+        ACTION clearbatch2(symbol token_symbol);
+
+        /** internal, fills the orders */
+        ACTION clearbatch3(symbol token_symbol, name reserve, asset net_src, asset net_min_dest, asset balance_pre);
+
         /**
          * Notification handler for transfer events from/to this contract.
          * Before init() is called anyone can deposit to the contract.
-         * After init() is called only the admin can deposit.
+         * After init() only eos and listed tokens are accepted, others are rejected in apply().
+         * Only the admin can deposit to the network itself,
+         * and anyone can deposit to their internal balance with a memo of VAULT_DEPOSIT_MEMO.
          * At that stage any other transfer to the contract is regarded as a trade attempt,
          * and expected to have a valid memo for a trade.
          * Note that the memo's min conversion rate parameter is the way for
          * the user to ensure that the actual rate for the trade is not less
-         * than what he expects.
+         * than what he expects. A trade that no single reserve fills at that rate, or of at least
+         * SPLIT_MIN_EOS, is split between the reserves if that gives more, and the whole split
+         * gets at least that rate.
          *
          * @param from - sender.
          * @param to - recipient, this contract.
          * @param quantity - sent asset.
          * @param memo - Expected as “<dest symbol>,<dest contract>,<min conversion rate>”
          * For example: "4 KARMA,therealkarma,7200.0000"
+         * For an exact output trade add “,<dest amount>”, quantity is then the most
+         * the sender is willing to pay, and whatever is not needed for dest is refunded.
+         * Exact output is rejected for a token in batch mode, see setbatch.
+         * For example: "4 KARMA,therealkarma,7200.0000,150.0000"
+         * The same fields can also be sent in the compact encoding described in compact_memo.hpp.
+         * A memo of TICKET_MEMO trades against the sender's quote ticket, see getticket.
          */
-        void transfer(name from, name to, asset quantity, string memo);
+        void transfer(name from, name to, asset quantity, string_view memo);
 
     private:
-        void trade(name from, name to, asset src, string memo, state &current_state);
+        void trade(name from, name to, asset src, string_view memo, state &current_state);
+
+        void trade_ticket(name from, asset src, name src_contract, state &current_state);
+
+        void pay_reserve(const trade_info &info, name reserve, asset src, asset dest, bool exact_output);
+
+        fixed_string<MAX_RESERVE_MEMO_LENGTH> reserve_memo(name receiver, name dest_contract, asset dest, bool exact);
+
+        bool add_batch_order(const trade_info &info, symbol token_symbol);
+
+        void batch_totals(symbol token_symbol, int64_t &buy_total, int64_t &sell_total);
+
+        void assert_not_batched(symbol token_symbol);
+
+        void gc_tickets(uint32_t limit);
+
+        void list_pairs(vector<listing> &listings, bool add_reserves);
+
+        void set_accepted(name token_contract, symbol_code sym, bool accept);
+
+        void vault_deposit(name from, asset quantity, name code, state &current_state);
+
+        void vault_add(name owner, asset quantity, name token_contract);
+
+        name vault_sub(name owner, asset quantity);
+
+        asset vault_balance(name owner, symbol sym);
+
+        void end_trade(name reserve, name sender, asset src, asset dest);
+
+        void async_search_best_rate(const reservespert &token_entry, asset src, bool from_vault);
+
+        void get_best_rate_results(asset src,
+                                   symbol dest_symbol,
+                                   uint128_t &rate,
+                                   int64_t &dest_amount,
+                                   name &reserve);
+
+        void async_search_best_src(const reservespert &token_entry, asset dest);
+
+        void async_search_max_src(const reservespert &token_entry, bool buy, double min_rate);
+
+        bool async_search_split(const trade_info &info, name single_reserve, asset single_dest);
+
+        void get_best_src_results(asset dest, symbol src_symbol, asset &src, name &reserve);
+
+        uint8_t get_reserve_rate(name reserve, uint128_t &rate, int64_t &dest_amount);
+
+        bool reserve_tripped(name reserve, symbol token_symbol, bool buy);
+
+        void update_reserve_health(name reserve, symbol token_symbol, bool buy, uint8_t reason);
+
+        void record_trade(name reserve, name sender, asset src, asset dest);
+
+        void bump_config_seq();
 
-        void async_search_best_rate(reservespert &token_entry, asset src);
+        bool notify_listener(name reserve, name sender, asset src, asset dest);
 
-        void get_best_rate_results(asset src, symbol dest_symbol, double &rate, name &reserve);
+        void update_price_feed(asset eos, asset token);
 
         void reentrancy_check(bool enter);
 
         state_type get_state_assert_admin();
 
-        void parse_memo(string memo, trade_info &info);
+        void parse_memo(string_view memo, trade_info &info);
 
-        trade_info create_trade_info(string memo, name from, asset src, name _code);
+        void create_trade_info(string_view memo, name from, asset src, name _code, trade_info &info);
 };
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <eosiolib/eosio.hpp>
+#include <eosiolib/asset.hpp>
+#include "../Common/common.hpp"
+
+using namespace eosio;
+
+/*
+ * Compact trade memo, an alternative to “<dest symbol>,<dest contract>,<min conversion rate>”
+ * that is shorter on the wire and decodes without string splitting.
+ * The memo is base32 (rfc4648 alphabet in lowercase, no padding) of the payload:
+ *   byte        version << 4 | flags
+ *   varuint     dest symbol raw
+ *   8 bytes     dest contract name value, little endian, only with COMPACT_MEMO_HAS_CONTRACT,
+ *               otherwise the contract the token is listed with is used
+ *   varuint     min conversion rate mantissa
+ *   int8        min conversion rate decimal exponent, rate = mantissa * 10^exponent
+ *   varuint     exact dest amount, only with COMPACT_MEMO_EXACT_OUTPUT
+ * For example "4 KARMA,therealkarma,7200.0000" is "cccjnbms2wurasac" (contract omitted).
+ */
+
+#define COMPACT_MEMO_VERSION 1
+#define COMPACT_MEMO_HAS_CONTRACT 0x01
+#define COMPACT_MEMO_EXACT_OUTPUT 0x02
+#define COMPACT_MEMO_MAX_BYTES 40 /* header, 3 varuints, contract and exponent */
+#define COMPACT_MEMO_MAX_CHARS 64 /* COMPACT_MEMO_MAX_BYTES in base32 */
+
+struct compact_memo {
+    symbol      dest_symbol;
+    name        dest_contract;
+    uint128_t   min_conversion_rate;
+    int64_t     exact_dest_amount;
+};
+
+inline int8_t base32_value(char c) {
+    if (c >= 'a' && c <= 'z') return c - 'a';
+    if (c >= '2' && c <= '7') return c - '2' + 26;
+    return -1;
+}
+
+/* a memo is compact if it is made of base32 characters only, text memos always have separators. */
+inline bool is_compact_memo(string_view memo) {
+    if (memo.empty() || memo.length() > COMPACT_MEMO_MAX_CHARS) return false;
+    for (char c : memo) {
+        if (base32_value(c) < 0) return false;
+    }
+    return true;
+}
+
+/* reads the decoded payload, asserting on truncation. */
+struct compact_memo_reader {
+    const uint8_t*  data;
+    size_t          size;
+    size_t          pos;
+
+    uint8_t byte() {
+        eosio_assert(pos < size, "truncated compact memo");
+        return data[pos++];
+    }
+
+    uint64_t varuint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            value |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) return value;
+        }
+        eosio_assert(false, "bad varuint in compact memo");
+        return 0;
+    }
+
+    uint64_t fixed64() {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++) value |= uint64_t(byte()) << (8 * i);
+        return value;
+    }
+};
+
+inline compact_memo decode_compact_memo(string_view memo) {
+    /* base32 to bytes, 5 bits per char, into a fixed buffer */
+    uint8_t payload[COMPACT_MEMO_MAX_BYTES];
+    size_t size = 0;
+    uint32_t acc = 0;
+    int bits = 0;
+    for (char c : memo) {
+        acc = (acc << 5) | uint32_t(base32_value(c));
+        bits += 5;
+        if (bits >= 8) {
+            bits -= 8;
+            eosio_assert(size < COMPACT_MEMO_MAX_BYTES, "compact memo too long");
+            payload[size++] = uint8_t(acc >> bits);
+            acc &= (1u << bits) - 1;
+        }
+    }
+    eosio_assert(acc == 0, "bad compact memo padding");
+
+    compact_memo_reader reader = {payload, size, 0};
+    uint8_t header = reader.byte();
+    eosio_assert((header >> 4) == COMPACT_MEMO_VERSION, "unsupported compact memo version");
+    uint8_t flags = header & 0x0f;
+
+    compact_memo res;
+    res.dest_symbol = symbol(reader.varuint());
+    eosio_assert(res.dest_symbol.is_valid(), "invalid dest symbol in compact memo");
+    res.dest_contract = (flags & COMPACT_MEMO_HAS_CONTRACT) ? name(reader.fixed64()) : name();
+
+    uint64_t mantissa = reader.varuint();
+    int exponent = int8_t(reader.byte()) + RATE_DECIMALS;
+    eosio_assert(exponent >= 0 && exponent < int(sizeof(POW10) / sizeof(POW10[0])),
+                 "min conversion rate out of range");
+    res.min_conversion_rate = uint128_t(mantissa) * POW10[exponent];
+
+    res.exact_dest_amount = 0;
+    if (flags & COMPACT_MEMO_EXACT_OUTPUT) {
+        uint64_t amount = reader.varuint();
+        eosio_assert(amount > 0 && amount <= uint64_t(MAX_AMOUNT), "invalid exact dest amount");
+        res.exact_dest_amount = int64_t(amount);
+    }
+
+    eosio_assert(reader.pos == reader.size, "trailing bytes in compact memo");
+    return res;
+}
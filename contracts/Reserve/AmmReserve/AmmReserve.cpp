@@ -9,48 +9,54 @@ ACTION AmmReserve::init(name    admin,
                         name    token_contract,
                         name    eos_contract,
                         bool    enable_trade) {
-    eosio_assert(is_account(admin), "admin account does not exist");
-    eosio_assert(is_account(network_contract), "network account does not exist");
-    eosio_assert(is_account(token_contract), "token account does not exist");
-    eosio_assert(is_account(eos_contract), "eos contract does not exist");
+    init_state(admin, network_contract, token_symbol, token_contract, eos_contract, enable_trade);
+}
 
-    require_auth(_self);
+ACTION AmmReserve::initparams(name      admin,
+                              name      network_contract,
+                              symbol    token_symbol,
+                              name      token_contract,
+                              name      eos_contract,
+                              bool      enable_trade,
+                              double    r,
+                              double    p_min,
+                              asset     max_eos_cap_buy,
+                              asset     max_eos_cap_sell,
+                              double    profit_percent,
+                              double    ram_fee,
+                              double    max_sell_rate,
+                              double    min_sell_rate,
+                              name      fee_wallet) {
+    /* validate params before anything is written */
+    params new_params = make_params(r, p_min, max_eos_cap_buy, max_eos_cap_sell, profit_percent, ram_fee,
+                                    max_sell_rate, min_sell_rate, fee_wallet);
+    init_state(admin, network_contract, token_symbol, token_contract, eos_contract, enable_trade);
 
     state_type state_inst(_self, _self.value);
-    eosio_assert(!state_inst.exists(), "init already called");
-
-    state new_state;
-    new_state.admin = admin;
-    new_state.network_contract = network_contract;
-    new_state.token_symbol = token_symbol;
-    new_state.token_contract = token_contract;
-    new_state.eos_contract = eos_contract;
-    new_state.trade_enabled = enable_trade;
-    state_inst.set(new_state, _self);
+    set_curve_params(state_inst.get(), token_symbol, new_params);
 }
 
 ACTION AmmReserve::quickset(double p) {
-    auto state_inst = get_state_assert_admin();
-    params_type params_inst(_self, _self.value);
+    auto state = get_state_assert_admin().get();
     params new_params;
 
     new_params.p_min = p / 2.0;
-    new_params.max_eos_cap_buy = asset(MAX_AMOUNT, EOS_SYMBOL);
-    new_params.max_eos_cap_sell = asset(MAX_AMOUNT, EOS_SYMBOL);
+    new_params.max_eos_cap_buy = MAX_AMOUNT;
+    new_params.max_eos_cap_sell = MAX_AMOUNT;
     new_params.profit_percent = 0.0;
     new_params.ram_fee = 0.0;
     new_params.max_sell_rate = p * 2.0;
     new_params.min_sell_rate = p / 2.0;
-    new_params.max_buy_rate = 1.0 / new_params.min_sell_rate;
-    new_params.min_buy_rate = 1.0 / new_params.max_sell_rate;
     new_params.fee_wallet = name();
 
     /* (p/p_min) = 2.0 = e^(rE) => r = ln(2)/E */
-    asset eos_balance = get_balance(_self, state_inst.get().eos_contract, EOS_SYMBOL);
+    asset eos_balance, token_balance;
+    eosio_assert(get_holdings(state, get_curve(state, state.token_symbol), eos_balance, token_balance),
+                 "inventory not synced");
     eosio_assert(eos_balance.is_valid() && eos_balance.amount > 0, "no balance");
     new_params.r = 0.69314 / amount_to_damount(eos_balance.amount, EOS_PRECISION);
 
-    params_inst.set(new_params, _self);
+    set_curve_params(state, state.token_symbol, new_params);
 }
 
 ACTION AmmReserve::setparams(double r,
@@ -62,40 +68,99 @@ ACTION AmmReserve::setparams(double r,
                              double max_sell_rate,
                              double min_sell_rate,
                              name   fee_wallet) {
+    auto state = get_state_assert_admin().get();
+    set_curve_params(state, state.token_symbol, make_params(r, p_min, max_eos_cap_buy, max_eos_cap_sell,
+                                                            profit_percent, ram_fee, max_sell_rate,
+                                                            min_sell_rate, fee_wallet));
+}
+
+ACTION AmmReserve::setcurve(symbol token_symbol,
+                            double r,
+                            double p_min,
+                            asset  max_eos_cap_buy,
+                            asset  max_eos_cap_sell,
+                            double profit_percent,
+                            double ram_fee,
+                            double max_sell_rate,
+                            double min_sell_rate,
+                            name   fee_wallet) {
+    auto state = get_state_assert_admin().get();
+    set_curve_params(state, token_symbol, make_params(r, p_min, max_eos_cap_buy, max_eos_cap_sell,
+                                                      profit_percent, ram_fee, max_sell_rate,
+                                                      min_sell_rate, fee_wallet));
+}
+
+ACTION AmmReserve::addcurve(symbol token_symbol, name token_contract) {
+    eosio_assert(token_symbol.is_valid() && token_symbol != EOS_SYMBOL, "invalid token symbol");
+    eosio_assert(is_account(token_contract), "token account does not exist");
+
+    auto state = get_state_assert_admin().get();
+    curve_ref existing;
+    eosio_assert(!find_curve(state, token_symbol, existing), "curve already exists");
+
+    curves_type curves_inst(_self, _self.value);
+    curves_inst.emplace(_self, [&](auto& s) {
+        s.token_symbol = token_symbol;
+        s.token_contract = token_contract;
+        s.flags = CURVE_ENABLED;
+    });
+
+    /* tokens already held are of the new curve, eos is given to it with moveeos */
+    inventory_type inventory_inst(_self, token_symbol.raw());
+    inventory_inst.set(inventory{0, get_balance(_self, token_contract, token_symbol).amount, false}, _self);
+    set_accepted(token_contract, token_symbol.code(), true);
+    bump_config_seq();
+}
+
+ACTION AmmReserve::rmcurve(symbol token_symbol) {
     get_state_assert_admin();
 
-    eosio_assert(r >= 0, "illegal r");
-    eosio_assert(p_min > 0, "illegal p_min");
+    curves_type curves_inst(_self, _self.value);
+    auto itr = curves_inst.find(token_symbol.raw());
+    eosio_assert(itr != curves_inst.end(), "unknown curve");
+
+    inventory_type inventory_inst(_self, token_symbol.raw());
+    auto inv = inventory_inst.get_or_default(inventory{0, 0, false});
+    eosio_assert(inv.eos == 0 && inv.token == 0, "curve inventory is not empty");
+
+    inventory_inst.remove();
+    params_type params_inst(_self, token_symbol.raw());
+    params_inst.remove();
+    spot_type spot_inst(_self, token_symbol.raw());
+    spot_inst.remove();
+    set_accepted(itr->token_contract, token_symbol.code(), false);
+    curves_inst.erase(itr);
+    bump_config_seq();
+}
 
-    eosio_assert(max_eos_cap_buy.is_valid() && max_eos_cap_buy.amount > 0,
-                 "illegal max_eos_cap_buy");
-    eosio_assert(max_eos_cap_sell.is_valid() && max_eos_cap_sell.amount > 0,
-                 "illegal max_eos_cap_sell");
+ACTION AmmReserve::enablecurve(symbol token_symbol, bool enable) {
+    get_state_assert_admin();
 
-    eosio_assert(profit_percent >= 0 && profit_percent < 100.0, "illegal profit_percent");
-    eosio_assert(ram_fee >= 0, "illegal ram_fee");
-    if (profit_percent || ram_fee) {
-        eosio_assert(((fee_wallet != name()) && (fee_wallet != "eosio"_n)), "no fee wallet");
-    }
+    curves_type curves_inst(_self, _self.value);
+    auto itr = curves_inst.find(token_symbol.raw());
+    eosio_assert(itr != curves_inst.end(), "unknown curve");
+    curves_inst.modify(itr, _self, [&](auto& s) {
+        s.flags = uint8_t(enable ? (s.flags | CURVE_ENABLED) : (s.flags & ~CURVE_ENABLED));
+    });
+    bump_config_seq();
+}
 
-    eosio_assert(max_sell_rate > 0, "illegal max_sell_rate");
-    eosio_assert(min_sell_rate >= 0, "illegal min_sell_rate");
-    eosio_assert(min_sell_rate <= max_sell_rate, "max_sell_rate smaller than min_sell_rate ");
+ACTION AmmReserve::moveeos(symbol from_symbol, symbol to_symbol, asset quantity) {
+    eosio_assert(quantity.is_valid() && quantity.amount > 0 && quantity.symbol == EOS_SYMBOL,
+                 "illegal quantity");
 
-    params_type params_inst(_self, _self.value);
-    params new_params;
-    new_params.r = r;
-    new_params.p_min = p_min;
-    new_params.max_eos_cap_buy = max_eos_cap_buy;
-    new_params.max_eos_cap_sell = max_eos_cap_sell;
-    new_params.profit_percent = profit_percent;
-    new_params.ram_fee = ram_fee;
-    new_params.max_buy_rate = 1.0 / min_sell_rate;
-    new_params.min_buy_rate = 1.0 / max_sell_rate;
-    new_params.max_sell_rate = max_sell_rate;
-    new_params.min_sell_rate = min_sell_rate;
-    new_params.fee_wallet = fee_wallet;
-    params_inst.set(new_params, _self);
+    auto state = get_state_assert_admin().get();
+    curve_ref from = get_curve(state, from_symbol);
+    curve_ref to = get_curve(state, to_symbol);
+    eosio_assert(from.scope != to.scope, "can not move eos to the same curve");
+
+    inventory_type from_inst(_self, from.scope);
+    inventory_type to_inst(_self, to.scope);
+    eosio_assert(from_inst.exists() && to_inst.exists(), "inventory not synced");
+    eosio_assert(from_inst.get().eos >= quantity.amount, "not enough eos in curve");
+
+    update_inventory(from, -quantity, false);
+    update_inventory(to, quantity, false);
 }
 
 ACTION AmmReserve::setadmin(name admin) {
@@ -106,6 +171,7 @@ ACTION AmmReserve::setadmin(name admin) {
     auto s = state_inst.get();
     s.admin = admin;
     state_inst.set(s, _self);
+    bump_config_seq();
 }
 
 ACTION AmmReserve::setnetwork(name network_contract) {
@@ -116,17 +182,56 @@ ACTION AmmReserve::setnetwork(name network_contract) {
     auto s = state_inst.get();
     s.network_contract = network_contract;
     state_inst.set(s, _self);
+    bump_config_seq();
 }
 
 ACTION AmmReserve::setenable(bool enable) {
     auto state_inst = get_state_assert_admin();
 
     auto s = state_inst.get();
-    s.trade_enabled = enable;
+    s.set_flag(STATE_TRADE_ENABLED, enable);
     state_inst.set(s, _self);
+    bump_config_seq();
 }
 
-ACTION AmmReserve::getconvrate(asset src) {
+ACTION AmmReserve::migrate() {
+    auto state_inst = get_state_assert_admin();
+    auto current_state = state_inst.get();
+    eosio_assert(current_state.schema_version() < SCHEMA_VERSION, "already migrated");
+
+    if (migrate_singleton<legacy_params, params>(_self, "params"_n, [](const legacy_params &l) {
+            return params{l.r,
+                          l.p_min,
+                          l.max_eos_cap_buy.amount,
+                          l.max_eos_cap_sell.amount,
+                          l.profit_percent,
+                          l.ram_fee,
+                          l.max_sell_rate,
+                          l.min_sell_rate,
+                          l.fee_wallet};
+        })) {
+        print("params: 1 rows converted, ", bytes_saved_per_row<legacy_params, params>(),
+              " bytes saved per row\n");
+    }
+
+    if (migrate_singleton<legacy_rate, rate>(_self, "rate"_n, [](const legacy_rate &l) {
+            return rate{l.stored_rate, l.dest.amount, RATE_OK};
+        })) {
+        print("rate: 1 rows converted, ", bytes_saved_per_row<legacy_rate, rate>(),
+              " bytes saved per row\n");
+    }
+
+    /* a legacy state row is read with its trade_enabled bool as the flags byte. */
+    current_state.flags = uint8_t((current_state.flags & STATE_TRADE_ENABLED) |
+                                  (SCHEMA_VERSION << SCHEMA_VERSION_SHIFT));
+    state_inst.set(current_state, _self);
+
+    inventory_type inventory_inst(_self, _self.value);
+    if (!inventory_inst.exists()) sync_inventory(current_state);
+    print("migration done\n");
+}
+
+ACTION AmmReserve::getconvrate(asset src, symbol dest_symbol, bool from_vault) {
     eosio_assert(src.is_valid(), "src amount");
     eosio_assert(src.amount >= 0, "src amount can not be negative");
 
@@ -137,50 +242,153 @@ ACTION AmmReserve::getconvrate(asset src) {
 
     asset dest = asset();
     double charged_fee;
-    double rate_result = reserve_get_conv_rate(src, false, dest, charged_fee);
+    uint8_t reason;
+    symbol token_symbol = (src.symbol == EOS_SYMBOL) ? dest_symbol : src.symbol;
+    double rate_result = reserve_get_conv_rate(token_symbol, src, false, from_vault, dest, charged_fee, reason);
 
     rate_type rate_inst(_self, _self.value);
-    rate s = {rate_result, dest};
+    rate s = {rate_result, dest.amount, reason};
     rate_inst.set(s, _self);
 }
 
+ACTION AmmReserve::getmaxsrc(symbol token_symbol, bool buy, double min_rate) {
+    eosio_assert(min_rate > 0, "min rate must be positive");
+
+    /* same as getconvrate, only network can query */
+    state_type state_inst(_self, _self.value);
+    eosio_assert(state_inst.exists(), "init not called yet");
+    require_auth(state_inst.get().network_contract);
+
+    maxsrc_type maxsrc_inst(_self, _self.value);
+    maxsrc_inst.set({reserve_get_max_src(token_symbol, buy, min_rate)}, _self);
+}
+
+ACTION AmmReserve::getsrcamt(asset dest, symbol src_symbol) {
+    eosio_assert(dest.is_valid(), "invalid dest");
+    eosio_assert(dest.amount > 0, "dest must be positive");
+
+    /* same as getconvrate, only network can query */
+    state_type state_inst(_self, _self.value);
+    eosio_assert(state_inst.exists(), "init not called yet");
+    require_auth(state_inst.get().network_contract);
+
+    srcamt_type srcamt_inst(_self, _self.value);
+    symbol token_symbol = (dest.symbol == EOS_SYMBOL) ? src_symbol : dest.symbol;
+    srcamt_inst.set({reserve_get_src_for_dest(token_symbol, dest)}, _self);
+}
+
+ACTION AmmReserve::vaulttrade(name receiver, asset src, asset min_dest) {
+    state_type state_inst(_self, _self.value);
+    eosio_assert(state_inst.exists(), "init not called yet");
+    auto state = state_inst.get();
+    require_auth(state.network_contract);
+    eosio_assert(state.schema_version() == SCHEMA_VERSION, "table migration pending");
+    eosio_assert(state.trade_enabled(), "trade disabled");
+
+    eosio_assert(src.is_valid() && min_dest.is_valid(), "invalid trade");
+    eosio_assert(src.amount > 0, "src amount must be positive");
+    eosio_assert(receiver != _self, "receiver can not be current contract");
+
+    bool buy = (src.symbol == EOS_SYMBOL);
+    curve_ref curve;
+    eosio_assert(find_curve(state, buy ? min_dest.symbol : src.symbol, curve), "unrecognized src");
+    eosio_assert(curve.enabled, "trade disabled");
+    eosio_assert(min_dest.symbol == (buy ? curve.token_symbol : EOS_SYMBOL), "unexpected dest symbol");
+
+    /* the network credited src to the vault before this action, a buy's rate subtracts it as in trade */
+    asset dest = asset();
+    double charged_fee = 0;
+    uint8_t reason;
+    double conversion_rate = reserve_get_conv_rate(curve.token_symbol, src, buy, true, dest, charged_fee, reason);
+    eosio_assert(conversion_rate > 0, "conversion rate must be bigger than 0");
+    eosio_assert(conversion_rate < MAX_RATE, "fail overflow validation");
+    eosio_assert(dest.amount >= min_dest.amount, "dest below expected");
+
+    /* paid from the internal balance, which also keeps the fee */
+    action {permission_level{_self, "active"_n},
+            state.network_contract,
+            "vaultpay"_n,
+            make_tuple(_self, receiver, dest)}.send();
+}
+
+ACTION AmmReserve::vaultwd(asset quantity) {
+    auto state_inst = get_state_assert_admin();
+
+    action {permission_level{_self, "active"_n},
+            state_inst.get().network_contract,
+            "vaultwd"_n,
+            make_tuple(_self, quantity)}.send();
+}
+
+ACTION AmmReserve::resync() {
+    auto state_inst = get_state_assert_admin();
+    inventory_type inventory_inst(_self, _self.value);
+    auto before = inventory_inst.get_or_default(inventory{0, 0, false});
+
+    sync_inventory(state_inst.get());
+    auto after = inventory_inst.get();
+    print("eos: ", after.eos - before.eos, " token: ", after.token - before.token, " corrected on primary curve\n");
+}
+
+ACTION AmmReserve::ramreport(name table, uint64_t scope, uint64_t cursor, uint32_t limit) {
+    ram_report(_self, table, scope, cursor, limit);
+}
+
 ACTION AmmReserve::withdraw(name to, asset quantity, name dest_contract, string memo) {
     eosio_assert(is_account(to), "to account does not exist");
     eosio_assert(is_account(dest_contract), "dest contract does not exist");
     eosio_assert(quantity.is_valid() && quantity.amount > 0, "illegal quantity");
+    eosio_assert(memo != TRADE_DEST_MEMO && memo != TRADE_FEE_MEMO, "memo is reserved for trades");
 
     get_state_assert_admin();
     async_pay(_self, to, quantity, dest_contract, memo);
 }
 
-double AmmReserve::reserve_get_conv_rate(asset src,
+double AmmReserve::reserve_get_conv_rate(symbol token_symbol,
+                                         asset src,
                                          bool subtract_src,
+                                         bool from_vault,
                                          asset &dest,
-                                         double &charged_fee) {
+                                         double &charged_fee,
+                                         uint8_t &reason) {
     dest = asset();
+    reason = RATE_NOT_READY;
 
     state_type state_inst(_self, _self.value);
     /* if reserve not ready return gracefully (store 0 rate) to continue queries in network */
     if (!state_inst.exists()) return 0;
     auto state = state_inst.get();
-    if (!state.trade_enabled) return 0;
+    if (state.schema_version() != SCHEMA_VERSION) return 0;
+    reason = RATE_DISABLED;
+    if (!state.trade_enabled()) return 0;
+
+    /* a token the reserve has no curve for is not quoted */
+    bool buy = (EOS_SYMBOL == src.symbol) ? true : false;
+    curve_ref curve;
+    reason = RATE_NOT_READY;
+    if (!find_curve(state, token_symbol, curve) || (!buy && src.symbol != token_symbol)) return 0;
+    reason = RATE_DISABLED;
+    if (!curve.enabled) return 0;
 
     /* verify params were set */
-    params_type params_inst(_self, _self.value);
+    reason = RATE_NO_PARAMS;
+    params_type params_inst(_self, curve.scope);
     if (!params_inst.exists()) return 0;
     auto params = params_inst.get();
 
-    bool buy = (EOS_SYMBOL == src.symbol) ? true : false;
-
-    asset eos_balance = get_balance(_self, state.eos_contract, EOS_SYMBOL);
+    reason = RATE_NOT_READY;
+    asset eos_balance, token_balance;
+    if (!get_holdings(state, curve, eos_balance, token_balance)) return 0;
+    asset dest_balance = get_payable(state, curve, buy, from_vault);
     if(subtract_src) {
         /* disregard eos src quantity, so it will not affect e used for rate calc. */
+        reason = RATE_LOW_BALANCE;
         if (src > eos_balance) return 0;
         eos_balance = eos_balance - src;
     }
 
     double rate = liquidity_get_rate(_self,
-                                     eos_balance,
+                                     get_spot(curve, params, eos_balance),
                                      buy,
                                      src,
                                      params.r,
@@ -188,66 +396,436 @@ double AmmReserve::reserve_get_conv_rate(asset src,
                                      params.profit_percent,
                                      params.ram_fee,
                                      charged_fee);
+    reason = RATE_OUT_OF_BAND;
     if (!rate || rate == INFINITY) return 0;
 
-    double min_allowed_rate = buy ? params.min_buy_rate : params.min_sell_rate;
-    double max_allowed_rate = buy ? params.max_buy_rate : params.max_sell_rate;
+    double min_allowed_rate = buy ? params.min_buy_rate() : params.min_sell_rate;
+    double max_allowed_rate = buy ? params.max_buy_rate() : params.max_sell_rate;
     if ((rate > max_allowed_rate) || (rate < min_allowed_rate) || (rate > MAX_RATE)) return 0;
 
-    symbol dest_symbol = buy ? state.token_symbol : EOS_SYMBOL;
+    symbol dest_symbol = buy ? curve.token_symbol : EOS_SYMBOL;
     dest = calc_dest(rate, src, dest_symbol);
 
     asset eos_trade_quantity = buy ? src : dest;
-    asset max_eos_cap = buy ? params.max_eos_cap_buy : params.max_eos_cap_sell;
+    asset max_eos_cap = asset(buy ? params.max_eos_cap_buy : params.max_eos_cap_sell, EOS_SYMBOL);
     if (eos_trade_quantity > max_eos_cap) {
         dest = asset();
+        reason = RATE_CAP_EXCEEDED;
         return 0;
     }
 
     /* make sure reserve has enough of the dest token */
-    name dest_contract = buy ? state.token_contract : state.eos_contract;
-    if (get_balance(_self, dest_contract, dest_symbol) < dest) {
+    if (dest_balance < dest) {
         dest = asset();
+        reason = RATE_LOW_BALANCE;
         return 0;
     }
 
+    reason = RATE_OK;
     return rate;
 }
 
-void AmmReserve::trade(name from, asset src, string memo, name code, state &state) {
-    eosio_assert(state.trade_enabled, "trade disabled");
+asset AmmReserve::reserve_get_max_src(symbol token_symbol, bool buy, double min_rate) {
+    state_type state_inst(_self, _self.value);
+    auto state = state_inst.get();
+    symbol src_symbol = buy ? EOS_SYMBOL : token_symbol;
+    if (state.schema_version() != SCHEMA_VERSION || !state.trade_enabled()) return asset(0, src_symbol);
+
+    curve_ref curve;
+    if (!find_curve(state, token_symbol, curve) || !curve.enabled) return asset(0, src_symbol);
+
+    params_type params_inst(_self, curve.scope);
+    if (!params_inst.exists()) return asset(0, src_symbol);
+    auto params = params_inst.get();
+
+    double max_allowed_rate = buy ? params.max_buy_rate() : params.max_sell_rate;
+    double min_allowed_rate = buy ? params.min_buy_rate() : params.min_sell_rate;
+    if (min_rate > max_allowed_rate) return asset(0, src_symbol);
+    min_rate = std::max(min_rate, min_allowed_rate);
+
+    asset eos_balance, token_balance;
+    if (!get_holdings(state, curve, eos_balance, token_balance)) return asset(0, src_symbol);
+
+    liq_info info = {params.r, params.p_min, params.profit_percent, params.ram_fee};
+    double p = get_spot(curve, params, eos_balance);
+    double max_src = liquidity_get_max_src(info, p, buy, min_rate);
+
+    /* bound by the eos cap and by what the reserve can pay of dest, trades settle from its account */
+    double dest_balance = asset_to_damount(get_payable(state, curve, buy, false));
+    max_src = std::min(max_src, liquidity_get_src_for_dest(info, p, buy, dest_balance));
+    if (buy) {
+        max_src = std::min(max_src, amount_to_damount(params.max_eos_cap_buy, EOS_PRECISION));
+    } else {
+        double cap = amount_to_damount(params.max_eos_cap_sell, EOS_PRECISION);
+        max_src = std::min(max_src, liquidity_get_src_for_dest(info, p, buy, cap));
+    }
+    max_src = std::min(max_src, amount_to_damount(MAX_AMOUNT, src_symbol.precision()));
+    if (!(max_src > 0)) return asset(0, src_symbol);
+
+    /* the solution is exact up to rounding, confirm with the trade's own rate calculation */
+    asset src = asset(damount_to_amount(max_src, src_symbol.precision()), src_symbol);
+    int64_t step = 1;
+    for (int i = 0; (src.amount > 0) && (i < MAX_SOLVER_ITERATIONS); i++) {
+        asset dest;
+        double charged_fee;
+        uint8_t reason;
+        if (reserve_get_conv_rate(token_symbol, src, false, false, dest, charged_fee, reason) >= min_rate) return src;
+        src.amount = std::max(src.amount - step, int64_t(0));
+        step *= 2;
+    }
+    return asset(0, src_symbol);
+}
+
+asset AmmReserve::reserve_get_src_for_dest(symbol token_symbol, asset dest) {
+    state_type state_inst(_self, _self.value);
+    auto state = state_inst.get();
+    bool buy = (dest.symbol == token_symbol);
+    symbol src_symbol = buy ? EOS_SYMBOL : token_symbol;
+    if (!buy && dest.symbol != EOS_SYMBOL) return asset(0, src_symbol);
+    if (state.schema_version() != SCHEMA_VERSION || !state.trade_enabled()) return asset(0, src_symbol);
+
+    curve_ref curve;
+    if (!find_curve(state, token_symbol, curve) || !curve.enabled) return asset(0, src_symbol);
+
+    params_type params_inst(_self, curve.scope);
+    if (!params_inst.exists()) return asset(0, src_symbol);
+    auto params = params_inst.get();
+
+    asset eos_balance, token_balance;
+    if (!get_holdings(state, curve, eos_balance, token_balance)) return asset(0, src_symbol);
+
+    liq_info info = {params.r, params.p_min, params.profit_percent, params.ram_fee};
+    double src_damount = liquidity_get_src_for_dest(info, get_spot(curve, params, eos_balance), buy,
+                                                    asset_to_damount(dest));
+    if (!(src_damount > 0) || (src_damount >= amount_to_damount(MAX_AMOUNT, src_symbol.precision()))) {
+        return asset(0, src_symbol);
+    }
+
+    /* round up, then confirm with the trade's own rate calculation, which also applies caps and band */
+    asset src = asset(damount_to_amount(src_damount, src_symbol.precision()), src_symbol);
+    if (amount_to_damount(src.amount, src_symbol.precision()) < src_damount) src.amount++;
+    int64_t step = 1;
+    for (int i = 0; i < MAX_SOLVER_ITERATIONS; i++) {
+        asset quoted_dest;
+        double charged_fee;
+        uint8_t reason;
+        double rate = reserve_get_conv_rate(token_symbol, src, false, false, quoted_dest, charged_fee, reason);
+        if (!rate) break;
+        if (quoted_dest >= dest) return src;
+        src.amount += step;
+        step *= 2;
+    }
+    return asset(0, src_symbol);
+}
+
+void AmmReserve::trade(name from, asset src, string_view memo, name code, state &state) {
+    eosio_assert(state.schema_version() == SCHEMA_VERSION, "table migration pending");
+    eosio_assert(state.trade_enabled(), "trade disabled");
     eosio_assert(from == state.network_contract, "only network can perform a trade");
     bool buy = (src.symbol == EOS_SYMBOL) ? true : false;
 
-    name expected_src_contract = buy ? state.eos_contract : state.token_contract;
-    eosio_assert(code == expected_src_contract, "wrong src contract");
-
     eosio_assert(src.is_valid(), "invalid transfer");
     eosio_assert(src.amount > 0, "src amount must be positive");
-    eosio_assert(src.symbol == EOS_SYMBOL || src.symbol == state.token_symbol, "unrecognized src");
 
-    params_type params_inst(_self, _self.value);
+    /* network sends "receiver,dest contract,min dest", or "receiver,dest contract,dest,exact"
+       for exact output trades. A bare "receiver" is still accepted. */
+    auto memo_parts = split_fields<EXACT_MEMO_PARTS>(memo, ',');
+    eosio_assert(memo_parts.size == 1 || memo_parts.size == TRUSTED_MEMO_PARTS ||
+                 memo_parts.size == EXACT_MEMO_PARTS, "bad trade memo");
+    name receiver = name(memo_parts[0]);
+    eosio_assert(receiver != _self, "receiver can not be current contract");
+    bool has_min_dest = (memo_parts.size >= TRUSTED_MEMO_PARTS);
+    asset min_dest = has_min_dest ? parse_asset(memo_parts[2]) : asset();
+
+    /* a sell trades on the curve of its src, a buy on the curve of the dest symbol */
+    symbol token_symbol = !buy ? src.symbol : (has_min_dest ? min_dest.symbol : state.token_symbol);
+    curve_ref curve;
+    eosio_assert(find_curve(state, token_symbol, curve), "unrecognized src");
+    eosio_assert(curve.enabled, "trade disabled");
+
+    name expected_src_contract = buy ? state.eos_contract : curve.token_contract;
+    eosio_assert(code == expected_src_contract, "wrong src contract");
+
+    params_type params_inst(_self, curve.scope);
     eosio_assert(params_inst.exists(), "params were not set");
     auto params = params_inst.get();
 
-    name receiver = name(memo.c_str());
-    eosio_assert(receiver != _self, "receiver can not be current contract");
+    symbol dest_symbol = buy ? curve.token_symbol : EOS_SYMBOL;
+    name dest_contract = buy ? curve.token_contract : state.eos_contract;
 
-    symbol dest_symbol = buy ? state.token_symbol : EOS_SYMBOL;
-    name dest_contract = buy ? state.token_contract : state.eos_contract;
+    /* before trading, a buy's rate is calculated with its src subtracted from the inventory */
+    update_inventory(curve, src, false);
 
     /* get conversion rate again */
     asset dest = asset();
     double charged_fee = 0;
-    double conversion_rate = reserve_get_conv_rate(src, buy, dest, charged_fee);
+    uint8_t reason;
+    double conversion_rate = reserve_get_conv_rate(curve.token_symbol, src, buy, false, dest, charged_fee, reason);
     eosio_assert(conversion_rate > 0, "conversion rate must be bigger than 0");
     eosio_assert(conversion_rate < MAX_RATE, "fail overflow validation");
 
-    async_pay(_self, receiver, dest, dest_contract, "trade dest");
+    if (has_min_dest) {
+        eosio_assert(name(memo_parts[1]) == dest_contract, "unexpected dest contract");
+        eosio_assert(min_dest.symbol == dest_symbol, "unexpected dest symbol");
+        eosio_assert(dest.amount >= min_dest.amount, "dest below expected");
+        if (memo_parts.size == EXACT_MEMO_PARTS) {
+            eosio_assert(memo_parts[3] == "exact", "bad trade memo");
+            dest.amount = min_dest.amount;
+        }
+    }
+
+    /* trade payments are accounted here, the transfer handler skips their memos */
+    async_pay(_self, receiver, dest, dest_contract, TRADE_DEST_MEMO);
+    update_inventory(curve, -dest, false);
 
     asset charged_fee_asset = asset(damount_to_amount(charged_fee, EOS_PRECISION), EOS_SYMBOL);
     if (charged_fee_asset.amount > 0) {
-        async_pay(_self, params.fee_wallet, charged_fee_asset, state.eos_contract, "send fee");
+        async_pay(_self, params.fee_wallet, charged_fee_asset, state.eos_contract, TRADE_FEE_MEMO);
+        update_inventory(curve, -charged_fee_asset, false);
+    }
+    store_spot(state, curve, params);
+}
+
+void AmmReserve::init_state(name    admin,
+                            name    network_contract,
+                            symbol  token_symbol,
+                            name    token_contract,
+                            name    eos_contract,
+                            bool    enable_trade) {
+    eosio_assert(is_account(admin), "admin account does not exist");
+    eosio_assert(is_account(network_contract), "network account does not exist");
+    eosio_assert(is_account(token_contract), "token account does not exist");
+    eosio_assert(is_account(eos_contract), "eos contract does not exist");
+
+    require_auth(_self);
+
+    state_type state_inst(_self, _self.value);
+    eosio_assert(!state_inst.exists(), "init already called");
+
+    state new_state;
+    new_state.admin = admin;
+    new_state.network_contract = network_contract;
+    new_state.token_symbol = token_symbol;
+    new_state.token_contract = token_contract;
+    new_state.eos_contract = eos_contract;
+    new_state.flags = uint8_t(SCHEMA_VERSION << SCHEMA_VERSION_SHIFT);
+    new_state.set_flag(STATE_TRADE_ENABLED, enable_trade);
+    state_inst.set(new_state, _self);
+
+    /* funds may have been deposited before init */
+    sync_inventory(new_state);
+}
+
+AmmReserve::params AmmReserve::make_params(double r,
+                                           double p_min,
+                                           asset  max_eos_cap_buy,
+                                           asset  max_eos_cap_sell,
+                                           double profit_percent,
+                                           double ram_fee,
+                                           double max_sell_rate,
+                                           double min_sell_rate,
+                                           name   fee_wallet) {
+    eosio_assert(r >= 0, "illegal r");
+    eosio_assert(p_min > 0, "illegal p_min");
+
+    eosio_assert(max_eos_cap_buy.is_valid() && max_eos_cap_buy.amount > 0,
+                 "illegal max_eos_cap_buy");
+    eosio_assert(max_eos_cap_sell.is_valid() && max_eos_cap_sell.amount > 0,
+                 "illegal max_eos_cap_sell");
+    eosio_assert(max_eos_cap_buy.symbol == EOS_SYMBOL && max_eos_cap_sell.symbol == EOS_SYMBOL,
+                 "eos caps must be in EOS");
+
+    eosio_assert(profit_percent >= 0 && profit_percent < 100.0, "illegal profit_percent");
+    eosio_assert(ram_fee >= 0, "illegal ram_fee");
+    if (profit_percent || ram_fee) {
+        eosio_assert(((fee_wallet != name()) && (fee_wallet != "eosio"_n)), "no fee wallet");
+    }
+
+    eosio_assert(max_sell_rate > 0, "illegal max_sell_rate");
+    eosio_assert(min_sell_rate >= 0, "illegal min_sell_rate");
+    eosio_assert(min_sell_rate <= max_sell_rate, "max_sell_rate smaller than min_sell_rate ");
+
+    params new_params;
+    new_params.r = r;
+    new_params.p_min = p_min;
+    new_params.max_eos_cap_buy = max_eos_cap_buy.amount;
+    new_params.max_eos_cap_sell = max_eos_cap_sell.amount;
+    new_params.profit_percent = profit_percent;
+    new_params.ram_fee = ram_fee;
+    new_params.max_sell_rate = max_sell_rate;
+    new_params.min_sell_rate = min_sell_rate;
+    new_params.fee_wallet = fee_wallet;
+    return new_params;
+}
+
+/* the primary curve is described by the state, the others by their row in curves. */
+bool AmmReserve::find_curve(const state &state, symbol token_symbol, curve_ref &curve) {
+    if (token_symbol == state.token_symbol) {
+        curve = {state.token_symbol, state.token_contract, _self.value, true, true};
+        return true;
+    }
+
+    curves_type curves_inst(_self, _self.value);
+    auto itr = curves_inst.find(token_symbol.raw());
+    if (itr == curves_inst.end()) return false;
+    curve = {itr->token_symbol, itr->token_contract, token_symbol.raw(), itr->enabled(), false};
+    return true;
+}
+
+AmmReserve::curve_ref AmmReserve::get_curve(const state &state, symbol token_symbol) {
+    curve_ref curve;
+    eosio_assert(find_curve(state, token_symbol, curve), "unknown curve");
+    return curve;
+}
+
+void AmmReserve::set_curve_params(const state &state, symbol token_symbol, const params &new_params) {
+    auto curve = get_curve(state, token_symbol);
+    params_type params_inst(_self, curve.scope);
+    params_inst.set(new_params, _self);
+    store_spot(state, curve, new_params);
+    bump_config_seq();
+}
+
+void AmmReserve::bump_config_seq() {
+    configseq_type configseq_inst(_self, _self.value);
+    auto current = configseq_inst.get_or_default();
+    current.seq++;
+    configseq_inst.set(current, _self);
+}
+
+/*
+ * inventory of the curve plus the internal balances kept for the reserve in the network vault,
+ * returns false if there is no inventory row yet. The eos vault balance is of the primary curve.
+ */
+bool AmmReserve::get_holdings(const state &state, const curve_ref &curve, asset &eos, asset &token) {
+    inventory_type inventory_inst(_self, curve.scope);
+    if (!inventory_inst.exists()) return false;
+    auto inv = inventory_inst.get();
+    eos = asset(inv.eos, EOS_SYMBOL);
+    token = asset(inv.token, curve.token_symbol);
+    if (!inv.vault) return true;
+
+    if (curve.primary) {
+        vault_type eos_vault_inst(state.network_contract, EOS_SYMBOL.raw());
+        auto itr = eos_vault_inst.find(_self.value);
+        if (itr != eos_vault_inst.end() && itr->token_contract == state.eos_contract) eos += itr->balance;
+    }
+
+    vault_type token_vault_inst(state.network_contract, curve.token_symbol.raw());
+    auto itr = token_vault_inst.find(_self.value);
+    if (itr != token_vault_inst.end() && itr->token_contract == curve.token_contract) token += itr->balance;
+    return true;
+}
+
+/*
+ * what the reserve can pay of the dest of a trade on the curve, from the balance the trade settles
+ * from: the inventory for trades paid by transfer, or the internal balance in the network vault
+ * for tradeint. As in get_holdings, the eos internal balance is of the primary curve.
+ */
+asset AmmReserve::get_payable(const state &state, const curve_ref &curve, bool buy, bool from_vault) {
+    symbol dest_symbol = buy ? curve.token_symbol : EOS_SYMBOL;
+    inventory_type inventory_inst(_self, curve.scope);
+    auto inv = inventory_inst.get_or_default(inventory{0, 0, false});
+    if (!from_vault) return asset(buy ? inv.token : inv.eos, dest_symbol);
+    if (!inv.vault || (!buy && !curve.primary)) return asset(0, dest_symbol);
+
+    name dest_contract = buy ? curve.token_contract : state.eos_contract;
+    vault_type vault_inst(state.network_contract, dest_symbol.raw());
+    auto itr = vault_inst.find(_self.value);
+    if (itr == vault_inst.end() || itr->token_contract != dest_contract) return asset(0, dest_symbol);
+    return itr->balance;
+}
+
+/* spot price at eos_balance, read from the spot row when it was computed at that balance. */
+double AmmReserve::get_spot(const curve_ref &curve, const params &params, asset eos_balance) {
+    spot_type spot_inst(_self, curve.scope);
+    if (spot_inst.exists()) {
+        auto current = spot_inst.get();
+        if (current.eos == eos_balance.amount) return current.p;
+    }
+    liq_info info = {params.r, params.p_min, params.profit_percent, params.ram_fee};
+    return p_of_e(info, asset_to_damount(eos_balance));
+}
+
+/*
+ * recomputes the spot row at the current holdings. Multiplying the previous price by
+ * exp(r * delta_e) costs the same exp, so the row is written exactly and does not drift.
+ */
+void AmmReserve::store_spot(const state &state, const curve_ref &curve, const params &params) {
+    asset eos_balance, token_balance;
+    if (!get_holdings(state, curve, eos_balance, token_balance)) return;
+    liq_info info = {params.r, params.p_min, params.profit_percent, params.ram_fee};
+    spot_type spot_inst(_self, curve.scope);
+    spot_inst.set(spot{p_of_e(info, asset_to_damount(eos_balance)), eos_balance.amount}, _self);
+}
+
+/* quantity is eos or the curve's token, negative when leaving the reserve */
+void AmmReserve::update_inventory(const curve_ref &curve, asset quantity, bool vault_deposit) {
+    inventory_type inventory_inst(_self, curve.scope);
+    if (!inventory_inst.exists()) return; /* counted by the next resync */
+    auto inv = inventory_inst.get();
+
+    if (quantity.symbol == EOS_SYMBOL) {
+        inv.eos += quantity.amount;
+    } else {
+        inv.token += quantity.amount;
+    }
+    inv.vault = inv.vault || vault_deposit;
+    inventory_inst.set(inv, _self);
+}
+
+/* a transfer other than a trade, eos is of the primary curve and tokens of their own curve */
+void AmmReserve::account_transfer(const state &state, name code, asset quantity, bool vault_deposit) {
+    curve_ref curve;
+    if (quantity.symbol == EOS_SYMBOL) {
+        if (code != state.eos_contract) return;
+        curve = get_curve(state, state.token_symbol);
+    } else if (!find_curve(state, quantity.symbol, curve) || code != curve.token_contract) {
+        return;
+    }
+    update_inventory(curve, quantity, vault_deposit);
+}
+
+/* tokens are synced per curve, the eos not given to other curves is of the primary curve */
+void AmmReserve::sync_inventory(const state &state) {
+    auto has_vault_row = [&](symbol sym) {
+        vault_type vault_inst(state.network_contract, sym.raw());
+        return vault_inst.find(_self.value) != vault_inst.end();
+    };
+
+    int64_t curves_eos = 0;
+    curves_type curves_inst(_self, _self.value);
+    for (auto itr = curves_inst.begin(); itr != curves_inst.end(); itr++) {
+        inventory_type curve_inventory_inst(_self, itr->token_symbol.raw());
+        auto inv = curve_inventory_inst.get_or_default(inventory{0, 0, false});
+        inv.token = get_balance(_self, itr->token_contract, itr->token_symbol).amount;
+        inv.vault = has_vault_row(itr->token_symbol);
+        curve_inventory_inst.set(inv, _self);
+        curves_eos += inv.eos;
+        set_accepted(itr->token_contract, itr->token_symbol.code(), true);
+    }
+
+    inventory new_inventory;
+    new_inventory.eos = get_balance(_self, state.eos_contract, EOS_SYMBOL).amount - curves_eos;
+    eosio_assert(new_inventory.eos >= 0, "curves hold more eos than the reserve");
+    new_inventory.token = get_balance(_self, state.token_contract, state.token_symbol).amount;
+    new_inventory.vault = has_vault_row(EOS_SYMBOL) || has_vault_row(state.token_symbol);
+
+    inventory_type inventory_inst(_self, _self.value);
+    inventory_inst.set(new_inventory, _self);
+    set_accepted(state.eos_contract, EOS_SYMBOL.code(), true);
+    set_accepted(state.token_contract, state.token_symbol.code(), true);
+}
+
+void AmmReserve::set_accepted(name token_contract, symbol_code sym, bool accept) {
+    accepted_type accepted_inst(_self, token_contract.value);
+    auto itr = accepted_inst.find(sym.raw());
+    if (accept && itr == accepted_inst.end()) {
+        accepted_inst.emplace(_self, [&](auto& s) {
+            s.sym = sym;
+        });
+    } else if (!accept && itr != accepted_inst.end()) {
+        accepted_inst.erase(itr);
     }
 }
 
@@ -258,8 +836,8 @@ AmmReserve::state_type AmmReserve::get_state_assert_admin() {
     return state_inst;
 }
 
-void AmmReserve::transfer(name from, name to, asset quantity, string memo) {
-    if (to != _self) return;
+void AmmReserve::transfer(name from, name to, asset quantity, string_view memo) {
+    if (to != _self && from != _self) return;
 
     state_type state_inst(_self, _self.value);
     if (!state_inst.exists()) {
@@ -268,8 +846,23 @@ void AmmReserve::transfer(name from, name to, asset quantity, string memo) {
     }
 
     auto state = state_inst.get();
+    if (from == _self) {
+        /* trade dest and fees were accounted by trade */
+        if (memo == TRADE_DEST_MEMO || memo == TRADE_FEE_MEMO) return;
+
+        /* withdrawals and deposits to the network vault */
+        bool vault_deposit = (to == state.network_contract && memo == VAULT_DEPOSIT_MEMO);
+        account_transfer(state, _code, -quantity, vault_deposit);
+        return;
+    }
+
     if (from == state.admin || from == STAKE_ACCOUNT || from == RAM_ACCOUNT) {
         /* admin and system accounts can deposit funds, but not trade */
+        account_transfer(state, _code, quantity, false);
+        return;
+    } else if (from == state.network_contract && memo == VAULT_WITHDRAW_MEMO) {
+        /* taken out of the network vault with vaultwd */
+        account_transfer(state, _code, quantity, false);
         return;
     } else {
         trade(from, quantity, memo, _code, state);
@@ -281,13 +874,18 @@ void AmmReserve::transfer(name from, name to, asset quantity, string memo) {
 extern "C" {
     [[noreturn]] void apply(uint64_t receiver, uint64_t code, uint64_t action) {
         if (action == "transfer"_n.value && code != receiver) {
-            eosio::execute_action(eosio::name(receiver), eosio::name(code), &AmmReserve::transfer);
+            if (accept_transfer(eosio::name(receiver), eosio::name(code))) {
+                execute_transfer(eosio::name(receiver), eosio::name(code), &AmmReserve::transfer);
+            }
         } else if (code == receiver) {
             switch (action) {
-                EOSIO_DISPATCH_HELPER(AmmReserve, (init)(quickset)(setparams)(setadmin)(setnetwork)
-                                                  (setenable)(getconvrate)(withdraw))
+                EOSIO_DISPATCH_HELPER(AmmReserve, (init)(initparams)(quickset)(setparams)(setcurve)(addcurve)
+                                                  (rmcurve)(enablecurve)(moveeos)(setadmin)(setnetwork)
+                                                  (setenable)(migrate)(getconvrate)(getmaxsrc)
+                                                  (getsrcamt)(vaulttrade)(vaultwd)(resync)(withdraw)(ramreport))
             }
         }
+        heap_report();
         eosio_exit(0);
     }
 }
@@ -1,47 +1,161 @@
 #pragma once
 
 #include <string>
+#include <algorithm>
 #include <eosiolib/eosio.hpp>
 #include <eosiolib/print.hpp>
 #include <eosiolib/asset.hpp>
 #include <eosiolib/singleton.hpp>
 #include "../../Common/common.hpp"
+#include "../../Common/migration.hpp"
+#include "../../Common/heapstats.hpp"
+#include "../../Common/ramreport.hpp"
+
+#define STATE_TRADE_ENABLED 0x01
+#define CURVE_ENABLED 0x01
+#define TRUSTED_MEMO_PARTS 3 /* receiver,dest contract,min dest */
+#define EXACT_MEMO_PARTS 4 /* receiver,dest contract,dest,exact */
+#define TRADE_DEST_MEMO "trade dest"
+#define TRADE_FEE_MEMO "send fee"
 
 CONTRACT AmmReserve : public contract {
     public:
         using contract::contract;
 
+        /*
+         * token_symbol and token_contract are of the primary curve, set in init.
+         * The rows of the primary curve are in the contract scope, those of curves
+         * added with addcurve are scoped by token symbol.
+         */
         TABLE state {
             name        admin;
             name        network_contract;
             symbol      token_symbol;
             name        token_contract;
             name        eos_contract;
-            bool        trade_enabled;
+            uint8_t     flags;
+
+            bool trade_enabled() const { return flags & STATE_TRADE_ENABLED; }
+            uint8_t schema_version() const { return flags >> SCHEMA_VERSION_SHIFT; }
+            void set_flag(uint8_t flag, bool on) { flags = uint8_t(on ? (flags | flag) : (flags & ~flag)); }
+        };
+
+        /* a curve added with addcurve, trading its token against eos of its own inventory. */
+        TABLE curve {
+            symbol      token_symbol;
+            name        token_contract;
+            uint8_t     flags;
+
+            uint64_t primary_key() const { return token_symbol.raw(); }
+            bool enabled() const { return flags & CURVE_ENABLED; }
         };
 
+        /* eos caps are kept as EOS amounts, buy rates are derived from the sell rates. */
         TABLE params {
             double      r;
             double      p_min;
-            asset       max_eos_cap_buy;
-            asset       max_eos_cap_sell;
+            int64_t     max_eos_cap_buy;
+            int64_t     max_eos_cap_sell;
             double      profit_percent;
             double      ram_fee;
-            double      max_buy_rate;
-            double      min_buy_rate;
             double      max_sell_rate;
             double      min_sell_rate;
             name        fee_wallet;
+
+            double max_buy_rate() const { return 1.0 / min_sell_rate; }
+            double min_buy_rate() const { return 1.0 / max_sell_rate; }
         };
 
         TABLE rate {
             double      stored_rate;
-            asset       dest;
+            int64_t     dest_amount;
+            uint8_t     reason;
+        };
+
+        TABLE maxsrc {
+            asset       src;
+        };
+
+        TABLE srcamt {
+            asset       src;
+        };
+
+        /*
+         * Amounts of eos and token of a curve, kept by the transfer handler and trade so
+         * quotes do not read the token contracts' tables. The eos of the account is split
+         * between the curves, see moveeos. vault is set once the curve's token was
+         * deposited to the network vault, only then are its vault rows read as well.
+         */
+        TABLE inventory {
+            int64_t     eos;
+            int64_t     token;
+            bool        vault;
+        };
+
+        /*
+         * Spot price of a curve, p_min * exp(r * e), and the eos holdings e it was computed at.
+         * Written when the params change and after each trade, so a spot quote is a table read.
+         * A row whose eos differs from the holdings is stale, and the price is recomputed.
+         */
+        TABLE spot {
+            double      p;
+            int64_t     eos;
+        };
+
+        /* bumped by every configuration change, so indexers only reread the reserve when it moved. */
+        TABLE configseq {
+            uint64_t    seq;
+        };
+
+        /*
+         * Token contracts the reserve accepts transfers of, scoped by token contract, one row per
+         * symbol code: eos and the tokens of its curves. Read by apply() to reject transfers of
+         * other tokens before the handler runs, see accept_transfer.
+         */
+        TABLE accepted {
+            symbol_code sym;
+            uint64_t    primary_key() const { return sym.raw(); }
+        };
+
+        /* the reserve's row in the network vault, see Network::vaultbal. */
+        struct vaultbal {
+            name        owner;
+            asset       balance;
+            name        token_contract;
+            uint64_t    primary_key() const { return owner.value; }
         };
 
         typedef eosio::singleton<"state"_n, state> state_type;
+        typedef eosio::multi_index<"curves"_n, curve> curves_type;
         typedef eosio::singleton<"params"_n, params> params_type;
         typedef eosio::singleton<"rate"_n, rate> rate_type;
+        typedef eosio::singleton<"maxsrc"_n, maxsrc> maxsrc_type;
+        typedef eosio::singleton<"srcamt"_n, srcamt> srcamt_type;
+        typedef eosio::singleton<"inventory"_n, inventory> inventory_type;
+        typedef eosio::singleton<"spot"_n, spot> spot_type;
+        typedef eosio::singleton<"configseq"_n, configseq> configseq_type;
+        typedef eosio::multi_index<"vault"_n, vaultbal> vault_type;
+        typedef eosio::multi_index<"accepted"_n, accepted> accepted_type;
+
+        /* layouts before schema version 1, only used by migrate. */
+        struct legacy_params {
+            double      r;
+            double      p_min;
+            asset       max_eos_cap_buy;
+            asset       max_eos_cap_sell;
+            double      profit_percent;
+            double      ram_fee;
+            double      max_buy_rate;
+            double      min_buy_rate;
+            double      max_sell_rate;
+            double      min_sell_rate;
+            name        fee_wallet;
+        };
+
+        struct legacy_rate {
+            double      stored_rate;
+            asset       dest;
+        };
 
         /**
          * Init the reserve.
@@ -52,8 +166,8 @@ CONTRACT AmmReserve : public contract {
          * and configure the reserve contract.
          * @param network_contract - contract of the network the reserve is listed on.
          * Only the network contract is allowed to trade through the reserve.
-         * @param token_symbol - the symbol of the token traded on the reserve.
-         * @param token_contract - the contract implementing the token traded on the reserve.
+         * @param token_symbol - the symbol of the token traded on the reserve's primary curve.
+         * @param token_contract - the contract implementing the token of the primary curve.
          * @param eos_contract - account of eos native token, usually eosio.token.
          * @param enable_trade - whether to initiate the reserve in an operating state,
          * or otherwise wait for a setenable operation.
@@ -65,6 +179,28 @@ CONTRACT AmmReserve : public contract {
                     name    eos_contract,
                     bool    enable_trade);
 
+        /**
+         * Init the reserve and set its parameters in one action, for onboarding reserves in bulk.
+         * Same as init followed by setparams, and like init can only be called once, and only
+         * by the reserve account authority. All arguments are validated before anything is written.
+         * See init and setparams for the arguments.
+         */
+        ACTION initparams(name      admin,
+                          name      network_contract,
+                          symbol    token_symbol,
+                          name      token_contract,
+                          name      eos_contract,
+                          bool      enable_trade,
+                          double    r,
+                          double    p_min,
+                          asset     max_eos_cap_buy,
+                          asset     max_eos_cap_sell,
+                          double    profit_percent,
+                          double    ram_fee,
+                          double    max_sell_rate,
+                          double    min_sell_rate,
+                          name      fee_wallet);
+
         /**
          * Set reserve parameters quickly, using default values.
          * Can only be called by the reserve admin.
@@ -78,7 +214,7 @@ CONTRACT AmmReserve : public contract {
         ACTION quickset(double p);
 
         /**
-        * Set reserve parameters.
+        * Set reserve parameters, of the primary curve.
         * Can only be called by the reserve admin.
         *
         * @param r - liquidity rate.
@@ -101,6 +237,62 @@ CONTRACT AmmReserve : public contract {
                          double min_sell_rate,
                          name   fee_wallet);
 
+        /**
+         * Set the parameters of a curve, same as setparams.
+         * Can only be called by the reserve admin.
+         *
+         * @param token_symbol - token of the curve, the primary token or one added with addcurve.
+         */
+        ACTION setcurve(symbol token_symbol,
+                        double r,
+                        double p_min,
+                        asset  max_eos_cap_buy,
+                        asset  max_eos_cap_sell,
+                        double profit_percent,
+                        double ram_fee,
+                        double max_sell_rate,
+                        double min_sell_rate,
+                        name   fee_wallet);
+
+        /**
+         * Add a curve for another token, so one reserve serves many pairs.
+         * The curve starts with the reserve's balance of the token and no eos, eos is
+         * moved to it with moveeos, and its parameters are set with setcurve.
+         * Can only be called by the reserve admin.
+         *
+         * @param token_symbol - symbol of the token.
+         * @param token_contract - contract implementing the token.
+         */
+        ACTION addcurve(symbol token_symbol, name token_contract);
+
+        /**
+         * Remove a curve added with addcurve, its inventory must be empty.
+         * Can only be called by the reserve admin.
+         *
+         * @param token_symbol - token of the curve.
+         */
+        ACTION rmcurve(symbol token_symbol);
+
+        /**
+         * Enable or disable a single curve added with addcurve.
+         * Can only be called by the reserve admin.
+         *
+         * @param token_symbol - token of the curve.
+         * @param enable - enable or disable.
+         */
+        ACTION enablecurve(symbol token_symbol, bool enable);
+
+        /**
+         * Move eos between the inventories of two curves.
+         * Eos deposits and withdrawals are of the primary curve, so eos reaches
+         * other curves through it. Can only be called by the reserve admin.
+         *
+         * @param from_symbol - token of the curve to take eos from.
+         * @param to_symbol - token of the curve to give eos to.
+         * @param quantity - eos amount.
+         */
+        ACTION moveeos(symbol from_symbol, symbol to_symbol, asset quantity);
+
         /**
          * Change the admin account.
          * Can only be called by the reserve admin.
@@ -127,17 +319,51 @@ CONTRACT AmmReserve : public contract {
          */
         ACTION setenable(bool enable);
 
+        /**
+         * Convert the reserve tables written by a previous contract version to the current
+         * compact layout. Can only be called by the reserve admin.
+         * Trades and rate queries are disabled until the migration is done.
+         * Prints the bytes saved per row for each converted table.
+         */
+        ACTION migrate();
+
         /**
          * Get conversion rate.
          * Can only be called by the network contract, as registered in the reserve.
-         * Result will be written to the trade table.
+         * Result will be written to the rate table, along with the reason for a 0 rate.
          *
-         * @param src - src asset for the rate query. Can be either EOS or the reserve’s token.
+         * @param src - src asset for the rate query. Can be either EOS or a token of the reserve.
+         * @param dest_symbol - EOS, or the token of the curve when src is EOS.
+         * @param from_vault - whether the trade is a tradeint, paid from the reserve's internal
+         * balance in the network vault rather than from its account. dest is bounded by that balance.
          */
-        ACTION getconvrate(asset src);
+        ACTION getconvrate(asset src, symbol dest_symbol, bool from_vault);
+
+        /**
+         * Get the largest src amount that can be traded at a rate of at least min_rate,
+         * within the eos caps and the reserve's dest balance.
+         * Can only be called by the network contract, as registered in the reserve.
+         * Result will be written to the maxsrc table, 0 if no amount meets min_rate.
+         *
+         * @param token_symbol - token of the curve.
+         * @param buy - whether src is EOS (buying the token) or the token.
+         * @param min_rate - minimum rate, in the trade direction's convention.
+         */
+        ACTION getmaxsrc(symbol token_symbol, bool buy, double min_rate);
+
+        /**
+         * Get the src amount needed to receive exactly dest, fees included.
+         * Can only be called by the network contract, as registered in the reserve.
+         * Result will be written to the srcamt table, 0 if the reserve can not provide dest.
+         *
+         * @param dest - the requested dest asset. Can be either EOS or a token of the reserve.
+         * @param src_symbol - EOS, or the token of the curve when dest is EOS.
+         */
+        ACTION getsrcamt(asset dest, symbol src_symbol);
 
         /* Withdraw funds from the reserve account.
          * Can only be called by the reserve admin.
+         * Eos is taken from the primary curve, tokens from their curve.
          *
          * @param to - account to withdraw to.
          * @param quantity - asset to withdraw.
@@ -146,26 +372,136 @@ CONTRACT AmmReserve : public contract {
          */
         ACTION withdraw(name to, asset quantity, name dest_contract, string memo);
 
+        /**
+         * Trade of the network's tradeint, settled within the network vault.
+         * The network credits src to the reserve's internal balance before calling it, and the
+         * reserve pays dest from its internal balance to the receiver's with the network's vaultpay.
+         * Can only be called by the network contract, as registered in the reserve.
+         *
+         * @param receiver - owner of the internal balance that receives dest.
+         * @param src - src asset, already credited to the reserve.
+         * @param min_dest - the least dest the reserve pays, its symbol selects the curve of a buy.
+         */
+        ACTION vaulttrade(name receiver, asset src, asset min_dest);
+
+        /**
+         * Withdraw from the reserve's internal balance in the network vault, to the reserve.
+         * Internal balances serve the network's tradeint, and are deposited with a withdraw
+         * to the network with a memo of VAULT_DEPOSIT_MEMO.
+         * Can only be called by the reserve admin.
+         *
+         * @param quantity - asset to withdraw from the vault.
+         */
+        ACTION vaultwd(asset quantity);
+
+        /**
+         * Reconcile the inventory rows with the reserve's actual token balances, and rebuild
+         * the accepted table. Needed after funds arrived before init, or when upgrading a reserve
+         * that has no inventory row or accepted table yet. Any eos difference is applied to the primary curve.
+         * Can only be called by the reserve admin.
+         * Prints the correction applied to each amount.
+         */
+        ACTION resync();
+
+        /**
+         * Report the RAM used by a table scope, a page of up to limit rows at a time.
+         * Prints the row count and serialized bytes of the page, and the primary key to continue
+         * from. Anyone can call it, nothing is written. scripts/ramreport walks all table scopes
+         * of the contract with it and aggregates the report.
+         *
+         * @param table - table name, of a multi_index or a singleton.
+         * @param scope - scope of the table.
+         * @param cursor - primary key to start from, 0 for the first page.
+         * @param limit - maximum number of rows in the page.
+         */
+        ACTION ramreport(name table, uint64_t scope, uint64_t cursor, uint32_t limit);
+
         /* Notification handler for transfer events from/to this contract.
+         * Every transfer of eos or a curve's token from/to this contract updates the inventory,
+         * eos transfers other than trades are of the primary curve.
          * Before init() is called anyone can deposit to the contract.
-         * After init() is called only the contract admin can deposit.
+         * After init() is called only the contract admin can deposit, and only eos and the
+         * tokens of the curves are accepted, others are rejected in apply().
+         * Transfers from the network vault are deposits as well.
          * Any other transfer to the contract is regarded as a trade attempt.
          * A trade is expected to come from the network account and have a valid memo.
          *
          * @param name - sender.
          * @param to - recipient, this contract.
          * @quantity - sent asset
-         * @memo - for trades expected as “<dest account>”. For example: "bob111111111".
+         * @memo - for trades expected as “<dest account>,<dest contract>,<min dest>”,
+         * for example "bob111111111,eosio.token,1.2345 EOS". The reserve asserts it pays at
+         * least min dest, and the symbol of min dest selects the curve of a buy.
+         * Exact output trades add “,exact”, in which case exactly dest is paid and any
+         * surplus of the curve is kept by the reserve.
+         * A memo of “<dest account>” alone trades on the primary curve for buys.
          */
-        void transfer(name from, name to, asset quantity, string memo);
+        void transfer(name from, name to, asset quantity, string_view memo);
 
     private:
-        double reserve_get_conv_rate(asset src,
+        void init_state(name    admin,
+                        name    network_contract,
+                        symbol  token_symbol,
+                        name    token_contract,
+                        name    eos_contract,
+                        bool    enable_trade);
+
+        params make_params(double r,
+                           double p_min,
+                           asset  max_eos_cap_buy,
+                           asset  max_eos_cap_sell,
+                           double profit_percent,
+                           double ram_fee,
+                           double max_sell_rate,
+                           double min_sell_rate,
+                           name   fee_wallet);
+
+        /* a curve as used internally, scope is where its params and inventory rows are. */
+        struct curve_ref {
+            symbol      token_symbol;
+            name        token_contract;
+            uint64_t    scope;
+            bool        enabled;
+            bool        primary;
+        };
+
+        bool find_curve(const state &state, symbol token_symbol, curve_ref &curve);
+
+        curve_ref get_curve(const state &state, symbol token_symbol);
+
+        double reserve_get_conv_rate(symbol token_symbol,
+                                     asset src,
                                      bool subtract_src,
+                                     bool from_vault,
                                      asset &dest,
-                                     double &charged_fee);
+                                     double &charged_fee,
+                                     uint8_t &reason);
+
+        asset reserve_get_max_src(symbol token_symbol, bool buy, double min_rate);
+
+        asset reserve_get_src_for_dest(symbol token_symbol, asset dest);
+
+        void trade(name from, asset src, string_view memo, name code, state &state);
+
+        void set_curve_params(const state &state, symbol token_symbol, const params &new_params);
+
+        bool get_holdings(const state &state, const curve_ref &curve, asset &eos, asset &token);
+
+        asset get_payable(const state &state, const curve_ref &curve, bool buy, bool from_vault);
+
+        void update_inventory(const curve_ref &curve, asset quantity, bool vault_deposit);
+
+        double get_spot(const curve_ref &curve, const params &params, asset eos_balance);
+
+        void store_spot(const state &state, const curve_ref &curve, const params &params);
+
+        void account_transfer(const state &state, name code, asset quantity, bool vault_deposit);
+
+        void sync_inventory(const state &state);
+
+        void set_accepted(name token_contract, symbol_code sym, bool accept);
 
-        void trade(name from, asset src, string memo, name code, state &state);
+        void bump_config_seq();
 
         state_type get_state_assert_admin();
 };
@@ -6,6 +6,9 @@
 
 #include <math.h>
 
+#define MAX_SOLVER_ITERATIONS 32
+#define SOLVER_TOLERANCE 1e-12 /* relative */
+
 using namespace eosio;
 
 struct liq_info {
@@ -19,16 +22,17 @@ double p_of_e(struct liq_info &info, double e) {
     return info.p_min * exp(info.r * e);
 }
 
-double get_delta_t(struct liq_info &info, double e, double delta_e) {
-    return (-1) * (exp(-info.r * delta_e) - 1.0) / (info.r * p_of_e(info, e));
+/* the curve functions below take p, the spot price p_of_e at the current eos balance. */
+double get_delta_t(struct liq_info &info, double p, double delta_e) {
+    return (-1) * (exp(-info.r * delta_e) - 1.0) / (info.r * p);
 }
 
-double get_delta_e(struct liq_info &info, double e, double delta_t) {
-    return ((log(1 + info.r * p_of_e(info, e) * delta_t)) / info.r);
+double get_delta_e(struct liq_info &info, double p, double delta_t) {
+    return ((log(1 + info.r * p * delta_t)) / info.r);
 }
 
 double liquidity_get_rate(name self_contract,
-                          asset eos_balance,
+                          double p,
                           bool buy,
                           asset src,
                           double r,
@@ -38,13 +42,12 @@ double liquidity_get_rate(name self_contract,
                           double &charged_fee) {
 
     liq_info info = {r, p_min, profit_percent, ram_fee};
-    double e = asset_to_damount(eos_balance);
     double src_damount = asset_to_damount(src);
     double dest_damount;
     double rate;
 
     if (!src_damount) {
-        double pre_profit_rate = buy ? (1 / p_of_e(info, e)) : p_of_e(info, e);
+        double pre_profit_rate = buy ? (1 / p) : p;
         rate = ((100.0 - info.profit_percent) * pre_profit_rate) / 100.0;
     } else {
         if (buy) {
@@ -54,9 +57,9 @@ double liquidity_get_rate(name self_contract,
                 return 0;
             }
             charged_fee += info.ram_fee;
-            dest_damount = get_delta_t(info, e, src_damount - charged_fee);
+            dest_damount = get_delta_t(info, p, src_damount - charged_fee);
         } else {
-            double delta_e = get_delta_e(info, e, src_damount);
+            double delta_e = get_delta_e(info, p, src_damount);
             charged_fee = (info.profit_percent * delta_e) / 100.0;
             dest_damount = delta_e - charged_fee;
         }
@@ -64,3 +67,69 @@ double liquidity_get_rate(name self_contract,
     }
     return rate;
 }
+
+/* fraction of the src (buy) or of the curve's eos output (sell) that is left after profit. */
+double after_profit(struct liq_info &info) {
+    return (100.0 - info.profit_percent) / 100.0;
+}
+
+/*
+ * Inverse of the trade curve, src amount that yields exactly dest_damount, including fees.
+ * Returns INFINITY if no src is large enough.
+ */
+double liquidity_get_src_for_dest(struct liq_info &info, double p, bool buy, double dest_damount) {
+    double rp = info.r * p;
+    if (buy) {
+        /* dest = get_delta_t(delta_e), delta_e = a * src - ram_fee */
+        if (rp * dest_damount >= 1.0) return INFINITY;
+        double delta_e = -log(1.0 - rp * dest_damount) / info.r;
+        return (delta_e + info.ram_fee) / after_profit(info);
+    } else {
+        /* dest = a * get_delta_e(src) */
+        return (exp(info.r * dest_damount / after_profit(info)) - 1.0) / rp;
+    }
+}
+
+/*
+ * Largest src amount for which the trade rate is at least min_rate, 0 if there is none.
+ * dest(src) is concave, so dest(src) - min_rate * src has at most one root past its peak,
+ * which newton's method reaches monotonically when started from its right.
+ */
+double liquidity_get_max_src(struct liq_info &info, double p, bool buy, double min_rate) {
+    double a = after_profit(info);
+    double rp = info.r * p;
+    if ((min_rate <= 0) || (rp <= 0)) return 0;
+
+    /* g(x) = dest(x) - min_rate * x, and its derivative dg */
+    auto g = [&](double x, double &dg) {
+        if (buy) {
+            double ex = exp(-info.r * (a * x - info.ram_fee));
+            dg = a * ex / p - min_rate;
+            return (1.0 - ex) / rp - min_rate * x;
+        }
+        dg = a * p / (1.0 + rp * x) - min_rate;
+        return a * log(1.0 + rp * x) / info.r - min_rate * x;
+    };
+
+    double x;
+    double dg;
+    if (buy) {
+        /* dest never reaches 1 / rp, so g is negative from there on */
+        x = 1.0 / (rp * min_rate);
+    } else {
+        /* the sell rate only decreases from its spot value */
+        if (min_rate >= a * p) return 0;
+        x = 1.0 / rp;
+        for (int i = 0; (g(x, dg) >= 0) && (i < MAX_SOLVER_ITERATIONS); i++) x *= 2;
+    }
+
+    for (int i = 0; i < MAX_SOLVER_ITERATIONS; i++) {
+        double gx = g(x, dg);
+        /* rising slope with g still negative means the peak is below min_rate */
+        if (dg >= 0) return (gx >= 0) ? x : 0;
+        double step = gx / dg;
+        x -= step;
+        if (fabs(step) <= SOLVER_TOLERANCE * x) break;
+    }
+    return (x > 0) ? x : 0;
+}
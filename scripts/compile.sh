@@ -1,6 +1,8 @@
-set -x
-rm contracts/Mock/Token/*.wasm contracts/Mock/Token/*.abi contracts/Reserve/AmmReserve/*.wasm contracts/Reserve/AmmReserve/*.abi
+set -ex
+# outputs of a failed build are not left behind for size.js or the deploy scripts
+rm -f contracts/Mock/Token/*.wasm contracts/Mock/Token/*.abi contracts/Mock/LegacyReserve/*.wasm contracts/Mock/LegacyReserve/*.abi contracts/Listener/*.wasm contracts/Listener/*.abi contracts/Reserve/AmmReserve/*.wasm contracts/Reserve/AmmReserve/*.abi contracts/Network/*.wasm contracts/Network/*.abi
 cd contracts/Mock/Token/ ; eosio-cpp -I ./ -o Token.wasm Token.cpp --abigen; cd ../../../
+cd contracts/Mock/LegacyReserve/ ; eosio-cpp -I ./ -o LegacyReserve.wasm LegacyReserve.cpp --abigen; cd ../../../
 cd contracts/Listener/ ; eosio-cpp -I ./ -o Listener.wasm Listener.cpp --abigen; cd ../../
-cd contracts/Reserve/AmmReserve ; eosio-cpp -I ./ -o AmmReserve.wasm AmmReserve.cpp --abigen ; cd ../../..
-cd contracts/Network/ ; eosio-cpp -I ./ -o Network.wasm Network.cpp --abigen ; cd ../../
\ No newline at end of file
+cd contracts/Reserve/AmmReserve ; eosio-cpp -I ./ ${HEAP_STATS:+-DHEAP_STATS} -o AmmReserve.wasm AmmReserve.cpp --abigen ; cd ../../..
+cd contracts/Network/ ; eosio-cpp -I ./ ${HEAP_STATS:+-DHEAP_STATS} -o Network.wasm Network.cpp --abigen ; cd ../../
\ No newline at end of file
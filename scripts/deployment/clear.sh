@@ -14,10 +14,11 @@ EOS_ACCOUNT=eosio.token
 ###### reserve ######
 #$meos set contract $OLD_CUSD_RESERVE_ACCOUNT --clear
 #$meos set contract $OLD_CUSD_RESERVE_ACCOUNT contracts/Mock ClearAmmReserve.wasm --abi ClearAmmReserve.abi -p $OLD_CUSD_RESERVE_ACCOUNT@active
-#$meos push action $OLD_CUSD_RESERVE_ACCOUNT clear "{}" -p $OLD_CUSD_RESERVE_ACCOUNT@active
+#$meos push action $OLD_CUSD_RESERVE_ACCOUNT clear '{"limit":100}' -p $OLD_CUSD_RESERVE_ACCOUNT@active
 
 ###### network ######
  #$meos set contract $OLD_NETWORK_ACCOUNT --clear
  #$meos set contract $OLD_NETWORK_ACCOUNT contracts/Mock ClearNetwork.wasm --abi ClearNetwork.abi -p $OLD_NETWORK_ACCOUNT@active
- #$meos push action $OLD_NETWORK_ACCOUNT clear "{}" -p $OLD_NETWORK_ACCOUNT@active
+ # clear is chunked, repeat until it prints "clear done"
+ #until $meos push action $OLD_NETWORK_ACCOUNT clear '{"limit":100}' -p $OLD_NETWORK_ACCOUNT@active 2>&1 | grep -q "clear done"; do :; done
  
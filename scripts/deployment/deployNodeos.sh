@@ -65,19 +65,19 @@ cleos push action reserve1 setparams '[ "0.01", "0.05", "20.0000 EOS", "20.0000
 
 #get conversion rate for buy
 cleos get table reserve reserve rate
-cleos push action reserve getconvrate '[ "0.0100 EOS"]' -p network@active
+cleos push action reserve getconvrate '[ "0.0100 EOS", "4,SYS", false]' -p network@active
 cleos get table reserve reserve rate
 cleos push action eosio.token transfer '[ "network", "reserve", "0.0100 EOS", "alice" ]' -p network@active
 
 cleos get table reserve1 reserve1 rate
-cleos push action reserve1 getconvrate '[ "0.0100 EOS"]' -p network@active
+cleos push action reserve1 getconvrate '[ "0.0100 EOS", "4,OTA", false]' -p network@active
 cleos get table reserve1 reserve1 rate
 cleos push action eosio.token transfer '[ "network", "reserve1", "0.0100 EOS", "alice" ]' -p network@active
 
 #get conversion rate for sell
-cleos push action reserve getconvrate '[ "1.0000 SYS"]' -p network@active
+cleos push action reserve getconvrate '[ "1.0000 SYS", "4,EOS", false]' -p network@active
 cleos push action eosio.token transfer '[ "network", "reserve", "0.0100 SYS", "alice" ]' -p network@active
-cleos push action reserve1 getconvrate '[ "1.0000 OTA"]' -p network@active
+cleos push action reserve1 getconvrate '[ "1.0000 OTA", "4,EOS", false]' -p network@active
 cleos push action other.token transfer '[ "network", "reserve1", "1.0000 OTA", "alice" ]' -p network@active
 
 cleos get table reserve reserve rate
@@ -130,11 +130,13 @@ exit
 #this can not be done with scatter/bloks.io since can not pronounce "" there (for listener)
 ####$meos push action $NETWORK_ACCOUNT init "[ \"$ACCOUNT_NAME\", \"$EOS_ACCOUNT\", \"\", true ]" -p $NETWORK_ACCOUNT@active
 
+# add the reserves and list all pairs in one action
+LISTINGS=""
 for idx in 0 1 2 3 4 5
 do
-	$meos push action $NETWORK_ACCOUNT addreserve "[ \"${ARR_RESERVE_ACCOUNT[$idx]}\", true ]" -p $ACCOUNT_NAME@active
-	$meos push action $NETWORK_ACCOUNT listpairres "[ \"${ARR_RESERVE_ACCOUNT[$idx]}\", \"${ARR_DECIMALS[$idx]},${ARR_SYMBOL[$idx]}\", \"${ARR_TOKEN_ACCOUNT[$idx]}\", true ]" -p $ACCOUNT_NAME@active
+	LISTINGS="$LISTINGS${LISTINGS:+, }{\"reserve\": \"${ARR_RESERVE_ACCOUNT[$idx]}\", \"token_symbol\": \"${ARR_DECIMALS[$idx]},${ARR_SYMBOL[$idx]}\", \"token_contract\": \"${ARR_TOKEN_ACCOUNT[$idx]}\", \"add\": true}"
 done
+$meos push action $NETWORK_ACCOUNT listpairs "[ [ $LISTINGS ] ]" -p $ACCOUNT_NAME@active
 
 #$meos push action $NETWORK_ACCOUNT setadmin "[\"$NETWORK_ADMIN_ACCOUNT\"]" -p $ACCOUNT_NAME@active
 
@@ -0,0 +1,198 @@
+/*
+ * ABI based action data serialization, enough for the profiler to build
+ * action payloads from the scenario json (same conventions as eosjs/cleos:
+ * assets as "1.0000 EOS", symbols as "4,EOS", names as strings).
+ */
+
+const NAME_CHARS = '.12345abcdefghijklmnopqrstuvwxyz'
+
+function nameToBigInt(str) {
+    let value = 0n
+    for (let i = 0; i < 13; i++) {
+        const c = i < str.length ? NAME_CHARS.indexOf(str[i]) : 0
+        if (c < 0) throw new Error(`invalid name ${str}`)
+        if (i < 12) {
+            value |= BigInt(c & 0x1f) << BigInt(64 - 5 * (i + 1))
+        } else {
+            value |= BigInt(c & 0x0f)
+        }
+    }
+    return value
+}
+
+function bigIntToName(value) {
+    value = BigInt.asUintN(64, BigInt(value))
+    const chars = []
+    let tmp = value
+    for (let i = 0; i <= 12; i++) {
+        const c = Number(tmp & (i === 0 ? 0x0fn : 0x1fn))
+        chars.unshift(NAME_CHARS[c])
+        tmp >>= (i === 0 ? 4n : 5n)
+    }
+    return chars.join('').replace(/\.+$/, '')
+}
+
+function symbolCodeToBigInt(code) {
+    let value = 0n
+    for (let i = code.length - 1; i >= 0; i--) {
+        value = (value << 8n) | BigInt(code.charCodeAt(i))
+    }
+    return value
+}
+
+function parseSymbol(str) {
+    const [precision, code] = str.split(',')
+    return {precision: parseInt(precision), code}
+}
+
+function parseAsset(str) {
+    const [amountStr, code] = str.trim().split(/\s+/)
+    const [whole, fraction = ''] = amountStr.replace('-', '').split('.')
+    let amount = BigInt(whole + fraction)
+    if (amountStr.startsWith('-')) amount = -amount
+    return {amount, precision: fraction.length, code}
+}
+
+class Writer {
+    constructor() { this.bytes = [] }
+
+    u8(v) { this.bytes.push(v & 0xff) }
+
+    fixed(v, size) {
+        let x = BigInt.asUintN(size * 8, BigInt(v))
+        for (let i = 0; i < size; i++) {
+            this.u8(Number(x & 0xffn))
+            x >>= 8n
+        }
+    }
+
+    varuint32(v) {
+        do {
+            let byte = v & 0x7f
+            v >>>= 7
+            if (v) byte |= 0x80
+            this.u8(byte)
+        } while (v)
+    }
+
+    float64(v) {
+        const buf = Buffer.alloc(8)
+        buf.writeDoubleLE(Number(v))
+        buf.forEach(b => this.u8(b))
+    }
+
+    float32(v) {
+        const buf = Buffer.alloc(4)
+        buf.writeFloatLE(Number(v))
+        buf.forEach(b => this.u8(b))
+    }
+
+    raw(bytes) { bytes.forEach(b => this.u8(b)) }
+
+    symbol(sym) {
+        this.u8(sym.precision)
+        const code = Buffer.from(sym.code)
+        for (let i = 0; i < 7; i++) this.u8(i < code.length ? code[i] : 0)
+    }
+}
+
+const BUILTIN = {
+    bool:         (w, v) => w.u8(v === true || v === 1 || v === '1' || v === 'true' ? 1 : 0),
+    int8:         (w, v) => w.fixed(v, 1),
+    uint8:        (w, v) => w.fixed(v, 1),
+    int16:        (w, v) => w.fixed(v, 2),
+    uint16:       (w, v) => w.fixed(v, 2),
+    int32:        (w, v) => w.fixed(v, 4),
+    uint32:       (w, v) => w.fixed(v, 4),
+    int64:        (w, v) => w.fixed(v, 8),
+    uint64:       (w, v) => w.fixed(v, 8),
+    int128:       (w, v) => w.fixed(v, 16),
+    uint128:      (w, v) => w.fixed(v, 16),
+    varuint32:    (w, v) => w.varuint32(Number(v)),
+    float32:      (w, v) => w.float32(v),
+    float64:      (w, v) => w.float64(v),
+    name:         (w, v) => w.fixed(nameToBigInt(v), 8),
+    time_point:   (w, v) => w.fixed(v, 8),
+    time_point_sec: (w, v) => w.fixed(v, 4),
+    block_timestamp_type: (w, v) => w.fixed(v, 4),
+    symbol_code:  (w, v) => w.fixed(symbolCodeToBigInt(v), 8),
+    symbol:       (w, v) => w.symbol(parseSymbol(v)),
+    string:       (w, v) => {
+        const bytes = Buffer.from(v, 'utf8')
+        w.varuint32(bytes.length)
+        w.raw(bytes)
+    },
+    bytes:        (w, v) => {
+        const bytes = Buffer.from(v, 'hex')
+        w.varuint32(bytes.length)
+        w.raw(bytes)
+    },
+    checksum256:  (w, v) => w.raw(Buffer.from(v, 'hex')),
+    asset:        (w, v) => {
+        const a = parseAsset(v)
+        w.fixed(a.amount, 8)
+        w.symbol(a)
+    },
+    extended_asset: (w, v) => {
+        BUILTIN.asset(w, v.quantity)
+        BUILTIN.name(w, v.contract)
+    }
+}
+
+class Abi {
+    constructor(abi) {
+        this.abi = abi
+        this.structs = {}
+        this.typedefs = {}
+        this.actions = {}
+        for (const s of abi.structs || []) this.structs[s.name] = s
+        for (const t of abi.types || []) this.typedefs[t.new_type_name] = t.type
+        for (const a of abi.actions || []) this.actions[a.name] = a.type
+    }
+
+    resolve(type) {
+        while (this.typedefs[type]) type = this.typedefs[type]
+        return type
+    }
+
+    write(w, type, value) {
+        type = this.resolve(type)
+        if (type.endsWith('[]')) {
+            const inner = type.slice(0, -2)
+            w.varuint32(value.length)
+            value.forEach(v => this.write(w, inner, v))
+        } else if (type.endsWith('?')) {
+            if (value === null || value === undefined) {
+                w.u8(0)
+            } else {
+                w.u8(1)
+                this.write(w, type.slice(0, -1), value)
+            }
+        } else if (BUILTIN[type]) {
+            BUILTIN[type](w, value)
+        } else if (this.structs[type]) {
+            const s = this.structs[type]
+            if (s.base) this.write(w, s.base, value)
+            for (const f of s.fields) {
+                if (!(f.name in value)) throw new Error(`missing field ${f.name} of ${type}`)
+                this.write(w, f.type, value[f.name])
+            }
+        } else {
+            throw new Error(`unknown abi type ${type}`)
+        }
+    }
+
+    serializeAction(action, data) {
+        const type = this.actions[action]
+        if (!type) throw new Error(`unknown action ${action}`)
+        const w = new Writer()
+        this.write(w, type, data)
+        return Buffer.from(w.bytes)
+    }
+}
+
+module.exports = {
+    Abi,
+    nameToBigInt,
+    bigIntToName
+}
@@ -0,0 +1,338 @@
+/*
+ * A tiny deterministic stand-in for nodeos, just enough to apply contract
+ * actions with stubbed host functions: an in-memory multi_index store,
+ * inline actions, require_recipient notifications and action data.
+ *
+ * Every applied action runs in a fresh instance of the instrumented module
+ * (like nodeos does), so the exported counters hold exactly that action's cost.
+ */
+
+const {instrument, EXTERNAL_KIND, VALTYPE} = require('./wasm')
+const {Abi, nameToBigInt, bigIntToName} = require('./abi')
+
+const PAGE_SIZE = 65536
+
+class ExitSignal extends Error {}
+
+class AssertError extends Error {}
+
+function isFloatIntrinsic(field) {
+    return /^__(add|sub|mul|div|neg|extend|trunc|fix|float|eq|ne|ge|gt|le|lt|unord|cmp)\w*[sdt]f\d?$/.test(field) ||
+           field.startsWith('_eosio_f')
+}
+
+class Contract {
+    constructor(account, wasmBytes, abiJson) {
+        const {bytes, counters, module} = instrument(wasmBytes)
+        this.account = account
+        this.module = new WebAssembly.Module(bytes)
+        this.counters = counters
+        this.names = module.names
+        this.imports = module.imports.filter(imp => imp.kind === EXTERNAL_KIND.func)
+        this.abi = new Abi(abiJson)
+    }
+}
+
+class Chain {
+    constructor() {
+        this.contracts = {}
+        this.accounts = new Set()
+        this.tables = new Map()   // "code:scope:table" -> Map(primary -> {data, payer})
+        this.now = 1546300800000000n  // 2019-01-01, advanced per top level action
+        this.console = []
+        this.onApply = null
+    }
+
+    createAccount(account) {
+        this.accounts.add(account)
+    }
+
+    deploy(account, wasmBytes, abiJson) {
+        this.accounts.add(account)
+        this.contracts[account] = new Contract(account, wasmBytes, abiJson)
+    }
+
+    /* push a top level action, reverting all table changes if it fails. */
+    pushAction({account, name, authorization, data}) {
+        const contract = this.contracts[account]
+        if (!contract) throw new Error(`no contract deployed on ${account}`)
+        const payload = Buffer.isBuffer(data) ? data : contract.abi.serializeAction(name, data)
+        const snapshot = this.snapshot()
+        this.now += 500000n
+        try {
+            this.execute({account, name, authorization: authorization || [], data: payload})
+        } catch (err) {
+            this.tables = snapshot
+            throw err
+        }
+    }
+
+    execute(action) {
+        const notified = [action.account]
+        const inline = []
+        this.applyOne(action.account, action, notified, inline)
+        for (let i = 1; i < notified.length; i++) {
+            this.applyOne(notified[i], action, notified, inline)
+        }
+        for (const next of inline) this.execute(next)
+    }
+
+    applyOne(receiver, action, notified, inline) {
+        const contract = this.contracts[receiver]
+        if (!contract) return
+
+        const ctx = {receiver, action, notified, inline, hostCalls: {}, memory: null}
+        const consoleStart = this.console.length
+        const instance = new WebAssembly.Instance(contract.module, {env: this.hostFunctions(contract, ctx)})
+        ctx.memory = instance.exports.memory
+
+        let error = null
+        try {
+            instance.exports.apply(nameToBigInt(receiver), nameToBigInt(action.account),
+                                   nameToBigInt(action.name))
+        } catch (err) {
+            if (!(err instanceof ExitSignal)) error = err
+        }
+
+        if (this.onApply) {
+            this.onApply({receiver, code: action.account, action: action.name,
+                          contract, instance, hostCalls: ctx.hostCalls,
+                          memoryPages: ctx.memory.buffer.byteLength / PAGE_SIZE,
+                          console: this.console.slice(consoleStart).join(''),
+                          failed: !!error})
+        }
+        if (error) throw error
+    }
+
+    snapshot() {
+        const copy = new Map()
+        for (const [key, rows] of this.tables) {
+            copy.set(key, new Map(Array.from(rows, ([k, v]) => [k, {data: Buffer.from(v.data), payer: v.payer}])))
+        }
+        return copy
+    }
+
+    /////////// host functions ///////////
+
+    hostFunctions(contract, ctx) {
+        const chain = this
+        const mem = () => new Uint8Array(ctx.memory.buffer)
+        const cstr = (ptr) => {
+            const m = mem()
+            let end = ptr
+            while (m[end]) end++
+            return Buffer.from(m.subarray(ptr, end)).toString('utf8')
+        }
+        const str = (ptr, len) => Buffer.from(mem().subarray(ptr, ptr + len)).toString('utf8')
+        const view = () => new DataView(ctx.memory.buffer)
+
+        /* iterators: index into ctx.iterators, end iterators are negative per table. */
+        const iterators = []
+        const endIterators = []
+        const tableKey = (code, scope, table) => `${BigInt.asUintN(64, code)}:${BigInt.asUintN(64, scope)}:${BigInt.asUintN(64, table)}`
+        const tableRows = (key, create) => {
+            if (!chain.tables.has(key) && create) chain.tables.set(key, new Map())
+            return chain.tables.get(key)
+        }
+        const endIterator = (key) => {
+            let idx = endIterators.indexOf(key)
+            if (idx < 0) idx = endIterators.push(key) - 1
+            return -(idx + 2)
+        }
+        const iteratorFor = (key, primary) => {
+            const idx = iterators.findIndex(it => it.key === key && it.primary === primary)
+            if (idx >= 0) return idx
+            return iterators.push({key, primary}) - 1
+        }
+        const sortedKeys = (rows) => Array.from(rows.keys()).sort((a, b) => (a < b ? -1 : a > b ? 1 : 0))
+        const rowAt = (itr) => {
+            const it = iterators[itr]
+            if (!it) throw new AssertError('invalid iterator')
+            return {it, rows: tableRows(it.key, false), row: tableRows(it.key, false).get(it.primary)}
+        }
+
+        const impl = {
+            /* action */
+            action_data_size: () => ctx.action.data.length,
+            read_action_data: (ptr, len) => {
+                if (!len) return ctx.action.data.length
+                const n = Math.min(len, ctx.action.data.length)
+                mem().set(ctx.action.data.subarray(0, n), ptr)
+                return n
+            },
+            current_receiver: () => nameToBigInt(ctx.receiver),
+            set_action_return_value: (ptr, len) => {
+                ctx.returnValue = Buffer.from(mem().subarray(ptr, ptr + len))
+            },
+
+            /* system */
+            eosio_assert: (cond, ptr) => { if (!cond) throw new AssertError(cstr(ptr)) },
+            eosio_assert_message: (cond, ptr, len) => { if (!cond) throw new AssertError(str(ptr, len)) },
+            eosio_assert_code: (cond, code) => { if (!cond) throw new AssertError(`assertion code ${code}`) },
+            eosio_exit: () => { throw new ExitSignal() },
+            abort: () => { throw new AssertError('abort() called') },
+            current_time: () => chain.now,
+            publication_time: () => chain.now,
+            tapos_block_num: () => Number((chain.now / 500000n) & 0xffffn),
+            tapos_block_prefix: () => 0,
+
+            /* auth */
+            require_auth: () => {},
+            require_auth2: () => {},
+            has_auth: () => 1,
+            is_account: (n) => (chain.accounts.has(bigIntToName(n)) ? 1 : 0),
+            require_recipient: (n) => {
+                const account = bigIntToName(n)
+                if (!ctx.notified.includes(account)) ctx.notified.push(account)
+            },
+
+            /* transactions */
+            send_inline: (ptr, len) => ctx.inline.push(unpackAction(Buffer.from(mem().subarray(ptr, ptr + len)))),
+            send_context_free_inline: (ptr, len) => ctx.inline.push(unpackAction(Buffer.from(mem().subarray(ptr, ptr + len)))),
+
+            /* memory */
+            memcpy: (dst, src, n) => { mem().copyWithin(dst, src, src + n); return dst },
+            memmove: (dst, src, n) => { mem().copyWithin(dst, src, src + n); return dst },
+            memset: (dst, v, n) => { mem().fill(v, dst, dst + n); return dst },
+            memcmp: (a, b, n) => {
+                const m = mem()
+                for (let i = 0; i < n; i++) {
+                    if (m[a + i] !== m[b + i]) return m[a + i] < m[b + i] ? -1 : 1
+                }
+                return 0
+            },
+
+            /* console */
+            prints: (ptr) => chain.console.push(cstr(ptr)),
+            prints_l: (ptr, len) => chain.console.push(str(ptr, len)),
+            printi: (v) => chain.console.push(String(v)),
+            printui: (v) => chain.console.push(String(BigInt.asUintN(64, v))),
+            printn: (v) => chain.console.push(bigIntToName(v)),
+            printdf: (v) => chain.console.push(String(v)),
+            printsf: (v) => chain.console.push(String(v)),
+
+            /* database */
+            db_store_i64: (scope, table, payer, id, ptr, len) => {
+                const key = tableKey(nameToBigInt(ctx.receiver), scope, table)
+                const rows = tableRows(key, true)
+                const primary = BigInt.asUintN(64, id)
+                if (rows.has(primary)) throw new AssertError('db_store_i64: duplicate primary key')
+                rows.set(primary, {data: Buffer.from(mem().subarray(ptr, ptr + len)), payer})
+                return iteratorFor(key, primary)
+            },
+            db_update_i64: (itr, payer, ptr, len) => {
+                const {row} = rowAt(itr)
+                row.data = Buffer.from(mem().subarray(ptr, ptr + len))
+                if (payer) row.payer = payer
+            },
+            db_remove_i64: (itr) => {
+                const {it, rows} = rowAt(itr)
+                rows.delete(it.primary)
+            },
+            db_get_i64: (itr, ptr, len) => {
+                const {row} = rowAt(itr)
+                if (!len) return row.data.length
+                const n = Math.min(len, row.data.length)
+                mem().set(row.data.subarray(0, n), ptr)
+                return n
+            },
+            db_next_i64: (itr, primaryPtr) => {
+                if (itr < 0) return -1
+                const {it, rows} = rowAt(itr)
+                const keys = sortedKeys(rows)
+                const next = keys[keys.indexOf(it.primary) + 1]
+                if (next === undefined) return endIterator(it.key)
+                view().setBigUint64(primaryPtr, next, true)
+                return iteratorFor(it.key, next)
+            },
+            db_previous_i64: (itr, primaryPtr) => {
+                let key, keys, pos
+                if (itr < 0) {
+                    key = endIterators[-itr - 2]
+                    if (key === undefined) return -1
+                    keys = sortedKeys(tableRows(key, false) || new Map())
+                    pos = keys.length
+                } else {
+                    const {it, rows} = rowAt(itr)
+                    key = it.key
+                    keys = sortedKeys(rows)
+                    pos = keys.indexOf(it.primary)
+                }
+                if (pos <= 0) return -1
+                view().setBigUint64(primaryPtr, keys[pos - 1], true)
+                return iteratorFor(key, keys[pos - 1])
+            },
+            db_find_i64: (code, scope, table, id) => {
+                const key = tableKey(code, scope, table)
+                const rows = tableRows(key, false)
+                if (!rows) return -1
+                const primary = BigInt.asUintN(64, id)
+                return rows.has(primary) ? iteratorFor(key, primary) : endIterator(key)
+            },
+            db_lowerbound_i64: (code, scope, table, id) => {
+                const key = tableKey(code, scope, table)
+                const rows = tableRows(key, false)
+                if (!rows) return -1
+                const primary = BigInt.asUintN(64, id)
+                const found = sortedKeys(rows).find(k => k >= primary)
+                return found === undefined ? endIterator(key) : iteratorFor(key, found)
+            },
+            db_upperbound_i64: (code, scope, table, id) => {
+                const key = tableKey(code, scope, table)
+                const rows = tableRows(key, false)
+                if (!rows) return -1
+                const primary = BigInt.asUintN(64, id)
+                const found = sortedKeys(rows).find(k => k > primary)
+                return found === undefined ? endIterator(key) : iteratorFor(key, found)
+            },
+            db_end_i64: (code, scope, table) => {
+                const key = tableKey(code, scope, table)
+                return tableRows(key, false) ? endIterator(key) : -1
+            }
+        }
+
+        /* wrap every import so it is counted, unknown ones become no-op stubs returning 0. */
+        const env = {}
+        for (const imp of contract.imports) {
+            const field = imp.field
+            const fn = impl[field]
+            const result = imp.type.results[0]
+            const fallback = (result === VALTYPE.i64) ? 0n : (result === undefined ? undefined : 0)
+            env[field] = (...args) => {
+                ctx.hostCalls[field] = (ctx.hostCalls[field] || 0) + 1
+                if (fn) return fn(...args)
+                return fallback
+            }
+        }
+        return env
+    }
+}
+
+function unpackAction(buf) {
+    let pos = 0
+    const u64 = () => { const v = buf.readBigUInt64LE(pos); pos += 8; return v }
+    const varuint32 = () => {
+        let result = 0, shift = 0, byte
+        do {
+            byte = buf[pos++]
+            result |= (byte & 0x7f) << shift
+            shift += 7
+        } while (byte & 0x80)
+        return result >>> 0
+    }
+    const account = bigIntToName(u64())
+    const name = bigIntToName(u64())
+    const authorization = []
+    for (let n = varuint32(); n > 0; n--) {
+        authorization.push({actor: bigIntToName(u64()), permission: bigIntToName(u64())})
+    }
+    const len = varuint32()
+    const data = buf.subarray(pos, pos + len)
+    return {account, name, authorization, data: Buffer.from(data)}
+}
+
+module.exports = {
+    Chain,
+    AssertError,
+    isFloatIntrinsic
+}
@@ -0,0 +1,192 @@
+/*
+ * Deterministic per-action cost profile of the compiled contracts.
+ *
+ * Billed CPU on nodeos depends on machine load, so instead of timing we apply
+ * each action of a scenario on an in-memory chain (see chain.js) with
+ * instrumented wasm, and count:
+ *   - executed wasm instructions, per function (top functions are reported),
+ *   - float opcodes (nodeos replaces them with softfloat calls),
+ *   - calls to softfloat / compiler-rt float intrinsics,
+ *   - database and other host function calls,
+ *   - linear memory pages at the end of the action,
+ *   - heap allocations and peak live heap bytes, when the contracts are
+ *     compiled with HEAP_STATS=1 scripts/compile.sh (see Common/heapstats.hpp).
+ *
+ * Usage:
+ *   node scripts/profiler/profile.js [scenario.json] [--out profile.json] [--top N]
+ *   node scripts/profiler/profile.js --diff before.json after.json
+ *
+ * The default scenario (scenarios/trade.json) deploys Token, Network and
+ * AmmReserve from their compiled wasm/abi (run scripts/compile.sh first) and
+ * profiles buy/sell trades and a getexprate query.
+ */
+
+const fs = require('fs')
+const path = require('path')
+const {Chain, isFloatIntrinsic} = require('./chain')
+
+const ROOT = path.join(__dirname, '../..')
+const DEFAULT_SCENARIO = path.join(__dirname, 'scenarios/trade.json')
+const DEFAULT_TOP = 10
+const HEAP_REPORT = /heap allocs=(\d+) peak=(\d+)/
+
+function actionKey({receiver, code, action}) {
+    return (receiver === code) ? `${code}::${action}` : `${code}::${action}@${receiver}`
+}
+
+function newEntry() {
+    return {executions: 0, instructions: 0, float_ops: 0, float_intrinsics: 0, db_calls: 0,
+            host_calls: {}, memory_pages: 0, heap_allocs: 0, heap_peak: 0, functions: {}}
+}
+
+function record(profile, event) {
+    const key = actionKey(event)
+    const entry = profile[key] || (profile[key] = newEntry())
+    const {contract, instance} = event
+    entry.executions++
+    entry.memory_pages = Math.max(entry.memory_pages, event.memoryPages)
+
+    const heap = HEAP_REPORT.exec(event.console)
+    if (heap) {
+        entry.heap_allocs += Number(heap[1])
+        entry.heap_peak = Math.max(entry.heap_peak, Number(heap[2]))
+    }
+
+    for (const funcIndex of Object.keys(contract.counters.instr)) {
+        const instr = Number(instance.exports[contract.counters.instr[funcIndex]].value)
+        if (!instr) continue
+        const float = Number(instance.exports[contract.counters.float[funcIndex]].value)
+        const calls = Number(instance.exports[contract.counters.calls[funcIndex]].value)
+        const fname = contract.names[funcIndex] || `func[${funcIndex}]`
+        const f = entry.functions[fname] || (entry.functions[fname] = {instructions: 0, float_ops: 0, calls: 0})
+        f.instructions += instr
+        f.float_ops += float
+        f.calls += calls
+        entry.instructions += instr
+        entry.float_ops += float
+    }
+
+    for (const [field, count] of Object.entries(event.hostCalls)) {
+        entry.host_calls[field] = (entry.host_calls[field] || 0) + count
+        if (field.startsWith('db_')) entry.db_calls += count
+        if (isFloatIntrinsic(field)) entry.float_intrinsics += count
+    }
+}
+
+function finalize(profile, top) {
+    const result = {}
+    for (const key of Object.keys(profile).sort()) {
+        const entry = profile[key]
+        const n = entry.executions
+        const functions = Object.entries(entry.functions)
+            .sort((a, b) => b[1].instructions - a[1].instructions)
+            .slice(0, top)
+            .map(([name, f]) => ({name, instructions: f.instructions / n,
+                                  float_ops: f.float_ops / n, calls: f.calls / n}))
+        const hostCalls = {}
+        for (const field of Object.keys(entry.host_calls).sort()) hostCalls[field] = entry.host_calls[field] / n
+        result[key] = {
+            executions: n,
+            instructions: entry.instructions / n,
+            float_ops: entry.float_ops / n,
+            float_intrinsics: entry.float_intrinsics / n,
+            db_calls: entry.db_calls / n,
+            memory_pages: entry.memory_pages,
+            heap_allocs: entry.heap_allocs / n,
+            heap_peak: entry.heap_peak,
+            host_calls: hostCalls,
+            top_functions: functions
+        }
+    }
+    return result
+}
+
+function loadContract(chain, account, basePath) {
+    const base = path.isAbsolute(basePath) ? basePath : path.join(ROOT, basePath)
+    chain.deploy(account, fs.readFileSync(`${base}.wasm`), JSON.parse(fs.readFileSync(`${base}.abi`)))
+}
+
+function run(scenarioPath, top) {
+    const scenario = JSON.parse(fs.readFileSync(scenarioPath))
+    const chain = new Chain()
+    for (const account of scenario.users || []) chain.createAccount(account)
+    for (const [account, basePath] of Object.entries(scenario.contracts)) {
+        loadContract(chain, account, basePath)
+    }
+
+    const profiled = scenario.steps.some(step => step.profile)
+    const profile = {}
+    const failures = []
+    let recording = false
+    chain.onApply = (event) => { if (recording) record(profile, event) }
+
+    for (const step of scenario.steps) {
+        recording = !profiled || !!step.profile
+        try {
+            chain.pushAction({account: step.account, name: step.name,
+                              authorization: [{actor: step.auth || step.account, permission: 'active'}],
+                              data: step.data})
+        } catch (err) {
+            if (!step.expect_failure) failures.push({step: `${step.account}::${step.name}`, error: err.message})
+        }
+    }
+    return {scenario: path.relative(ROOT, scenarioPath), failures, actions: finalize(profile, top)}
+}
+
+/////////// diff ///////////
+
+function pct(before, after) {
+    if (!before) return after ? '   new' : '     -'
+    const d = ((after - before) * 100.0) / before
+    return `${d >= 0 ? '+' : ''}${d.toFixed(1)}%`.padStart(7)
+}
+
+function diff(beforePath, afterPath) {
+    const before = JSON.parse(fs.readFileSync(beforePath)).actions
+    const after = JSON.parse(fs.readFileSync(afterPath)).actions
+    const keys = Array.from(new Set(Object.keys(before).concat(Object.keys(after)))).sort()
+    const metrics = ['instructions', 'float_ops', 'float_intrinsics', 'db_calls', 'memory_pages',
+                     'heap_allocs', 'heap_peak']
+
+    const lines = [['action'].concat(metrics).join('  ')]
+    for (const key of keys) {
+        const b = before[key] || {}
+        const a = after[key] || {}
+        const cells = metrics.map(m => `${a[m] || 0} (${pct(b[m] || 0, a[m] || 0)})`)
+        lines.push([key].concat(cells).join('  '))
+    }
+    return lines.join('\n')
+}
+
+function main(argv) {
+    if (argv[0] === '--diff') {
+        console.log(diff(argv[1], argv[2]))
+        return
+    }
+
+    let scenarioPath = DEFAULT_SCENARIO
+    let out = null
+    let top = DEFAULT_TOP
+    for (let i = 0; i < argv.length; i++) {
+        if (argv[i] === '--out') out = argv[++i]
+        else if (argv[i] === '--top') top = parseInt(argv[++i])
+        else scenarioPath = argv[i]
+    }
+
+    const result = run(path.resolve(scenarioPath), top)
+    const json = JSON.stringify(result, null, 4)
+    if (out) fs.writeFileSync(out, json)
+    else console.log(json)
+
+    if (result.failures.length) {
+        console.error(`${result.failures.length} scenario step(s) failed:`)
+        result.failures.forEach(f => console.error(`  ${f.step}: ${f.error}`))
+        process.exitCode = 1
+    }
+}
+
+if (require.main === module) {
+    main(process.argv.slice(2))
+}
+
+module.exports = {run, diff}
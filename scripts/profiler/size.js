@@ -0,0 +1,140 @@
+/*
+ * Code size report of the compiled contracts.
+ *
+ * setcode bills RAM for the whole module, and nodeos compiles/instantiates it
+ * on every cache miss, so this reports per contract:
+ *   - total wasm bytes,
+ *   - bytes per section (code, data, ...),
+ *   - number of defined functions and the largest function bodies.
+ *
+ * Usage:
+ *   node scripts/profiler/size.js [contract.wasm ...] [--out size.json] [--top N]
+ *   node scripts/profiler/size.js --diff before.json after.json
+ *
+ * Without arguments the wasm of all four contracts is read (run scripts/compile.sh first).
+ */
+
+const fs = require('fs')
+const path = require('path')
+const {parseModule} = require('./wasm')
+
+const ROOT = path.join(__dirname, '../..')
+const DEFAULT_CONTRACTS = [
+    'contracts/Network/Network.wasm',
+    'contracts/Reserve/AmmReserve/AmmReserve.wasm',
+    'contracts/Listener/Listener.wasm',
+    'contracts/Mock/Token/Token.wasm'
+]
+const DEFAULT_TOP = 10
+const SECTION_NAMES = ['custom', 'type', 'import', 'func', 'table', 'memory', 'global',
+                       'export', 'start', 'elem', 'code', 'data', 'datacount']
+const CODE_SECTION = 10
+
+function readU32(bytes, pos) {
+    let value = 0
+    let shift = 0
+    for (;;) {
+        const b = bytes[pos++]
+        value += (b & 0x7f) * Math.pow(2, shift)
+        if (!(b & 0x80)) return {value, pos}
+        shift += 7
+    }
+}
+
+function functionSizes(mod) {
+    const code = mod.sections.find(s => s.id === CODE_SECTION)
+    if (!code) return []
+    let {value: count, pos} = readU32(mod.bytes, code.start)
+    const sizes = []
+    for (let i = 0; i < count; i++) {
+        const body = readU32(mod.bytes, pos)
+        const index = mod.numImportedFuncs + i
+        sizes.push({name: mod.names[index] || `func[${index}]`, bytes: body.value})
+        pos = body.pos + body.value
+    }
+    return sizes
+}
+
+function report(wasmPath, top) {
+    const bytes = fs.readFileSync(wasmPath)
+    const mod = parseModule(bytes)
+
+    const sections = {}
+    for (const s of mod.sections) {
+        const name = SECTION_NAMES[s.id] || `section[${s.id}]`
+        sections[name] = (sections[name] || 0) + (s.end - s.start)
+    }
+    const functions = functionSizes(mod).sort((a, b) => b.bytes - a.bytes)
+    return {
+        bytes: bytes.length,
+        sections,
+        functions: functions.length,
+        imports: mod.numImportedFuncs,
+        top_functions: functions.slice(0, top)
+    }
+}
+
+function run(paths, top) {
+    const result = {}
+    for (const p of paths) {
+        const wasmPath = path.isAbsolute(p) ? p : path.join(ROOT, p)
+        result[path.basename(wasmPath, '.wasm')] = report(wasmPath, top)
+    }
+    return {contracts: result}
+}
+
+/////////// diff ///////////
+
+function pct(before, after) {
+    if (!before) return after ? '   new' : '     -'
+    const d = ((after - before) * 100.0) / before
+    return `${d >= 0 ? '+' : ''}${d.toFixed(1)}%`.padStart(7)
+}
+
+function diff(beforePath, afterPath) {
+    const before = JSON.parse(fs.readFileSync(beforePath)).contracts
+    const after = JSON.parse(fs.readFileSync(afterPath)).contracts
+    const keys = Array.from(new Set(Object.keys(before).concat(Object.keys(after)))).sort()
+    const metrics = [['bytes', c => c.bytes], ['code', c => c.sections.code || 0],
+                     ['data', c => c.sections.data || 0], ['functions', c => c.functions]]
+
+    const lines = [['contract'].concat(metrics.map(m => m[0])).join('  ')]
+    for (const key of keys) {
+        const b = before[key]
+        const a = after[key]
+        const cells = metrics.map(([, get]) => {
+            const bv = b ? get(b) : 0
+            const av = a ? get(a) : 0
+            return `${av} (${pct(bv, av)})`
+        })
+        lines.push([key].concat(cells).join('  '))
+    }
+    return lines.join('\n')
+}
+
+function main(argv) {
+    if (argv[0] === '--diff') {
+        console.log(diff(argv[1], argv[2]))
+        return
+    }
+
+    const paths = []
+    let out = null
+    let top = DEFAULT_TOP
+    for (let i = 0; i < argv.length; i++) {
+        if (argv[i] === '--out') out = argv[++i]
+        else if (argv[i] === '--top') top = parseInt(argv[++i])
+        else paths.push(argv[i])
+    }
+
+    const result = run(paths.length ? paths : DEFAULT_CONTRACTS, top)
+    const json = JSON.stringify(result, null, 4)
+    if (out) fs.writeFileSync(out, json)
+    else console.log(json)
+}
+
+if (require.main === module) {
+    main(process.argv.slice(2))
+}
+
+module.exports = {run, diff}
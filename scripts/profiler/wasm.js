@@ -0,0 +1,411 @@
+/*
+ * Minimal wasm binary reader/writer used by the profiler.
+ *
+ * instrument() rewrites every defined function so that each straight-line
+ * segment of code adds its static instruction count (and the number of float
+ * opcodes in it) to per-function mutable i64 globals, and counts function
+ * entries. The globals are exported as __prof_<kind>_<function index> so
+ * the host can read them back after an action was applied.
+ */
+
+const SECTION = {custom: 0, type: 1, import: 2, func: 3, table: 4, memory: 5, global: 6,
+                 export: 7, start: 8, elem: 9, code: 10, data: 11, datacount: 12}
+
+const EXTERNAL_KIND = {func: 0, table: 1, memory: 2, global: 3}
+
+/* sections that must come after the global / export sections when (re)inserting them. */
+const AFTER_GLOBAL = [SECTION.export, SECTION.start, SECTION.elem, SECTION.datacount,
+                      SECTION.code, SECTION.data]
+const AFTER_EXPORT = [SECTION.start, SECTION.elem, SECTION.datacount, SECTION.code, SECTION.data]
+
+const VALTYPE = {i32: 0x7f, i64: 0x7e, f32: 0x7d, f64: 0x7c}
+
+const COUNTER_KINDS = ['instr', 'float', 'calls']
+
+/////////// leb128 ///////////
+
+class Reader {
+    constructor(bytes, pos = 0, end = bytes.length) {
+        this.bytes = bytes
+        this.pos = pos
+        this.end = end
+    }
+
+    eof() { return this.pos >= this.end }
+
+    u8() {
+        if (this.pos >= this.end) throw new Error('unexpected end of wasm')
+        return this.bytes[this.pos++]
+    }
+
+    u32() {
+        let result = 0, shift = 0, byte
+        do {
+            byte = this.u8()
+            result += (byte & 0x7f) * Math.pow(2, shift)
+            shift += 7
+        } while (byte & 0x80)
+        return result
+    }
+
+    /* signed values are only skipped by the instrumenter, never interpreted. */
+    skipLeb() {
+        while (this.u8() & 0x80) {}
+    }
+
+    skip(n) {
+        this.pos += n
+        if (this.pos > this.end) throw new Error('unexpected end of wasm')
+    }
+
+    slice(n) {
+        const res = this.bytes.subarray(this.pos, this.pos + n)
+        this.skip(n)
+        return res
+    }
+
+    string() {
+        const len = this.u32()
+        return Buffer.from(this.slice(len)).toString('utf8')
+    }
+}
+
+function encodeU32(value) {
+    const out = []
+    do {
+        let byte = value & 0x7f
+        value = Math.floor(value / 128)
+        if (value !== 0) byte |= 0x80
+        out.push(byte)
+    } while (value !== 0)
+    return out
+}
+
+function encodeS64(value) {
+    let v = BigInt(value)
+    const out = []
+    for (;;) {
+        let byte = Number(v & 0x7fn)
+        v >>= 7n
+        const signBit = byte & 0x40
+        if ((v === 0n && !signBit) || (v === -1n && signBit)) {
+            out.push(byte)
+            return out
+        }
+        out.push(byte | 0x80)
+    }
+}
+
+function encodeString(str) {
+    const bytes = Buffer.from(str, 'utf8')
+    return encodeU32(bytes.length).concat(Array.from(bytes))
+}
+
+function section(id, payload) {
+    return Buffer.concat([Buffer.from([id].concat(encodeU32(payload.length))), Buffer.from(payload)])
+}
+
+/////////// module structure ///////////
+
+function parseModule(bytes) {
+    bytes = new Uint8Array(bytes)
+    if (bytes[0] !== 0x00 || bytes[1] !== 0x61 || bytes[2] !== 0x73 || bytes[3] !== 0x6d) {
+        throw new Error('not a wasm module')
+    }
+    const r = new Reader(bytes, 8)
+    const sections = []
+    while (!r.eof()) {
+        const id = r.u8()
+        const size = r.u32()
+        const start = r.pos
+        sections.push({id, start, end: start + size, payload: bytes.subarray(start, start + size)})
+        r.skip(size)
+    }
+
+    const mod = {bytes, sections, types: [], imports: [], numImportedFuncs: 0, numImportedGlobals: 0,
+                 numDefinedFuncs: 0, numDefinedGlobals: 0, exports: [], names: {}}
+
+    for (const s of sections) {
+        const sr = new Reader(bytes, s.start, s.end)
+        if (s.id === SECTION.type) {
+            const count = sr.u32()
+            for (let i = 0; i < count; i++) {
+                sr.u8() // func
+                const params = Array.from(sr.slice(sr.u32()))
+                const results = Array.from(sr.slice(sr.u32()))
+                mod.types.push({params, results})
+            }
+        } else if (s.id === SECTION.import) {
+            const count = sr.u32()
+            for (let i = 0; i < count; i++) {
+                const module = sr.string()
+                const field = sr.string()
+                const kind = sr.u8()
+                if (kind === EXTERNAL_KIND.func) {
+                    const type = mod.types[sr.u32()]
+                    mod.imports.push({module, field, kind, type, index: mod.numImportedFuncs++})
+                } else if (kind === EXTERNAL_KIND.table) {
+                    sr.u8()
+                    skipLimits(sr)
+                    mod.imports.push({module, field, kind})
+                } else if (kind === EXTERNAL_KIND.memory) {
+                    skipLimits(sr)
+                    mod.imports.push({module, field, kind})
+                } else if (kind === EXTERNAL_KIND.global) {
+                    sr.u8(); sr.u8()
+                    mod.imports.push({module, field, kind, index: mod.numImportedGlobals++})
+                }
+            }
+        } else if (s.id === SECTION.func) {
+            mod.numDefinedFuncs = sr.u32()
+        } else if (s.id === SECTION.global) {
+            mod.numDefinedGlobals = sr.u32()
+        } else if (s.id === SECTION.export) {
+            const count = sr.u32()
+            for (let i = 0; i < count; i++) {
+                const field = sr.string()
+                const kind = sr.u8()
+                const index = sr.u32()
+                mod.exports.push({field, kind, index})
+            }
+        } else if (s.id === SECTION.custom) {
+            const name = sr.string()
+            if (name === 'name') parseNameSection(sr, mod.names)
+        }
+    }
+
+    for (const imp of mod.imports) {
+        if (imp.kind === EXTERNAL_KIND.func) mod.names[imp.index] = imp.field
+    }
+    for (const exp of mod.exports) {
+        if (exp.kind === EXTERNAL_KIND.func && !mod.names[exp.index]) mod.names[exp.index] = exp.field
+    }
+    return mod
+}
+
+function skipLimits(r) {
+    const flags = r.u8()
+    r.u32()
+    if (flags & 1) r.u32()
+}
+
+function parseNameSection(r, names) {
+    while (!r.eof()) {
+        const id = r.u8()
+        const size = r.u32()
+        const end = r.pos + size
+        if (id === 1) {
+            const count = r.u32()
+            for (let i = 0; i < count; i++) {
+                const index = r.u32()
+                names[index] = r.string()
+            }
+        }
+        r.pos = end
+    }
+}
+
+/////////// instruction decoding ///////////
+
+/* f32/f64 comparisons, arithmetic and conversions, i.e. what nodeos replaces with softfloat calls. */
+function isFloatOp(op) {
+    return (op >= 0x5b && op <= 0x66) ||
+           (op >= 0x8b && op <= 0xa6) ||
+           (op >= 0xa8 && op <= 0xab) ||
+           (op >= 0xae && op <= 0xbb)
+}
+
+/* instructions after which a new counted segment starts. */
+function endsSegment(op) {
+    return op === 0x02 || op === 0x03 || op === 0x04 || op === 0x05 || op === 0x0b ||
+           op === 0x0c || op === 0x0d || op === 0x0e || op === 0x0f || op === 0x10 ||
+           op === 0x11 || op === 0x00
+}
+
+/* read one instruction, skipping its immediates. returns {op, float}. */
+function readInstruction(r) {
+    const op = r.u8()
+    let float = isFloatOp(op)
+    switch (op) {
+        case 0x02: case 0x03: case 0x04:
+            r.skipLeb() // block type
+            break
+        case 0x0c: case 0x0d:
+        case 0x10:
+        case 0x20: case 0x21: case 0x22: case 0x23: case 0x24:
+        case 0x25: case 0x26:
+        case 0xd2:
+            r.u32()
+            break
+        case 0x0e: {
+            const count = r.u32()
+            for (let i = 0; i <= count; i++) r.u32()
+            break
+        }
+        case 0x11:
+            r.u32(); r.u32()
+            break
+        case 0x1c: {
+            const count = r.u32()
+            r.skip(count)
+            break
+        }
+        case 0x3f: case 0x40:
+        case 0xd0:
+            r.u8()
+            break
+        case 0x41: case 0x42:
+            r.skipLeb()
+            break
+        case 0x43:
+            r.skip(4)
+            break
+        case 0x44:
+            r.skip(8)
+            break
+        case 0xfc: {
+            const sub = r.u32()
+            if (sub <= 7) float = true // saturating float truncations
+            else if (sub === 8) { r.u32(); r.u8() }
+            else if (sub === 9 || sub === 13 || sub === 15 || sub === 16 || sub === 17) r.u32()
+            else if (sub === 10) { r.u8(); r.u8() }
+            else if (sub === 11) r.u8()
+            else if (sub === 12 || sub === 14) { r.u32(); r.u32() }
+            else throw new Error(`unsupported 0xfc opcode ${sub}`)
+            break
+        }
+        default:
+            if (op >= 0x28 && op <= 0x3e) { r.u32(); r.u32() } // memarg
+            else if (op > 0xc4 && op !== 0xd1) throw new Error(`unsupported opcode 0x${op.toString(16)}`)
+    }
+    return {op, float}
+}
+
+function counterIncrement(globalIndex, amount) {
+    return [0x23].concat(encodeU32(globalIndex),
+                         [0x42], encodeS64(amount),
+                         [0x7c], // i64.add
+                         [0x24], encodeU32(globalIndex))
+}
+
+function instrumentBody(bytes, start, end, globals) {
+    const r = new Reader(bytes, start, end)
+    const localsStart = r.pos
+    const localGroups = r.u32()
+    for (let i = 0; i < localGroups; i++) { r.u32(); r.u8() }
+    const out = Array.from(bytes.subarray(localsStart, r.pos))
+
+    out.push(...counterIncrement(globals.calls, 1))
+
+    /* collect segments first, so the increment can be placed at the segment start. */
+    let segment = []
+    let instrCount = 0
+    let floatCount = 0
+    const flush = () => {
+        if (instrCount) out.push(...counterIncrement(globals.instr, instrCount))
+        if (floatCount) out.push(...counterIncrement(globals.float, floatCount))
+        out.push(...segment)
+        segment = []
+        instrCount = 0
+        floatCount = 0
+    }
+
+    while (!r.eof()) {
+        const before = r.pos
+        const {op, float} = readInstruction(r)
+        for (let i = before; i < r.pos; i++) segment.push(bytes[i])
+        instrCount++
+        if (float) floatCount++
+        if (endsSegment(op)) flush()
+    }
+    flush()
+    return out
+}
+
+/*
+ * Returns {bytes, counters} where counters[kind][funcIndex] is the export
+ * name of the corresponding counter global.
+ */
+function instrument(input) {
+    const mod = parseModule(input)
+    const bytes = mod.bytes
+    const firstCounter = mod.numImportedGlobals + mod.numDefinedGlobals
+    const counters = {instr: {}, float: {}, calls: {}}
+
+    const newGlobals = []
+    const newExports = []
+    const globalFor = {}
+    for (let i = 0; i < mod.numDefinedFuncs; i++) {
+        const funcIndex = mod.numImportedFuncs + i
+        globalFor[funcIndex] = {}
+        COUNTER_KINDS.forEach((kind, k) => {
+            const globalIndex = firstCounter + i * COUNTER_KINDS.length + k
+            globalFor[funcIndex][kind] = globalIndex
+            newGlobals.push(0x7e, 0x01, 0x42, 0x00, 0x0b) // mut i64 = 0
+            const exportName = `__prof_${kind}_${funcIndex}`
+            newExports.push(...encodeString(exportName), EXTERNAL_KIND.global, ...encodeU32(globalIndex))
+            counters[kind][funcIndex] = exportName
+        })
+    }
+    const numNew = mod.numDefinedFuncs * COUNTER_KINDS.length
+
+    const out = [Buffer.from(bytes.subarray(0, 8))]
+    let wroteGlobal = false
+    let wroteExport = false
+    const writeGlobal = (existing) => {
+        let count = 0, rest = []
+        if (existing) {
+            const r = new Reader(bytes, existing.start, existing.end)
+            count = r.u32()
+            rest = Array.from(bytes.subarray(r.pos, existing.end))
+        }
+        out.push(section(SECTION.global, encodeU32(count + numNew).concat(rest, newGlobals)))
+        wroteGlobal = true
+    }
+    const writeExport = (existing) => {
+        let count = 0, rest = []
+        if (existing) {
+            const r = new Reader(bytes, existing.start, existing.end)
+            count = r.u32()
+            rest = Array.from(bytes.subarray(r.pos, existing.end))
+        }
+        out.push(section(SECTION.export, encodeU32(count + numNew).concat(rest, newExports)))
+        wroteExport = true
+    }
+
+    for (const s of mod.sections) {
+        if (!wroteGlobal && AFTER_GLOBAL.includes(s.id)) writeGlobal(null)
+        if (!wroteExport && AFTER_EXPORT.includes(s.id)) writeExport(null)
+
+        if (s.id === SECTION.global) {
+            writeGlobal(s)
+        } else if (s.id === SECTION.export) {
+            writeExport(s)
+        } else if (s.id === SECTION.code) {
+            const r = new Reader(bytes, s.start, s.end)
+            const count = r.u32()
+            let payload = encodeU32(count)
+            for (let i = 0; i < count; i++) {
+                const size = r.u32()
+                const body = instrumentBody(bytes, r.pos, r.pos + size,
+                                            globalFor[mod.numImportedFuncs + i])
+                payload = payload.concat(encodeU32(body.length), body)
+                r.skip(size)
+            }
+            out.push(section(SECTION.code, payload))
+        } else {
+            out.push(section(s.id, s.payload))
+        }
+    }
+    if (!wroteGlobal) writeGlobal(null)
+    if (!wroteExport) writeExport(null)
+
+    return {bytes: Buffer.concat(out), counters, module: mod}
+}
+
+module.exports = {
+    parseModule,
+    instrument,
+    EXTERNAL_KIND,
+    VALTYPE
+}
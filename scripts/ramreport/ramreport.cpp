@@ -0,0 +1,202 @@
+/*
+ * RAM usage report of a contract, aggregated from the pages of its ramreport action.
+ *
+ * Lists the table scopes of the contract with "cleos get scope", pages through each one with
+ * the contract's ramreport action, and prints the rows and bytes per table, per payer and in
+ * total. The payer is the one of the table scope as get scope reports it, which is the payer of
+ * every row only for tables the contract pays for itself. Rows of owner paid tables (the network's
+ * tickets are billed to the account that opened them) are reported under "row owners" instead of
+ * being split per payer, the report can not see per row payers. Billed bytes add the chain's fixed overhead per row and per table scope
+ * to the serialized bytes, secondary index rows are not included.
+ *
+ * Every page is a transaction, authorized by and billed to actor.
+ *
+ * Usage:
+ *   ramreport --contract <account> --actor <account> [--url <nodeos url>] [--limit <rows per page>]
+ *             [--owner-paid <table>]...
+ *   ramreport --contract network --actor monitor --url http://127.0.0.1:8888
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "../shadow/json.hpp"
+
+using namespace shadow;
+
+#define ROW_OVERHEAD 108 /* bytes billed per row besides its data, billable size of key_value_object */
+#define SCOPE_OVERHEAD 108 /* bytes billed per table scope, billable size of table_id_object */
+#define DEFAULT_PAGE_ROWS 500
+#define SCOPES_PER_QUERY 1000
+#define OWNER_PAID_LABEL "row owners"
+
+struct totals {
+    uint64_t    scopes = 0;
+    uint64_t    rows = 0;
+    uint64_t    bytes = 0;
+
+    uint64_t billed() const { return bytes + rows * ROW_OVERHEAD + scopes * SCOPE_OVERHEAD; }
+};
+
+struct table_scope {
+    std::string table;
+    std::string scope;
+    std::string payer;
+    uint64_t    count;
+};
+
+static std::string quote(const std::string &arg) {
+    std::string res = "'";
+    for (char c : arg) {
+        if (c == '\'') res += "'\\''";
+        else res.push_back(c);
+    }
+    return res + "'";
+}
+
+/* stdout of command, empty if it failed. */
+static std::string run(const std::string &command) {
+    FILE *pipe = popen((command + " 2>/dev/null").c_str(), "r");
+    if (!pipe) return std::string();
+    std::string out;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), pipe)) > 0) out.append(chunk, n);
+    return (pclose(pipe) == 0) ? out : std::string();
+}
+
+/* value of an eosio name, scopes that are not names (such as symbols) come back as their raw value. */
+static uint64_t name_value(const std::string &str) {
+    auto char_value = [](char c) -> uint64_t {
+        if (c >= 'a' && c <= 'z') return (c - 'a') + 6;
+        if (c >= '1' && c <= '5') return (c - '1') + 1;
+        return 0;
+    };
+
+    uint64_t value = 0;
+    size_t n = std::min(str.size(), size_t(12));
+    for (size_t i = 0; i < n; i++) value |= (char_value(str[i]) & 0x1f) << (64 - 5 * (i + 1));
+    if (str.size() > 12) value |= char_value(str[12]) & 0x0f;
+    return value;
+}
+
+static bool list_scopes(const std::string &cleos, const std::string &contract, std::vector<table_scope> &res) {
+    std::string lower;
+    do {
+        std::string out = run(cleos + " get scope " + quote(contract) + " -l " + std::to_string(SCOPES_PER_QUERY) +
+                              (lower.empty() ? "" : " -L " + quote(lower)));
+        json reply;
+        if (out.empty() || !json_parser(out).parse(reply) || !reply.get("rows")) return false;
+
+        for (auto &row : reply.get("rows")->items) {
+            res.push_back({row.str("table"), row.str("scope"), row.str("payer"),
+                           std::strtoull(row.str("count").c_str(), nullptr, 10)});
+        }
+        lower = reply.str("more");
+    } while (!lower.empty());
+    return true;
+}
+
+/* one page of ramreport, returns false if the push failed or printed no report. */
+static bool report_page(const std::string &cleos,
+                        const std::string &contract,
+                        const std::string &actor,
+                        const table_scope &ts,
+                        uint64_t &cursor,
+                        uint32_t limit,
+                        totals &page,
+                        bool &done) {
+    std::string data = "[\"" + ts.table + "\", \"" + std::to_string(name_value(ts.scope)) + "\", \"" +
+                       std::to_string(cursor) + "\", " + std::to_string(limit) + "]";
+    std::string out = run(cleos + " push action " + quote(contract) + " ramreport " + quote(data) +
+                          " -p " + quote(actor + "@active") + " -j");
+    json reply;
+    if (out.empty() || !json_parser(out).parse(reply) || !reply.get("processed")) return false;
+    auto traces = reply.get("processed")->get("action_traces");
+    if (!traces || traces->items.empty()) return false;
+
+    std::string console = traces->items[0].str("console");
+    size_t pos = console.find("ramreport ");
+    if (pos == std::string::npos) return false;
+
+    unsigned long long rows, bytes;
+    char next[32];
+    if (sscanf(console.c_str() + pos, "ramreport rows=%llu bytes=%llu next=%31s", &rows, &bytes, next) != 3) return false;
+    page.rows = rows;
+    page.bytes = bytes;
+    done = (strcmp(next, "done") == 0);
+    if (!done) cursor = std::strtoull(next, nullptr, 10);
+    return true;
+}
+
+static void print_row(const std::string &label, const totals &t) {
+    printf("%-16s %8llu %10llu %12llu %12llu\n", label.c_str(), (unsigned long long)t.scopes,
+           (unsigned long long)t.rows, (unsigned long long)t.bytes, (unsigned long long)t.billed());
+}
+
+int main(int argc, char **argv) {
+    std::string contract, actor, url;
+    uint32_t limit = DEFAULT_PAGE_ROWS;
+    std::set<std::string> owner_paid = {"tickets"};
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--contract") contract = argv[i + 1];
+        else if (arg == "--actor") actor = argv[i + 1];
+        else if (arg == "--url") url = argv[i + 1];
+        else if (arg == "--limit") limit = std::strtoul(argv[i + 1], nullptr, 10);
+        else if (arg == "--owner-paid") owner_paid.insert(argv[i + 1]);
+    }
+    if (contract.empty() || actor.empty() || !limit) {
+        std::cerr << "usage: ramreport --contract <account> --actor <account> [--url <nodeos url>] "
+                     "[--limit <rows per page>] [--owner-paid <table>]..." << std::endl;
+        return 1;
+    }
+    std::string cleos = "cleos" + (url.empty() ? std::string() : " -u " + quote(url));
+
+    std::vector<table_scope> scopes;
+    if (!list_scopes(cleos, contract, scopes)) {
+        std::cerr << "can not list the table scopes of " << contract << std::endl;
+        return 1;
+    }
+
+    std::map<std::string, totals> by_table;
+    std::map<std::string, totals> by_payer;
+    totals all;
+    for (auto &ts : scopes) {
+        totals scope_totals;
+        scope_totals.scopes = 1;
+        uint64_t cursor = 0;
+        for (bool done = false; !done;) {
+            totals page;
+            if (!report_page(cleos, contract, actor, ts, cursor, limit, page, done)) {
+                std::cerr << "ramreport failed on " << ts.table << " scope " << ts.scope << std::endl;
+                return 1;
+            }
+            scope_totals.rows += page.rows;
+            scope_totals.bytes += page.bytes;
+        }
+        if (scope_totals.rows != ts.count) {
+            std::cerr << ts.table << " scope " << ts.scope << " changed during the report, " << ts.count
+                      << " rows listed, " << scope_totals.rows << " reported" << std::endl;
+        }
+
+        std::string payer = owner_paid.count(ts.table) ? OWNER_PAID_LABEL : ts.payer;
+        for (totals *t : {&by_table[ts.table], &by_payer[payer], &all}) {
+            t->scopes += scope_totals.scopes;
+            t->rows += scope_totals.rows;
+            t->bytes += scope_totals.bytes;
+        }
+    }
+
+    printf("%-16s %8s %10s %12s %12s\n", "table", "scopes", "rows", "bytes", "billed");
+    for (auto &t : by_table) print_row(t.first, t.second);
+    printf("\n%-16s %8s %10s %12s %12s\n", "payer", "scopes", "rows", "bytes", "billed");
+    for (auto &p : by_payer) print_row(p.first, p.second);
+    printf("\n");
+    print_row("total", all);
+    return 0;
+}
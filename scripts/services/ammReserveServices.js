@@ -1,5 +1,18 @@
+const {nameToBigInt} = require('../profiler/abi')
+
+const EOS_UNIT = 10000 /* 4 digits precision */
+const MAX_RATE = 1000000 /* up to 1M tokens per EOS */
+const STATE_TRADE_ENABLED = 0x01
+const CURVE_ENABLED = 0x01
+const SCHEMA_VERSION = 1
+const SCHEMA_VERSION_SHIFT = 4
+
 /////////// exported functions /////////// 
 
+/*
+ * Rate of the primary curve with e taken as the reserve account's eos balance, which is the reserve's
+ * eos only as long as it has no added curves and no internal balances. For quotes, see getCurveRate.
+ */
 module.exports.getRate = async function(options) {
     eos = options.eos
     reserveAccount = options.reserveAccount
@@ -13,15 +26,16 @@ module.exports.getRate = async function(options) {
     let currentParams = {
         r:              parseFloat(params["rows"][0]["r"]),
         pMin:           parseFloat(params["rows"][0]["p_min"]),
-        maxEosCapBuy:   parseFloat(params["rows"][0]["max_eos_cap_buy"].split(" ")[0]),
-        maxEosCapSell:  parseFloat(params["rows"][0]["max_eos_cap_buy"].split(" ")[0]),
+        maxEosCapBuy:   parseInt(params["rows"][0]["max_eos_cap_buy"]) / EOS_UNIT,
+        maxEosCapSell:  parseInt(params["rows"][0]["max_eos_cap_sell"]) / EOS_UNIT,
         profitPercent:  parseFloat(params["rows"][0]["profit_percent"]),
         ramFee:         parseFloat(params["rows"][0]["ram_fee"]),
-        maxBuyRate:     parseFloat(params["rows"][0]["max_buy_rate"]),
-        minBuyRate:     parseFloat(params["rows"][0]["min_buy_rate"]),
         maxSellRate:    parseFloat(params["rows"][0]["max_sell_rate"]),
         minSellRate:    parseFloat(params["rows"][0]["min_sell_rate"])
     }
+    /* buy rates are not stored, they are derived from the sell rates */
+    currentParams.maxBuyRate = 1.0 / currentParams.minSellRate
+    currentParams.minBuyRate = 1.0 / currentParams.maxSellRate
 
     let e = await getReserveEos(eos, reserveAccount, eosTokenAccount);
     let rate
@@ -58,8 +72,118 @@ module.exports.getRate = async function(options) {
     return rateAfterValidation(currentParams, rate, buy);
 }
 
+/*
+ * Rate of a trade on the curve of tokenSymbol ("4,SYS"), as getconvrate computes it on chain for a trade
+ * paid by transfer: params, inventory and spot rows of the curve's scope, with the reserve's internal
+ * balances in the network vault counted in the curve's holdings, and dest bounded by the inventory.
+ * Returns 0 wherever the reserve would not quote.
+ */
+module.exports.getCurveRate = async function(options) {
+    let eos = options.eos
+    let reserveAccount = options.reserveAccount
+    let tokenSymbol = options.tokenSymbol
+    let srcAmount = options.srcAmount
+    let buy = (options.srcSymbol == "EOS")
+
+    let state = await getRow(eos, reserveAccount, reserveAccount, "state")
+    if (!state || ((state.flags >> SCHEMA_VERSION_SHIFT) != SCHEMA_VERSION)) return 0
+    if (!(state.flags & STATE_TRADE_ENABLED)) return 0
+    if (!buy && options.srcSymbol != tokenSymbol.split(",")[1]) return 0
+
+    /* find_curve: the primary curve keeps its rows in the reserve's scope, added curves in the symbol's */
+    let primary = (tokenSymbol == state.token_symbol)
+    let scope = reserveAccount
+    if (!primary) {
+        scope = symbolRaw(tokenSymbol)
+        let curve = await getRow(eos, reserveAccount, reserveAccount, "curves", scope)
+        if (!curve || curve.token_symbol != tokenSymbol || !(curve.flags & CURVE_ENABLED)) return 0
+    }
+
+    let params = await getRow(eos, reserveAccount, scope, "params")
+    let inventory = await getRow(eos, reserveAccount, scope, "inventory")
+    if (!params || !inventory) return 0
+    let currentParams = {
+        r:              parseFloat(params.r),
+        pMin:           parseFloat(params.p_min),
+        maxEosCapBuy:   parseInt(params.max_eos_cap_buy) / EOS_UNIT,
+        maxEosCapSell:  parseInt(params.max_eos_cap_sell) / EOS_UNIT,
+        profitPercent:  parseFloat(params.profit_percent),
+        ramFee:         parseFloat(params.ram_fee),
+        maxSellRate:    parseFloat(params.max_sell_rate),
+        minSellRate:    parseFloat(params.min_sell_rate)
+    }
+    currentParams.maxBuyRate = 1.0 / currentParams.minSellRate
+    currentParams.minBuyRate = 1.0 / currentParams.maxSellRate
+
+    /* get_holdings, the eos internal balance is of the primary curve */
+    let eosAmount = parseInt(inventory.eos)
+    if (inventory.vault && primary) {
+        eosAmount += await getVaultAmount(eos, state.network_contract, "4,EOS", reserveAccount, state.eos_contract)
+    }
+
+    /* get_spot */
+    let spot = await getRow(eos, reserveAccount, scope, "spot")
+    let p = (spot && parseInt(spot.eos) == eosAmount) ? parseFloat(spot.p) :
+            pOfE(currentParams.r, currentParams.pMin, eosAmount / EOS_UNIT)
+
+    let destPrecision = buy ? parseInt(tokenSymbol.split(",")[0]) : 4
+    let destBalance = (buy ? parseInt(inventory.token) : parseInt(inventory.eos)) / Math.pow(10, destPrecision)
+    return curveRate(currentParams, p, buy, srcAmount, destBalance)
+}
+
 /////////// internal function /////////// 
 
+/* liquidity_get_rate and the checks of reserve_get_conv_rate, at spot price p */
+function curveRate(currentParams, p, buy, srcAmount, destBalance) {
+    let rate, destAmount = 0
+    if (!srcAmount) {
+        rate = ((100.0 - currentParams.profitPercent) * (buy ? (1 / p) : p)) / 100.0
+    } else {
+        if (buy) {
+            let chargedFee = (currentParams.profitPercent * srcAmount) / 100.0
+            if (currentParams.ramFee >= (srcAmount - chargedFee)) return 0
+            chargedFee += currentParams.ramFee
+            destAmount = (-1.0) * (Math.exp((-currentParams.r) * (srcAmount - chargedFee)) - 1.0) / (currentParams.r * p)
+        } else {
+            let deltaE = Math.log(1.0 + currentParams.r * p * srcAmount) / currentParams.r
+            destAmount = deltaE - (currentParams.profitPercent * deltaE) / 100.0
+        }
+        rate = destAmount / srcAmount
+    }
+    if (!rate || !isFinite(rate)) return 0
+    rate = rateAfterValidation(currentParams, rate, buy)
+    if (!rate || rate > MAX_RATE) return 0
+
+    if (buy ? (srcAmount > currentParams.maxEosCapBuy) : (destAmount > currentParams.maxEosCapSell)) return 0
+    if (destAmount > destBalance) return 0
+    return rate
+}
+
+function symbolRaw(symbol) {
+    let [precision, code] = symbol.split(",")
+    let value = BigInt(0)
+    for (let i = code.length - 1; i >= 0; i--) {
+        value = (value << BigInt(8)) | BigInt(code.charCodeAt(i))
+    }
+    return ((value << BigInt(8)) | BigInt(parseInt(precision))).toString()
+}
+
+/* the row of a singleton, or the row keyed by lowerBound of a table, null if there is none */
+async function getRow(eos, code, scope, table, lowerBound) {
+    let options = {code: code, scope: scope, table: table, limit: 1, json: true}
+    if (lowerBound) options.lower_bound = lowerBound
+    let reply = await eos.getTableRows(options)
+    return reply.rows.length ? reply.rows[0] : null
+}
+
+/* the reserve's internal balance in the network vault, if it is of the expected contract */
+async function getVaultAmount(eos, networkAccount, symbol, reserveAccount, tokenContract) {
+    let row = await getRow(eos, networkAccount, symbolRaw(symbol), "vault",
+                         nameToBigInt(reserveAccount).toString())
+    if (!row || row.owner != reserveAccount || row.token_contract != tokenContract) return 0
+    return parseInt(row.balance.split(" ")[0].replace(".", ""))
+}
+
 function deltaTFunc(currentParams, e, deltaE) {
     return (-1.0) *
            (Math.exp((-currentParams.r) * deltaE) - 1.0) /
@@ -1,4 +1,10 @@
 const reserveServices = require('./ammReserveServices')
+const {nameToBigInt} = require('../profiler/abi')
+
+const COMPACT_MEMO_VERSION = 1
+const COMPACT_MEMO_HAS_CONTRACT = 0x01
+const COMPACT_MEMO_EXACT_OUTPUT = 0x02
+const BASE32_ALPHABET = 'abcdefghijklmnopqrstuvwxyz234567'
 
 module.exports.getBalances = async function(options){
     let eos = options.eos
@@ -29,7 +35,7 @@ module.exports.getEnabled = async function(options){
         table:"state",
         json: true
     })
-    return state.rows[0].is_enabled
+    return (state.rows[0].flags & 1) != 0
 }
 
 module.exports.getRate = async function(options) {
@@ -72,6 +78,75 @@ module.exports.getRate = async function(options) {
     return bestRate
 }
 
+/* trade and config sequence numbers of the change feed, 0 before the first trade or change. */
+module.exports.getFeedSeq = async function(options) {
+    let eos = options.eos
+    let networkAccount = options.networkAccount
+
+    let reply = await eos.getTableRows({code: networkAccount, scope: networkAccount, table: "feedseq", json: true})
+    if (!reply.rows.length) return {trade_seq: 0, config_seq: 0}
+    return {trade_seq: parseInt(reply.rows[0].trade_seq), config_seq: parseInt(reply.rows[0].config_seq)}
+}
+
+/* trades of the change feed after sequence seq, oldest first, up to limit. */
+module.exports.getTradesSince = async function(options) {
+    let eos = options.eos
+    let networkAccount = options.networkAccount
+    let seq = options.seq
+    let limit = options.limit || 100
+
+    let reply = await eos.getTableRows({
+        code: networkAccount,
+        scope: networkAccount,
+        table: "tradefeed",
+        lower_bound: (seq + 1).toString(),
+        limit: limit,
+        json: true
+    })
+    return reply.rows
+}
+
+/*
+ * Quotes of all listed pairs against all their reserves, computed off chain from the tables of the
+ * network and the reserves, so no transaction is pushed and no RAM is used. Per reserve there is a
+ * spot buy and a spot sell (0 src) and a buy of eosAmount, a rate of 0 means the reserve would not
+ * trade. Each pair is quoted on its own curve of the reserve, from the rows getconvrate reads, see
+ * ammReserveServices.getCurveRate.
+ */
+module.exports.getQuotes = async function(options) {
+    let eos = options.eos
+    let networkAccount = options.networkAccount
+    let eosAmount = options.eosAmount
+
+    let reservesReply = await eos.getTableRows({
+        code: networkAccount,
+        scope: networkAccount,
+        table: "reservespert",
+        limit: 1000,
+        json: true
+    })
+
+    let quotes = []
+    for (const row of reservesReply.rows) {
+        const tokenSymbol = row.symbol.split(",")[1]
+        for (const reserve of row.reserve_contracts) {
+            for (const [srcSymbol, destSymbol, srcAmount] of [["EOS", tokenSymbol, 0],
+                                                              [tokenSymbol, "EOS", 0],
+                                                              ["EOS", tokenSymbol, eosAmount]]) {
+                const rate = await reserveServices.getCurveRate({
+                    eos: eos,
+                    reserveAccount: reserve,
+                    tokenSymbol: row.symbol,
+                    srcSymbol: srcSymbol,
+                    srcAmount: srcAmount
+                })
+                quotes.push({reserve: reserve, srcSymbol: srcSymbol, destSymbol: destSymbol, srcAmount: srcAmount, rate: rate})
+            }
+        }
+    }
+    return quotes
+}
+
 module.exports.getRates = async function(options) {
     // TODO: missing slippageRate handling
 
@@ -118,6 +193,71 @@ module.exports.trade = async function(options) {
                          {authorization: [`${userAccount}@active`]});
 }
 
+/*
+ * Encode a trade memo in the compact format, see contracts/Network/compact_memo.hpp.
+ * destTokenAccount is optional, the network uses the contract the token is listed with if omitted.
+ * minConversionRate is a decimal string, exactDestAmount an optional integer amount in dest units.
+ */
+module.exports.encodeCompactMemo = function(options) {
+    const bytes = []
+    const varuint = (value) => {
+        value = BigInt(value)
+        do {
+            let b = Number(value & 0x7fn)
+            value >>= 7n
+            if (value) b |= 0x80
+            bytes.push(b)
+        } while (value)
+    }
+
+    let flags = 0
+    if (options.destTokenAccount) flags |= COMPACT_MEMO_HAS_CONTRACT
+    if (options.exactDestAmount) flags |= COMPACT_MEMO_EXACT_OUTPUT
+    bytes.push((COMPACT_MEMO_VERSION << 4) | flags)
+
+    let symbolRaw = BigInt(options.destPrecision)
+    for (let i = 0; i < options.destSymbol.length; i++) {
+        symbolRaw |= BigInt(options.destSymbol.charCodeAt(i)) << BigInt(8 * (i + 1))
+    }
+    varuint(symbolRaw)
+
+    if (options.destTokenAccount) {
+        let value = nameToBigInt(options.destTokenAccount)
+        for (let i = 0; i < 8; i++) {
+            bytes.push(Number(value & 0xffn))
+            value >>= 8n
+        }
+    }
+
+    /* rate as mantissa * 10^exponent, with trailing zeros moved to the exponent */
+    let [whole, fraction = ''] = options.minConversionRate.toString().split('.')
+    let digits = (whole + fraction).replace(/^0+(?=.)/, '')
+    let exponent = -fraction.length
+    while (digits.length > 1 && digits.endsWith('0')) {
+        digits = digits.slice(0, -1)
+        exponent++
+    }
+    varuint(digits)
+    bytes.push(exponent & 0xff)
+
+    if (options.exactDestAmount) varuint(options.exactDestAmount)
+
+    let memo = ''
+    let acc = 0
+    let bits = 0
+    for (const b of bytes) {
+        acc = (acc << 8) | b
+        bits += 8
+        while (bits >= 5) {
+            bits -= 5
+            memo += BASE32_ALPHABET[(acc >> bits) & 0x1f]
+        }
+        acc &= (1 << bits) - 1
+    }
+    if (bits) memo += BASE32_ALPHABET[(acc << (5 - bits)) & 0x1f]
+    return memo
+}
+
 module.exports.getUserBalance = async function(options){
     let eos = options.eos
     let account = options.account
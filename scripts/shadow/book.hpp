@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+/*
+ * In-memory mirror of the network listings and of every AmmReserve's primary curve,
+ * and the rate calculations of the contracts, ported from:
+ *   liquidity_get_rate                      contracts/Reserve/AmmReserve/liquidity.hpp
+ *   AmmReserve::reserve_get_conv_rate       contracts/Reserve/AmmReserve/AmmReserve.cpp
+ *   Network::get_best_rate_results          contracts/Network/Network.cpp
+ *   calc_dest, calc_dest_fixed              contracts/Common/common.hpp
+ * Keep them in line when the contracts change.
+ */
+
+namespace shadow {
+
+typedef unsigned __int128 uint128_t;
+
+const int EOS_PRECISION = 4;
+const int RATE_DECIMALS = 18;
+const double MAX_RATE = 1000000;
+const int64_t MAX_AMOUNT = (int64_t(1) << 62) - 1;
+
+inline uint128_t pow10(int n) {
+    uint128_t res = 1;
+    while (n-- > 0) res *= 10;
+    return res;
+}
+
+struct symbol_t {
+    std::string code;
+    int         precision = 0;
+
+    bool operator==(const symbol_t &o) const { return code == o.code && precision == o.precision; }
+    bool operator!=(const symbol_t &o) const { return !(*this == o); }
+    bool is_eos() const { return code == "EOS" && precision == EOS_PRECISION; }
+    std::string key() const { return std::to_string(precision) + "," + code; }
+};
+
+struct asset_t {
+    int64_t     amount = 0;
+    symbol_t    symbol;
+
+    double damount() const { return double(amount) / double(pow10(symbol.precision)); }
+};
+
+/* the whole string as a number, returns false if malformed, input is never trusted to be. */
+inline bool parse_double(const std::string &str, double &out) {
+    if (str.empty()) return false;
+    char *end;
+    errno = 0;
+    out = strtod(str.c_str(), &end);
+    return (*end == '\0') && (errno == 0) && std::isfinite(out);
+}
+
+/* "4,SYS", returns false if malformed. */
+inline bool parse_symbol(const std::string &str, symbol_t &out) {
+    size_t comma = str.find(',');
+    if (comma == std::string::npos || comma == 0 || comma + 1 >= str.size()) return false;
+    std::string precision = str.substr(0, comma);
+    char *end;
+    errno = 0;
+    long value = strtol(precision.c_str(), &end, 10);
+    if ((*end != '\0') || (errno != 0) || (value < 0) || (value > 18)) return false;
+    out.precision = int(value);
+    out.code = str.substr(comma + 1);
+    return true;
+}
+
+/* "1.0000 EOS", the precision is the number of decimals. */
+inline bool parse_asset(const std::string &str, asset_t &out) {
+    size_t space = str.find(' ');
+    if (space == std::string::npos || space == 0) return false;
+    std::string number = str.substr(0, space);
+    out.symbol.code = str.substr(space + 1);
+    size_t point = number.find('.');
+    out.symbol.precision = (point == std::string::npos) ? 0 : int(number.size() - point - 1);
+    if (out.symbol.precision > 18 || out.symbol.code.empty()) return false;
+
+    bool negative = (number[0] == '-');
+    /* more digits than an int64 holds is malformed too */
+    if (number.size() - (point == std::string::npos ? 0 : 1) - (negative ? 1 : 0) > 18) return false;
+    int64_t amount = 0;
+    for (size_t i = negative ? 1 : 0; i < number.size(); i++) {
+        if (number[i] == '.') continue;
+        if (number[i] < '0' || number[i] > '9') return false;
+        amount = amount * 10 + (number[i] - '0');
+    }
+    out.amount = negative ? -amount : amount;
+    return true;
+}
+
+inline std::string format_asset(const asset_t &quantity) {
+    std::string digits = std::to_string(quantity.amount);
+    int precision = quantity.symbol.precision;
+    if (int(digits.size()) <= precision) digits.insert(0, precision + 1 - digits.size(), '0');
+    if (precision) digits.insert(digits.size() - precision, 1, '.');
+    return digits + " " + quantity.symbol.code;
+}
+
+struct params_t {
+    double      r = 0;
+    double      p_min = 0;
+    int64_t     max_eos_cap_buy = 0;
+    int64_t     max_eos_cap_sell = 0;
+    double      profit_percent = 0;
+    double      ram_fee = 0;
+    double      max_sell_rate = 0;
+    double      min_sell_rate = 0;
+};
+
+struct reserve_mirror {
+    std::string network_contract;
+    symbol_t    token_symbol;
+    std::string token_contract;
+    std::string eos_contract;
+    bool        enabled = false;
+    bool        has_params = false;
+    params_t    params;
+    int64_t     eos = 0; /* eos of the account, the primary curve's while no curve was added */
+    int64_t     token = 0;
+    std::set<std::string> added_curves; /* by token symbol key, see addcurve */
+};
+
+struct quote {
+    std::string reserve;
+    double      rate = 0;
+    asset_t     dest;
+};
+
+/* immutable once published, see snapshot.hpp. */
+struct book {
+    std::string                                     network;
+    std::map<std::string, reserve_mirror>           reserves; /* by account */
+    std::map<std::string, std::vector<std::string>> pairs; /* reservespert, by token symbol key */
+    uint64_t                                        applied = 0; /* traces applied so far */
+
+    /* liquidity_get_rate */
+    static double liquidity_rate(const params_t &p, double e, bool buy, double src) {
+        auto p_of_e = [&](double x) { return p.p_min * exp(p.r * x); };
+        if (!src) {
+            double pre_profit_rate = buy ? (1 / p_of_e(e)) : p_of_e(e);
+            return ((100.0 - p.profit_percent) * pre_profit_rate) / 100.0;
+        }
+        double dest;
+        if (buy) {
+            double fee = (p.profit_percent * src) / 100.0;
+            if (p.ram_fee >= (src - fee)) return 0;
+            fee += p.ram_fee;
+            dest = (-1) * (exp(-p.r * (src - fee)) - 1.0) / (p.r * p_of_e(e));
+        } else {
+            double delta_e = log(1 + p.r * p_of_e(e) * src) / p.r;
+            dest = delta_e - (p.profit_percent * delta_e) / 100.0;
+        }
+        return dest / src;
+    }
+
+    /* reserve_get_conv_rate of the primary curve, 0 if the reserve would not quote. */
+    static double reserve_rate(const reserve_mirror &res, const asset_t &src, asset_t &dest) {
+        dest = asset_t();
+        if (!res.enabled || !res.has_params) return 0;
+
+        /* transfers of added curves, and moveeos between curves, can not be told apart from the primary's */
+        if (!res.added_curves.empty()) return 0;
+        bool buy = src.symbol.is_eos();
+        if (!buy && src.symbol != res.token_symbol) return 0;
+
+        const params_t &p = res.params;
+        double rate = liquidity_rate(p, double(res.eos) / double(pow10(EOS_PRECISION)), buy, src.damount());
+        if (!rate || std::isinf(rate)) return 0;
+
+        double min_allowed_rate = buy ? 1.0 / p.max_sell_rate : p.min_sell_rate;
+        double max_allowed_rate = buy ? 1.0 / p.min_sell_rate : p.max_sell_rate;
+        if ((rate > max_allowed_rate) || (rate < min_allowed_rate) || (rate > MAX_RATE)) return 0;
+
+        /* calc_dest */
+        dest.symbol = buy ? res.token_symbol : symbol_t{"EOS", EOS_PRECISION};
+        double dest_damount = src.damount() * rate;
+        if (dest_damount * double(pow10(dest.symbol.precision)) > double(MAX_AMOUNT)) return 0;
+        dest.amount = int64_t(dest_damount * double(pow10(dest.symbol.precision)));
+
+        int64_t eos_trade_amount = buy ? src.amount : dest.amount;
+        int64_t cap = buy ? p.max_eos_cap_buy : p.max_eos_cap_sell;
+        if (eos_trade_amount > cap) return 0;
+        if ((buy ? res.token : res.eos) < dest.amount) return 0;
+        return rate;
+    }
+
+    /* get_best_rate_results and the dest of trade1: highest fixed point rate, dest bounded by the reserve's. */
+    quote best_rate(const asset_t &src, const symbol_t &dest_symbol) const {
+        quote best;
+        best.dest.symbol = dest_symbol;
+        bool buy = src.symbol.is_eos();
+        auto pair = pairs.find((buy ? dest_symbol : src.symbol).key());
+        if (pair == pairs.end()) return best;
+
+        uint128_t best_fixed = 0;
+        int64_t best_dest_amount = 0;
+        for (auto &name : pair->second) {
+            auto res = reserves.find(name);
+            if (res == reserves.end()) continue;
+            asset_t dest;
+            double rate = reserve_rate(res->second, src, dest);
+            if (!(rate > 0)) continue;
+            uint128_t fixed = uint128_t(rate * double(pow10(RATE_DECIMALS)));
+            if (fixed > best_fixed) {
+                best_fixed = fixed;
+                best_dest_amount = dest.amount;
+                best.reserve = name;
+            }
+        }
+        if (!best_fixed) return best;
+
+        /* calc_dest_fixed */
+        int shift = RATE_DECIMALS + src.symbol.precision - dest_symbol.precision;
+        uint128_t amount = uint128_t(src.amount) * best_fixed / pow10(shift);
+        best.dest.amount = std::min(int64_t(std::min(amount, uint128_t(MAX_AMOUNT))), best_dest_amount);
+        best.rate = double(best_fixed) / double(pow10(RATE_DECIMALS));
+        return best;
+    }
+
+    /* returns whether the trace changed the book. */
+    bool apply(const json &trace) {
+        auto act = trace.get("act") ? trace.get("act") : &trace;
+        std::string account = act->str("account");
+        std::string action = act->str("name");
+        std::string receiver = trace.str("receiver");
+        auto data = act->get("data");
+        if (!data) return false;
+
+        /* notifications repeat the action, only the trace of the contract itself counts */
+        if (!receiver.empty() && receiver != account) return false;
+
+        if (action == "transfer") return apply_transfer(account, *data);
+        if (account == network) return apply_network(action, *data);
+
+        auto res = reserves.find(account);
+        if (action == "init" || action == "initparams") {
+            reserve_mirror r;
+            if (!parse_symbol(data->str("token_symbol"), r.token_symbol)) return false;
+            r.network_contract = data->str("network_contract");
+            r.token_contract = data->str("token_contract");
+            r.eos_contract = data->str("eos_contract");
+            r.enabled = data->flag("enable_trade");
+            if (res != reserves.end()) {
+                r.eos = res->second.eos;
+                r.token = res->second.token;
+                r.added_curves = res->second.added_curves;
+            }
+            if (action == "initparams" && !set_params(r, *data)) return false;
+            reserves[account] = r;
+            return true;
+        }
+        if (res == reserves.end()) return false;
+
+        reserve_mirror &r = res->second;
+        if (action == "setparams") {
+            return set_params(r, *data);
+        } else if (action == "setcurve") {
+            symbol_t token_symbol;
+            if (!parse_symbol(data->str("token_symbol"), token_symbol)) return false;
+            /* only the primary curve is mirrored */
+            if (token_symbol != r.token_symbol) return false;
+            return set_params(r, *data);
+        } else if (action == "addcurve" || action == "rmcurve") {
+            symbol_t token_symbol;
+            if (!parse_symbol(data->str("token_symbol"), token_symbol)) return false;
+            if (action == "addcurve") r.added_curves.insert(token_symbol.key());
+            else r.added_curves.erase(token_symbol.key());
+        } else if (action == "quickset") {
+            /* the contract refuses quickset without eos, it only shows up here if the mirror is off */
+            double p;
+            if (!parse_double(data->str("p"), p) || r.eos <= 0) return false;
+            r.params = params_t();
+            r.params.p_min = p / 2.0;
+            r.params.max_eos_cap_buy = MAX_AMOUNT;
+            r.params.max_eos_cap_sell = MAX_AMOUNT;
+            r.params.max_sell_rate = p * 2.0;
+            r.params.min_sell_rate = p / 2.0;
+            r.params.r = 0.69314 / (double(r.eos) / double(pow10(EOS_PRECISION)));
+            r.has_params = true;
+        } else if (action == "setenable") {
+            r.enabled = data->flag("enable");
+        } else if (action == "setnetwork") {
+            r.network_contract = data->str("network_contract");
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    private:
+        /* returns false and leaves the params as they were if any field is malformed. */
+        static bool set_params(reserve_mirror &r, const json &data) {
+            asset_t cap_buy, cap_sell;
+            params_t params;
+            if (!parse_asset(data.str("max_eos_cap_buy"), cap_buy) ||
+                !parse_asset(data.str("max_eos_cap_sell"), cap_sell) ||
+                !parse_double(data.str("r"), params.r) ||
+                !parse_double(data.str("p_min"), params.p_min) ||
+                !parse_double(data.str("profit_percent"), params.profit_percent) ||
+                !parse_double(data.str("ram_fee"), params.ram_fee) ||
+                !parse_double(data.str("max_sell_rate"), params.max_sell_rate) ||
+                !parse_double(data.str("min_sell_rate"), params.min_sell_rate)) {
+                return false;
+            }
+            params.max_eos_cap_buy = cap_buy.amount;
+            params.max_eos_cap_sell = cap_sell.amount;
+            r.params = params;
+            r.has_params = true;
+            return true;
+        }
+
+        /* the inventory of the primary curve, as AmmReserve keeps it from the transfers it sees */
+        bool apply_transfer(const std::string &code, const json &data) {
+            asset_t quantity;
+            if (!parse_asset(data.str("quantity"), quantity)) return false;
+            bool changed = false;
+            for (auto side : {std::make_pair(data.str("to"), quantity.amount),
+                              std::make_pair(data.str("from"), -quantity.amount)}) {
+                auto res = reserves.find(side.first);
+                if (res == reserves.end()) continue;
+                reserve_mirror &r = res->second;
+                if (quantity.symbol.is_eos() && code == r.eos_contract) {
+                    r.eos += side.second;
+                    changed = true;
+                } else if (quantity.symbol == r.token_symbol && code == r.token_contract) {
+                    r.token += side.second;
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        bool apply_network(const std::string &action, const json &data) {
+            if (action == "listpairres") return list_pair(data);
+            if (action == "listpairs") {
+                auto listings = data.get("listings");
+                bool changed = false;
+                if (listings) for (auto &l : listings->items) changed = list_pair(l) || changed;
+                return changed;
+            }
+            /* addreserve does not change routing, a reserve can only be removed once it has no listed pairs */
+            return false;
+        }
+
+        bool list_pair(const json &data) {
+            symbol_t token_symbol;
+            if (!parse_symbol(data.str("token_symbol"), token_symbol)) return false;
+            std::string reserve = data.str("reserve");
+            auto &listed = pairs[token_symbol.key()];
+            auto itr = std::find(listed.begin(), listed.end(), reserve);
+            if (data.flag("add") && itr == listed.end()) {
+                listed.push_back(reserve);
+            } else if (!data.flag("add") && itr != listed.end()) {
+                listed.erase(itr);
+                if (listed.empty()) pairs.erase(token_symbol.key());
+            } else {
+                return false;
+            }
+            return true;
+        }
+};
+
+} // namespace shadow
@@ -0,0 +1,2 @@
+set -x
+cd "$(dirname "$0")" ; g++ -std=c++17 -O2 -Wall -pthread -o shadow shadow.cpp
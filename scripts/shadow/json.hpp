@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Minimal JSON reader for the action trace stream, values are kept as parsed,
+ * numbers keep their text so amounts and rates lose no precision on the way.
+ */
+
+namespace shadow {
+
+struct json {
+    enum kind_t { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+    kind_t                          kind = NUL;
+    bool                            boolean = false;
+    std::string                     text; /* string value, or the number as written */
+    std::vector<json>               items;
+    std::map<std::string, json>     fields;
+
+    const json* get(const std::string &key) const {
+        auto itr = fields.find(key);
+        return (kind == OBJECT && itr != fields.end()) ? &itr->second : nullptr;
+    }
+
+    /* string or number as text, empty if missing. */
+    std::string str(const std::string &key) const {
+        auto value = get(key);
+        return (value && (value->kind == STRING || value->kind == NUMBER)) ? value->text : std::string();
+    }
+
+    /* bool, or 0/1 as abi serializers write it. */
+    bool flag(const std::string &key) const {
+        auto value = get(key);
+        if (!value) return false;
+        if (value->kind == BOOL) return value->boolean;
+        return value->text == "1" || value->text == "true";
+    }
+};
+
+class json_parser {
+    public:
+        explicit json_parser(const std::string &input) : s(input), pos(0) {}
+
+        /* returns false on malformed input. */
+        bool parse(json &out) {
+            if (!value(out)) return false;
+            skip_space();
+            return pos == s.size();
+        }
+
+    private:
+        const std::string   &s;
+        size_t              pos;
+
+        void skip_space() {
+            while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\r' || s[pos] == '\n')) pos++;
+        }
+
+        bool literal(const char *word) {
+            size_t n = std::char_traits<char>::length(word);
+            if (s.compare(pos, n, word) != 0) return false;
+            pos += n;
+            return true;
+        }
+
+        bool value(json &out) {
+            skip_space();
+            if (pos >= s.size()) return false;
+            char c = s[pos];
+            if (c == '{') return object(out);
+            if (c == '[') return array(out);
+            if (c == '"') {
+                out.kind = json::STRING;
+                return string(out.text);
+            }
+            if (c == 't' || c == 'f') {
+                out.kind = json::BOOL;
+                out.boolean = (c == 't');
+                return literal(out.boolean ? "true" : "false");
+            }
+            if (c == 'n') {
+                out.kind = json::NUL;
+                return literal("null");
+            }
+            return number(out);
+        }
+
+        bool number(json &out) {
+            size_t start = pos;
+            while (pos < s.size() && (isdigit((unsigned char)s[pos]) || s[pos] == '-' || s[pos] == '+' ||
+                                      s[pos] == '.' || s[pos] == 'e' || s[pos] == 'E')) pos++;
+            if (pos == start) return false;
+            out.kind = json::NUMBER;
+            out.text = s.substr(start, pos - start);
+            return true;
+        }
+
+        bool string(std::string &out) {
+            pos++; /* opening quote */
+            while (pos < s.size()) {
+                char c = s[pos++];
+                if (c == '"') return true;
+                if (c != '\\') {
+                    out.push_back(c);
+                    continue;
+                }
+                if (pos >= s.size()) return false;
+                char e = s[pos++];
+                switch (e) {
+                    case 'n': out.push_back('\n'); break;
+                    case 't': out.push_back('\t'); break;
+                    case 'r': out.push_back('\r'); break;
+                    case 'b': out.push_back('\b'); break;
+                    case 'f': out.push_back('\f'); break;
+                    case 'u': {
+                        /* names, symbols and memos of interest are ascii, keep others as '?' */
+                        if (pos + 4 > s.size()) return false;
+                        std::string hex = s.substr(pos, 4);
+                        char *end;
+                        unsigned long code = strtoul(hex.c_str(), &end, 16);
+                        if (*end != '\0' || !isxdigit((unsigned char)hex[0])) return false;
+                        out.push_back(code < 0x80 ? char(code) : '?');
+                        pos += 4;
+                        break;
+                    }
+                    default: out.push_back(e);
+                }
+            }
+            return false;
+        }
+
+        bool array(json &out) {
+            out.kind = json::ARRAY;
+            pos++;
+            skip_space();
+            if (pos < s.size() && s[pos] == ']') {
+                pos++;
+                return true;
+            }
+            for (;;) {
+                json item;
+                if (!value(item)) return false;
+                out.items.push_back(std::move(item));
+                skip_space();
+                if (pos >= s.size()) return false;
+                if (s[pos++] == ']') return true;
+                if (s[pos - 1] != ',') return false;
+            }
+        }
+
+        bool object(json &out) {
+            out.kind = json::OBJECT;
+            pos++;
+            skip_space();
+            if (pos < s.size() && s[pos] == '}') {
+                pos++;
+                return true;
+            }
+            for (;;) {
+                skip_space();
+                std::string key;
+                if (pos >= s.size() || s[pos] != '"' || !string(key)) return false;
+                skip_space();
+                if (pos >= s.size() || s[pos++] != ':') return false;
+                if (!value(out.fields[key])) return false;
+                skip_space();
+                if (pos >= s.size()) return false;
+                if (s[pos++] == '}') return true;
+                if (s[pos - 1] != ',') return false;
+            }
+        }
+};
+
+} // namespace shadow
@@ -0,0 +1,179 @@
+/*
+ * Shadow pricing daemon.
+ *
+ * Mirrors the reserve state of the network off chain from a stream of action traces,
+ * and answers best rate queries from memory, so pricing does not cost a getconvrate
+ * fan-out transaction per quote.
+ *
+ * Input is newline delimited json, one action trace per line, read from a file or a pipe,
+ * either as a full action trace ({"receiver": ..., "act": {"account", "name", "data"}})
+ * or just the action ({"account", "name", "data"}). Data must be abi decoded. The stream
+ * must start at the deployment of the contracts, since inventory is rebuilt from transfers.
+ *
+ * Queries are lines on a unix socket:
+ *   rate <src asset> <dest symbol>   ->  ok <reserve> <rate> <dest asset>  |  err <reason>
+ *   stats                            ->  ok <traces applied> <reserves> <pairs> <pending books>
+ *
+ * Usage:
+ *   shadow --network <account> --socket <path> [--input <file>]
+ *   nodeos ... | trace-to-ndjson | shadow --network network --socket /tmp/shadow.sock
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "json.hpp"
+#include "book.hpp"
+#include "snapshot.hpp"
+
+using namespace shadow;
+
+#define PUBLISH_EVERY 1000 /* traces, publish even when input keeps arriving */
+
+static std::string answer(const book &b, const std::string &line) {
+    std::istringstream in(line);
+    std::string command;
+    in >> command;
+
+    if (command == "stats") {
+        return "ok " + std::to_string(b.applied) + " " + std::to_string(b.reserves.size()) + " " +
+               std::to_string(b.pairs.size());
+    }
+    if (command != "rate") return "err unknown command";
+
+    std::string amount, code, dest;
+    in >> amount >> code >> dest;
+    asset_t src;
+    symbol_t dest_symbol;
+    if (!parse_asset(amount + " " + code, src) || src.amount <= 0) return "err invalid src";
+    if (!parse_symbol(dest, dest_symbol)) return "err invalid dest symbol";
+    if (src.symbol.is_eos() == dest_symbol.is_eos()) return "err one side must be EOS";
+
+    quote q = b.best_rate(src, dest_symbol);
+    if (q.reserve.empty()) return "err no rate";
+
+    char rate[32];
+    snprintf(rate, sizeof(rate), "%.12g", q.rate);
+    return "ok " + q.reserve + " " + rate + " " + format_asset(q.dest);
+}
+
+static void serve(snapshots &books, int fd) {
+    int slot = books.acquire_slot();
+    if (slot < 0) {
+        const char *busy = "err too many connections\n";
+        write(fd, busy, strlen(busy));
+        close(fd);
+        return;
+    }
+
+    std::string buffer;
+    char chunk[4096];
+    for (;;) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) break;
+        buffer.append(chunk, n);
+
+        size_t pos;
+        while ((pos = buffer.find('\n')) != std::string::npos) {
+            std::string line = buffer.substr(0, pos);
+            buffer.erase(0, pos + 1);
+
+            const book *b = books.pin(slot);
+            std::string reply = answer(*b, line);
+            if (line.compare(0, 5, "stats") == 0) reply += " " + std::to_string(books.pending());
+            books.unpin(slot);
+
+            reply.push_back('\n');
+            if (write(fd, reply.data(), reply.size()) < 0) break;
+        }
+    }
+    books.release_slot(slot);
+    close(fd);
+}
+
+static void listen_socket(snapshots &books, const std::string &path) {
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    if (server < 0 || bind(server, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(server, 16) < 0) {
+        perror("socket");
+        exit(1);
+    }
+    for (;;) {
+        int fd = accept(server, nullptr, nullptr);
+        if (fd < 0) continue;
+        std::thread(serve, std::ref(books), fd).detach();
+    }
+}
+
+/* single writer: applies traces to a draft copy and publishes it once the input is drained. */
+static void follow(snapshots &books, std::istream &in) {
+    book *draft = nullptr;
+    uint64_t unpublished = 0;
+    std::string line;
+
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        json trace;
+        if (!json_parser(line).parse(trace)) {
+            std::cerr << "skipping malformed trace: " << line.substr(0, 80) << std::endl;
+            continue;
+        }
+
+        if (!draft) draft = new book(books.latest());
+        draft->applied++;
+        if (draft->apply(trace)) unpublished++;
+
+        if (unpublished >= PUBLISH_EVERY || in.rdbuf()->in_avail() <= 0) {
+            books.publish(draft);
+            draft = nullptr;
+            unpublished = 0;
+        }
+    }
+    if (draft) books.publish(draft);
+}
+
+int main(int argc, char **argv) {
+    std::string network, socket_path, input;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--network") network = argv[i + 1];
+        else if (arg == "--socket") socket_path = argv[i + 1];
+        else if (arg == "--input") input = argv[i + 1];
+    }
+    if (network.empty() || socket_path.empty()) {
+        std::cerr << "usage: shadow --network <account> --socket <path> [--input <file>]" << std::endl;
+        return 1;
+    }
+
+    std::ios::sync_with_stdio(false);
+    snapshots books;
+    book *first = new book();
+    first->network = network;
+    books.publish(first);
+
+    std::thread server(listen_socket, std::ref(books), socket_path);
+
+    if (input.empty()) {
+        follow(books, std::cin);
+    } else {
+        std::ifstream file(input);
+        if (!file) {
+            std::cerr << "can not open " << input << std::endl;
+            return 1;
+        }
+        follow(books, file);
+    }
+
+    /* input ended, keep answering from the last book */
+    server.join();
+    return 0;
+}
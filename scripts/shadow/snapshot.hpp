@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "book.hpp"
+
+/*
+ * Lock free publication of the book, with epoch based reclamation.
+ *
+ * The single writer applies traces to a private copy and publishes it with one atomic store.
+ * Readers pin the current epoch in their slot before loading the pointer, so a retired book
+ * is only freed once every slot is idle or has pinned a later epoch. Neither side ever blocks.
+ */
+
+namespace shadow {
+
+const int MAX_READERS = 64;
+const uint64_t IDLE = 0;
+
+class snapshots {
+    public:
+        snapshots() : current(new book()), epoch(1), num_retired(0) {
+            for (auto &slot : slots) slot.store(IDLE);
+            for (auto &used : taken) used.store(false);
+        }
+
+        ~snapshots() {
+            reclaim(UINT64_MAX);
+            delete current.load();
+        }
+
+        /* a reader slot per connection, -1 if all are taken. */
+        int acquire_slot() {
+            for (int i = 0; i < MAX_READERS; i++) {
+                bool expected = false;
+                if (taken[i].compare_exchange_strong(expected, true)) return i;
+            }
+            return -1;
+        }
+
+        void release_slot(int slot) {
+            slots[slot].store(IDLE);
+            taken[slot].store(false);
+        }
+
+        /* the book stays valid until unpin. */
+        const book* pin(int slot) {
+            slots[slot].store(epoch.load());
+            return current.load();
+        }
+
+        void unpin(int slot) {
+            slots[slot].store(IDLE);
+        }
+
+        /* writer only. */
+        const book& latest() const {
+            return *current.load();
+        }
+
+        /* writer only, takes ownership of next. */
+        void publish(book *next) {
+            const book *prev = current.exchange(next);
+            retired.push_back({prev, epoch.fetch_add(1)});
+            reclaim(min_pinned());
+        }
+
+        /* any thread, the count the writer last published. */
+        size_t pending() const {
+            return num_retired.load();
+        }
+
+    private:
+        struct retired_book {
+            const book  *ptr;
+            uint64_t    epoch; /* readers pinned after this epoch can not see ptr */
+        };
+
+        std::atomic<const book*>    current;
+        std::atomic<uint64_t>       epoch;
+        std::atomic<uint64_t>       slots[MAX_READERS];
+        std::atomic<bool>           taken[MAX_READERS];
+        std::vector<retired_book>   retired; /* writer only */
+        std::atomic<size_t>         num_retired; /* size of retired, for readers */
+
+        uint64_t min_pinned() const {
+            uint64_t res = UINT64_MAX;
+            for (auto &slot : slots) {
+                uint64_t pinned = slot.load();
+                if (pinned != IDLE && pinned < res) res = pinned;
+            }
+            return res;
+        }
+
+        void reclaim(uint64_t min_epoch) {
+            size_t kept = 0;
+            for (auto &r : retired) {
+                if (r.epoch < min_epoch) delete r.ptr;
+                else retired[kept++] = r;
+            }
+            retired.resize(kept);
+            num_retired.store(kept);
+        }
+};
+
+} // namespace shadow
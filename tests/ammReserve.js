@@ -131,11 +131,11 @@ describe('As reserve admin', () => {
         let state
         await reserveAsOwner.setenable({enable: 0},{authorization: `${adminData.account}@active`});
         state = await adminData.eos.getTableRows({code: reserveData.account, scope: reserveData.account, table: 'state', json: true});
-        assert.equal(state["rows"][0].trade_enabled, 0);
+        assert.equal(state["rows"][0].flags & 1, 0);
 
         await reserveAsOwner.setenable({enable: 1},{authorization: `${adminData.account}@active`});
         state = await adminData.eos.getTableRows({code: reserveData.account, scope: reserveData.account, table: 'state', json: true});
-        assert.equal(state["rows"][0].trade_enabled, 1);
+        assert.equal(state["rows"][0].flags & 1, 1);
     });
     it('can set admin', async function() {
         let state
@@ -171,6 +171,33 @@ describe('As reserve admin', () => {
         const balanceChange = balanceAfter - balanceBefore
         balanceChange.should.be.closeTo(23.0000, AMOUNT_PRECISON);
     });
+    it('keeps inventory in line with the reserve balances', async function() {
+        const eosBalance = await getUserBalance({account:reserveData.account, symbol:'EOS', tokenContract:tokenData.account, eos:mosheData.eos})
+        const tokenBalance = await getUserBalance({account:reserveData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+        let inventory = (await adminData.eos.getTableRows({code: reserveData.account, scope: reserveData.account, table: 'inventory', json: true})).rows[0]
+        assert.equal(inventory.eos, Math.round(eosBalance * 10000))
+        assert.equal(inventory.token, Math.round(tokenBalance * 10000))
+
+        await reserveAsOwner.resync({}, {authorization: `${adminData.account}@active`});
+        const resynced = (await adminData.eos.getTableRows({code: reserveData.account, scope: reserveData.account, table: 'inventory', json: true})).rows[0]
+        assert.deepEqual(resynced, inventory)
+    });
+    it('add, quote and remove a second curve', async function() {
+        await reserveAsOwner.addcurve({token_symbol: "4,TKN", token_contract: tokenData.account}, {authorization: `${adminData.account}@active`});
+        const curves = (await adminData.eos.getTableRows({code: reserveData.account, scope: reserveData.account, table: 'curves', json: true})).rows
+        assert.equal(curves.length, 1)
+        assert.equal(curves[0].token_symbol, "4,TKN")
+
+        /* no eos was moved to the curve, so it quotes no rate */
+        await reserveAsOwner.setcurve(Object.assign({token_symbol: "4,TKN"}, defaultParams), {authorization: `${adminData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "1.0000 EOS", dest_symbol: "4,TKN", from_vault: 0},{authorization: `${networkData.account}@active`});
+        const rate = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate
+        assert.equal(parseFloat(rate), 0)
+
+        await reserveAsOwner.rmcurve({token_symbol: "4,TKN"}, {authorization: `${adminData.account}@active`});
+        const remaining = (await adminData.eos.getTableRows({code: reserveData.account, scope: reserveData.account, table: 'curves', json: true})).rows
+        assert.equal(remaining.length, 0)
+    });
     it('can not get funds from non authorized account', async function() {
         const token = await aliceData.eos.contract(tokenData.account);
         const p = token.transfer({from:aliceData.account, to:reserveData.account, quantity:"0.0001 EOS", memo:"just checking a refund"},
@@ -223,6 +250,14 @@ describe('as a regular user', () => {
         const p =  reserveAsAlice.setadmin({admin: adminData.account},{authorization: `${aliceData.account}@active`});
         await ensureContractAssertionError(p, "Missing required authority");
     });
+    it('can not add a curve', async function() {
+        const p = reserveAsAlice.addcurve({token_symbol: "4,TKN", token_contract: tokenData.account}, {authorization: `${aliceData.account}@active`});
+        await ensureContractAssertionError(p, "Missing required authority");
+    });
+    it('can not resync inventory', async function() {
+        const p = reserveAsAlice.resync({}, {authorization: `${aliceData.account}@active`});
+        await ensureContractAssertionError(p, "Missing required authority");
+    });
     it('can not withdraw funds from reserve', async function() {
         const p = reserveAsAlice.withdraw({
             to:adminData.account,
@@ -241,7 +276,7 @@ describe('as a regular user', () => {
     it('get buy rate with 0 quantity', async function() {
         /* get rate from blockchain. */
         const reserveAsNetwork = await networkData.eos.contract(reserveData.account);
-        await reserveAsNetwork.getconvrate({src: "0.0000 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "0.0000 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
 
         /* calc expected rate offline*/
@@ -250,15 +285,22 @@ describe('as a regular user', () => {
     });
     it('get buy rate with non 0 quantity', async function() {
         /* get rate from blockchain. */
-        await reserveAsNetwork.getconvrate({src: "4.7611 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "4.7611 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
 
         /* calc expected rate offline*/
         let calcRate = await reserveServices.getRate({ srcSymbol:"EOS", destSymbol:"SYS", srcAmount: 4.7611, eos:reserveData.eos, reserveAccount:reserveData.account, eosTokenAccount:tokenData.account})
         calcRate.should.be.closeTo(rate, RATE_PRECISON)
     });
+    it('buy rate for a vault trade is bounded by the internal balance', async function() {
+        /* the reserve holds SYS in its account, but none in the network vault */
+        await reserveAsNetwork.getconvrate({src: "1.0000 EOS", dest_symbol: "4,SYS", from_vault: 1},{authorization: `${networkData.account}@active`});
+        const row = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0]
+        assert.equal(parseFloat(row.stored_rate), 0)
+        assert.equal(row.reason, 6 /* low balance */)
+    });
     it('buy with rate < min_buy_rate is 0', async function() {
-        await reserveAsNetwork.getconvrate({src: "1.2321 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "1.2321 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.notEqual(rate, 0)
 
@@ -267,7 +309,7 @@ describe('as a regular user', () => {
         alteredParams.max_sell_rate = max_sell_rate.toFixed(4).toString()
         await reserveAsOwner.setparams(alteredParams,{authorization: `${adminData.account}@active`});
         
-        await reserveAsNetwork.getconvrate({src: "1.2322 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "1.2322 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.equal(rate, 0)
 
@@ -275,7 +317,7 @@ describe('as a regular user', () => {
         await reserveAsOwner.setparams(defaultParams,{authorization: `${adminData.account}@active`});
     });
     it('buy with rate > max_buy_rate is 0', async function() {
-        await reserveAsNetwork.getconvrate({src: "1.2321 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "1.2321 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.notEqual(rate, 0)
 
@@ -284,7 +326,7 @@ describe('as a regular user', () => {
         alteredParams.min_sell_rate = min_sell_rate.toFixed(4).toString()
         await reserveAsOwner.setparams(alteredParams, {authorization: `${adminData.account}@active`});
 
-        await reserveAsNetwork.getconvrate({src: "1.2322 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "1.2322 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.equal(rate, 0)
 
@@ -293,7 +335,7 @@ describe('as a regular user', () => {
     });
     it('get sell rate with 0 quantity', async function() {
         /* get rate from blockchain. */
-        await reserveAsNetwork.getconvrate({src: "0.0000 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "0.0000 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate
 
         /* calc expected rate offline*/
@@ -302,15 +344,15 @@ describe('as a regular user', () => {
     });
     it('get sell rate with non 0 quantity', async function() {
         /* get rate from blockchain. */
-        await reserveAsNetwork.getconvrate({src: "34.211 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "34.2110 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate
 
         /* calc expected rate offline*/
-        let calcRate = await reserveServices.getRate({ srcSymbol:"SYS", destSymbol:"EOS", srcAmount: 34.211, eos:reserveData.eos, reserveAccount:reserveData.account, eosTokenAccount:tokenData.account})
+        let calcRate = await reserveServices.getRate({ srcSymbol:"SYS", destSymbol:"EOS", srcAmount: 34.2110, eos:reserveData.eos, reserveAccount:reserveData.account, eosTokenAccount:tokenData.account})
         calcRate.toString().should.be.equal(rate)
     });
     it('sell with rate < min_sell_rate is 0', async function() {
-        await reserveAsNetwork.getconvrate({src: "14.2172 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "14.2172 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.notEqual(rate, 0)
 
@@ -320,20 +362,37 @@ describe('as a regular user', () => {
         alteredParams.min_sell_rate = min_sell_rate.toFixed(4).toString()
         await reserveAsOwner.setparams(alteredParams,{authorization: `${adminData.account}@active`});
         
-        await reserveAsNetwork.getconvrate({src: "14.2171 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "14.2171 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.equal(rate, 0)
 
         /* return to previous params */
         await reserveAsOwner.setparams(defaultParams,{authorization: `${adminData.account}@active`});
     });
+    it('can not get max src', async function() {
+        const p = reserveAsAlice.getmaxsrc({token_symbol: "4,SYS", buy: 1, min_rate: "1.0"},{authorization: `${aliceData.account}@active`});
+        await ensureContractAssertionError(p, "Missing required authority");
+    });
+    it('max buy src meets the min rate', async function() {
+        await reserveAsNetwork.getconvrate({src: "0.0000 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
+        let spotRate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
+        let minRate = spotRate * 0.99
+
+        await reserveAsNetwork.getmaxsrc({token_symbol: "4,SYS", buy: 1, min_rate: minRate.toString()},{authorization: `${networkData.account}@active`});
+        let maxSrc = (await reserveData.eos.getTableRows({table:"maxsrc", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].src
+        parseFloat(maxSrc).should.be.above(0)
+
+        await reserveAsNetwork.getconvrate({src: maxSrc, dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
+        let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
+        rate.should.be.at.least(minRate)
+    });
     it('getting 0 rate of if ram fee is as big as EOS amount on buy', async function() {
         let alteredParams = Object.assign({}, defaultParams);
         alteredParams.profit_percent = 0.0
         alteredParams.ram_fee = 3.3112
         await reserveAsOwner.setparams(alteredParams,{authorization: `${adminData.account}@active`});
 
-        await reserveAsNetwork.getconvrate({src: "3.3112 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "3.3112 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.equal(rate, 0)
 
@@ -346,7 +405,7 @@ describe('as a regular user', () => {
         alteredParams.ram_fee = 3.3000
         await reserveAsOwner.setparams(alteredParams,{authorization: `${adminData.account}@active`});
 
-        await reserveAsNetwork.getconvrate({src: "3.3112 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "3.3112 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.equal(rate, 0)
 
@@ -354,7 +413,7 @@ describe('as a regular user', () => {
         await reserveAsOwner.setparams(defaultParams,{authorization: `${adminData.account}@active`});
     });
     xit('removed because of Duplicate transaction - sell with rate > max_sell_rate is 0 ', async function() {
-        await reserveAsNetwork.getconvrate({src: "14.213 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "14.2130 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.notEqual(rate, 0)
     
@@ -363,7 +422,7 @@ describe('as a regular user', () => {
         alteredParams.max_sell_rate = max_sell_rate.toFixed(4).toString()
         await reserveAsOwner.setparams(alteredParams,{authorization: `${adminData.account}@active`});
         
-        await reserveAsNetwork.getconvrate({src: "14.213 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "14.2130 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         rate = parseFloat((await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate)
         assert.equal(rate, 0)
     
@@ -380,7 +439,7 @@ describe('As network', () => {
 
         const balanceBefore = await getUserBalance({account:mosheData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
 
-        await reserveAsNetwork.getconvrate({src: "2.3110 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "2.3110 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         await token.transfer({from:networkData.account, to:reserveData.account, quantity:"2.3110 EOS", memo:mosheData.account},
                              {authorization: [`${networkData.account}@active`]});
 
@@ -394,7 +453,7 @@ describe('As network', () => {
         let calcRate = await reserveServices.getRate({ srcAmount: 3.3112, srcSymbol:"EOS", destSymbol:"SYS", eos:reserveData.eos, reserveAccount:reserveData.account, eosTokenAccount:tokenData.account})
         let calcDestAmount = srcAmount * calcRate;
 
-        await reserveAsNetwork.getconvrate({src: "3.3112 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "3.3112 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         await token.transfer({from:networkData.account, to:reserveData.account, quantity:"3.3112 EOS", memo:mosheData.account},
                              {authorization: [`${networkData.account}@active`]});
 
@@ -407,7 +466,7 @@ describe('As network', () => {
     })
     xit('removed because of Duplicate transaction - buy rate includes profit', async function() {
         // get rate with profit
-        await reserveAsNetwork.getconvrate({src: "7.3116 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "7.3116 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rateWithprofits = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate
 
         //set profit as 0 and get rate without profit
@@ -416,7 +475,7 @@ describe('As network', () => {
         await reserveAsOwner.setparams(alteredParams,{authorization: `${adminData.account}@active`});
 
         // get rate without profit
-        await reserveAsNetwork.getconvrate({src: "7.3116 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "7.3116 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rateWithoutprofits = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate
         (rateWithoutprofits * (100 + 0.25) / 100).should.be.closeTo(rateWithprofits, AMOUNT_PRECISON);
 
@@ -431,7 +490,7 @@ describe('As network', () => {
 
         fee_before = await getUserBalance({account:walletData.account, symbol:'EOS', tokenContract:tokenData.account, eos:walletData.eos})
 
-        await reserveAsNetwork.getconvrate({src: "3.3112 EOS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "3.3112 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
         await token.transfer({from:networkData.account, to:reserveData.account, quantity:"3.3112 EOS", memo:mosheData.account},
                              {authorization: [`${networkData.account}@active`]});
 
@@ -449,7 +508,7 @@ describe('As network', () => {
 
         const balanceBefore = await getUserBalance({account:mosheData.account, symbol:'EOS', tokenContract:tokenData.account, eos:mosheData.eos})
 
-        await reserveAsNetwork.getconvrate({src: "34.2110 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "34.2110 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         await token.transfer({from:networkData.account, to:reserveData.account, quantity:"34.2110 SYS", memo:mosheData.account},
                              {authorization: [`${networkData.account}@active`]});
 
@@ -457,13 +516,21 @@ describe('As network', () => {
         const balanceChange = balanceAfter - balanceBefore
         balanceChange.should.be.closeTo(calcDestAmount, AMOUNT_PRECISON);
     });
+    it('spot price follows the inventory after a trade', async function() {
+        const spot = (await reserveData.eos.getTableRows({table:"spot", code:reserveData.account, scope:reserveData.account, json: true})).rows[0]
+        const inventory = (await reserveData.eos.getTableRows({table:"inventory", code:reserveData.account, scope:reserveData.account, json: true})).rows[0]
+        assert.equal(spot.eos, inventory.eos)
+
+        const expectedSpot = defaultParams.p_min * Math.exp(defaultParams.r * inventory.eos / 10000)
+        parseFloat(spot.p).should.be.closeTo(expectedSpot, RATE_PRECISON)
+    });
     it('profit and ram fee are sent on sell', async function() {
         fee_before = await getUserBalance({account:walletData.account, symbol:'EOS', tokenContract:tokenData.account, eos:walletData.eos})
 
         let calcRate = await reserveServices.getRate({ srcAmount: 34.2113, srcSymbol:"SYS", destSymbol:"EOS", eos:reserveData.eos, reserveAccount:reserveData.account, eosTokenAccount:tokenData.account})
         let calcDestAmount = srcAmount * calcRate;
 
-        await reserveAsNetwork.getconvrate({src: "34.2113 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "34.2113 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         await token.transfer({from:networkData.account, to:reserveData.account, quantity:"34.2113 SYS", memo:mosheData.account},
                 {authorization: [`${networkData.account}@active`]});
 
@@ -476,7 +543,7 @@ describe('As network', () => {
     })
     xit('removed because of Duplicate transaction - sell rate includes profit', async function() {
         // get rate with profit
-        await reserveAsNetwork.getconvrate({src: "0.2111 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "0.2111 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         rateWithoutprofits = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate
 
         //set profit as 0 and get rate without profit
@@ -485,7 +552,7 @@ describe('As network', () => {
         await reserveAsOwner.setparams(alteredParams,{authorization: `${adminData.account}@active`});
 
         // get rate without profit
-        await reserveAsNetwork.getconvrate({src: "0.2111 SYS"},{authorization: `${networkData.account}@active`});
+        await reserveAsNetwork.getconvrate({src: "0.2111 SYS", dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
         let rateWithprofits = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate
 
         (rateWithprofits * (100 + 0.25) / 100).should.be.closeTo(rateWithoutprofits, AMOUNT_PRECISON);
@@ -504,7 +571,7 @@ describe('As network', () => {
             //console.log(amountAsString)
 
             // get sell rate
-            await reserveAsNetwork.getconvrate({src: amountAsString},{authorization: `${networkData.account}@active`});
+            await reserveAsNetwork.getconvrate({src: amountAsString, dest_symbol: "4,EOS", from_vault: 0},{authorization: `${networkData.account}@active`});
             rate = (await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})).rows[0].stored_rate
             //console.log("sell rate", rate)
 
@@ -515,7 +582,7 @@ describe('As network', () => {
                 parseFloat(last_rate).should.be.closeTo(parseFloat(defaultParams.p_min), 0.01);
 
                 // make sure current buy rate is close to pmin
-                await reserveAsNetwork.getconvrate({src: "0.0000 EOS"},{authorization: `${networkData.account}@active`});
+                await reserveAsNetwork.getconvrate({src: "0.0000 EOS", dest_symbol: "4,SYS", from_vault: 0},{authorization: `${networkData.account}@active`});
                 res = await reserveData.eos.getTableRows({table:"rate", code:reserveData.account, scope:reserveData.account, json: true})
                 buyRate = 1/parseFloat(res.rows[0].stored_rate)
                 buyRate.should.be.closeTo(parseFloat(defaultParams.p_min), 0.01);
@@ -6,7 +6,7 @@ const should = require('chai').should();
 const assert = require('assert');
 
 const {ensureContractAssertionError, snooze, getUserBalance,
-       renouncePermToOnlyCode, roundDown} = require('./utils');
+       renouncePermToOnlyCode, roundDown, symbolRaw} = require('./utils');
 const networkServices = require('../scripts/services/networkServices')
 const reserveServices = require('../scripts/services/ammReserveServices')
 
@@ -32,6 +32,7 @@ const reserve6Data =      {account: "netreserve11", publicKey: keyPairArray[1][0
 const reserve6AdminData = {account: "netadmin11",   publicKey: keyPairArray[1][0], privateKey: keyPairArray[1][1]}
 const reserve7Data =      {account: "netreserve12", publicKey: keyPairArray[1][0], privateKey: keyPairArray[1][1]}
 const reserve7AdminData = {account: "netadmin12",   publicKey: keyPairArray[1][0], privateKey: keyPairArray[1][1]}
+const legacyReserveData = {account: "netlegacy", publicKey: keyPairArray[1][0], privateKey: keyPairArray[1][1]}
 
 
 const aliceData =         {account: "netalice",   publicKey: keyPairArray[2][0], privateKey: keyPairArray[2][1]}
@@ -61,6 +62,7 @@ reserve6Data.eos = Eos({ keyProvider: reserve6Data.privateKey /* , verbose: 'fal
 reserve6AdminData.eos = Eos({ keyProvider: reserve6AdminData.privateKey /* , verbose: 'false' */})
 reserve7Data.eos = Eos({ keyProvider: reserve7Data.privateKey /* , verbose: 'false' */})
 reserve7AdminData.eos = Eos({ keyProvider: reserve7AdminData.privateKey /* , verbose: 'false' */})
+legacyReserveData.eos = Eos({ keyProvider: legacyReserveData.privateKey /* , verbose: 'false' */})
 aliceData.eos = Eos({ keyProvider: aliceData.privateKey /* , verbose: 'false' */})
 mosheData.eos = Eos({ keyProvider: mosheData.privateKey /* , verbose: 'false' */})
 networkData.eos = Eos({ keyProvider: networkData.privateKey /* , verbose: 'false' */})
@@ -103,6 +105,7 @@ before("setup accounts, contracts and initial funds", async () => {
     await systemData.eos.transaction(tr => {tr.newaccount({creator: "eosio", name:reserve5Data.account, owner: reserve5Data.publicKey, active: reserve5Data.publicKey})});
     await systemData.eos.transaction(tr => {tr.newaccount({creator: "eosio", name:reserve6Data.account, owner: reserve6Data.publicKey, active: reserve6Data.publicKey})});
     await systemData.eos.transaction(tr => {tr.newaccount({creator: "eosio", name:reserve7Data.account, owner: reserve7Data.publicKey, active: reserve7Data.publicKey})});
+    await systemData.eos.transaction(tr => {tr.newaccount({creator: "eosio", name:legacyReserveData.account, owner: legacyReserveData.publicKey, active: legacyReserveData.publicKey})});
     await systemData.eos.transaction(tr => {tr.newaccount({creator: "eosio", name:aliceData.account, owner: aliceData.publicKey, active: aliceData.publicKey})});
     await systemData.eos.transaction(tr => {tr.newaccount({creator: "eosio", name:mosheData.account, owner: mosheData.publicKey, active: mosheData.publicKey})});
     await systemData.eos.transaction(tr => {tr.newaccount({creator: "eosio", name:networkData.account, owner: networkData.publicKey, active: networkData.publicKey})});
@@ -136,6 +139,8 @@ before("setup accounts, contracts and initial funds", async () => {
     await reserve6Data.eos.setabi(reserve6Data.account, JSON.parse(fs.readFileSync(`contracts/Reserve/AmmReserve/AmmReserve.abi`)))
     await reserve7Data.eos.setcode(reserve7Data.account, 0, 0, fs.readFileSync(`contracts/Reserve/AmmReserve/AmmReserve.wasm`));
     await reserve7Data.eos.setabi(reserve7Data.account, JSON.parse(fs.readFileSync(`contracts/Reserve/AmmReserve/AmmReserve.abi`)))
+    await legacyReserveData.eos.setcode(legacyReserveData.account, 0, 0, fs.readFileSync(`contracts/Mock/LegacyReserve/LegacyReserve.wasm`));
+    await legacyReserveData.eos.setabi(legacyReserveData.account, JSON.parse(fs.readFileSync(`contracts/Mock/LegacyReserve/LegacyReserve.abi`)))
     await networkData.eos.setcode(networkData.account, 0, 0, fs.readFileSync(`contracts/Network/Network.wasm`));
     await networkData.eos.setabi(networkData.account, JSON.parse(fs.readFileSync(`contracts/Network/Network.abi`)))
 
@@ -343,11 +348,15 @@ describe('as admin', () => {
             let state
             await networkAsAdmin.setenable({enable: 0},{authorization: `${networkAdminData.account}@active`});
             state = await networkAdminData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'state', json: true});
-            assert.equal(state["rows"][0].enabled, 0);
+            assert.equal(state["rows"][0].flags & 1, 0);
     
             await networkAsAdmin.setenable({enable: 1},{authorization: `${networkAdminData.account}@active`});
             state = await networkAdminData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'state', json: true});
-            assert.equal(state["rows"][0].enabled, 1);
+            assert.equal(state["rows"][0].flags & 1, 1);
+        })
+        it('can not migrate an up to date network', async function() {
+            const p = networkAsAdmin.migrate({limit: 10},{authorization: `${networkAdminData.account}@active`});
+            await ensureContractAssertionError(p, "already migrated");
         })
         it('withdraw', async function() {
             const balanceBefore = await getUserBalance({account:networkData.account, symbol:'EOS', tokenContract:tokenData.account, eos:mosheData.eos})
@@ -432,6 +441,27 @@ describe('as admin', () => {
             reserves = await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'reserve', json: true});
             assert.equal(reserves["rows"][3].num_tokens, "0")
         })
+        it('list and unlist several pairs in one action', async function() {
+            const listings = [
+                {reserve:reserve3Data.account, token_symbol:"4,SYS", token_contract:tokenData.account, add: 1},
+                {reserve:reserve3Data.account, token_symbol:"3,TOKA", token_contract:tokenData.account, add: 1},
+                {reserve:reserve4Data.account, token_symbol:"3,TOKA", token_contract:tokenData.account, add: 1}
+            ]
+            await networkAsAdmin.listpairs({listings: listings},{authorization: `${networkAdminData.account}@active`});
+            reserves = await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'reserve', json: true});
+            assert.equal(reserves["rows"].find(r => r.contract == reserve3Data.account).num_tokens, "2")
+            reservesPerTable = await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'reservespert', json: true});
+            assert.equal(reservesPerTable["rows"].find(r => r.symbol == "3,TOKA").reserve_contracts.length, 2)
+
+            const p = networkAsAdmin.listpairs({listings: [listings[0], listings[0]]},{authorization: `${networkAdminData.account}@active`});
+            await ensureContractAssertionError(p, "duplicate listing");
+
+            await networkAsAdmin.listpairs({listings: listings.map(l => Object.assign({}, l, {add: 0}))},{authorization: `${networkAdminData.account}@active`});
+            reserves = await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'reserve', json: true});
+            assert.equal(reserves["rows"].find(r => r.contract == reserve3Data.account).num_tokens, "0")
+            reservesPerTable = await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'reservespert', json: true});
+            assert.equal(reservesPerTable["rows"].length, 0)
+        })
         it('listing an existing pair for a reserve does nothing, also removing a pair works', async function() {
             /* start with two different pairs */
             await networkAsAdmin.listpairres({add: 1, reserve:reserve1Data.account, token_symbol:"4,SYS", token_contract:tokenData.account},{authorization: `${networkAdminData.account}@active`});
@@ -641,11 +671,11 @@ describe('as non admin', () => {
         it('check accounting of volume', async function() {
             let tokenStats 
             tokenStatsBefore = await networkAdminData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'tokenstats', json: true});
-            eosCountBefore =  parseFloat(tokenStatsBefore["rows"][0]["eos_counter"].split(" "))
-            tokenCountBefore =  parseFloat(tokenStatsBefore["rows"][0]["token_counter"].split(" "))
+            eosCountBefore =  parseInt(tokenStatsBefore["rows"][0]["eos_counter"])
+            tokenCountBefore =  parseInt(tokenStatsBefore["rows"][0]["token_counter"])
 
             await networkAsAlice.getexprate({src: "5.0000 EOS", dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
-            expDestAmount = parseFloat((await networkData.eos.getTableRows({table:"rate", code:networkData.account, scope:networkData.account, json: true})).rows[0].dest.split(" "))
+            expDestAmount = parseInt((await networkData.eos.getTableRows({table:"rate", code:networkData.account, scope:networkData.account, json: true})).rows[0].dest_amount)
 
             const token = await aliceData.eos.contract(tokenData.account);
             await token.transfer({
@@ -656,12 +686,375 @@ describe('as non admin', () => {
                 {authorization: [`${aliceData.account}@active`]});
 
             tokenStatsAfter = await networkAdminData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'tokenstats', json: true});
-            eosCountAfter =  parseFloat(tokenStatsAfter["rows"][0]["eos_counter"].split(" "))
-            tokenCountAfter =  parseFloat(tokenStatsAfter["rows"][0]["token_counter"].split(" "))
+            eosCountAfter =  parseInt(tokenStatsAfter["rows"][0]["eos_counter"])
+            tokenCountAfter =  parseInt(tokenStatsAfter["rows"][0]["token_counter"])
 
-            assert.equal(eosCountAfter - eosCountBefore, 5.0000)
+            /* counters are kept in token units, 4 digits precision for both EOS and SYS */
+            assert.equal(eosCountAfter - eosCountBefore, 50000)
             assert.equal(tokenCountAfter - tokenCountBefore, expDestAmount)
         })
+        it('check price feed and candle are updated on trade', async function() {
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"2.0000 EOS",
+                memo:"4 SYS," + tokenData.account + ",0.000001"},
+                {authorization: [`${aliceData.account}@active`]});
+            const tokenStats = await networkAdminData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'tokenstats', json: true});
+            assert.equal(tokenStats["rows"][0]["token_symbol"], "4,SYS")
+
+            const feed = (await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'pricefeed', json: true})).rows[0]
+            assert.equal(feed.token_symbol, "4,SYS")
+            parseFloat(feed.last_price).should.be.above(0)
+
+            const candles = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "SYS"), table: 'candles', json: true})).rows
+            assert.equal(candles.length, 1)
+            parseFloat(candles[0].close).should.be.closeTo(parseFloat(feed.last_price), RATE_PRECISON)
+            parseFloat(candles[0].low).should.be.at.most(parseFloat(candles[0].high))
+        })
+        it('can get max src for a min rate', async function() {
+            await networkAsAlice.getexprate({src: "0.0000 EOS", dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
+            const spotRate = parseFloat((await networkData.eos.getTableRows({table:"rate", code:networkData.account, scope:networkData.account, json: true})).rows[0].stored_rate)
+            const minRate = spotRate * 0.98
+
+            await networkAsAlice.getmaxsrc({token_symbol: "4,SYS", buy: 1, min_rate: minRate.toString()},{authorization: `${aliceData.account}@active`});
+            const result = (await networkData.eos.getTableRows({table:"maxsrc", code:networkData.account, scope:networkData.account, json: true})).rows[0]
+            parseFloat(result.src).should.be.above(0)
+            assert.include([reserve1Data.account, reserve6Data.account], result.reserve)
+
+            await networkAsAlice.getexprate({src: result.src, dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
+            const rate = parseFloat((await networkData.eos.getTableRows({table:"rate", code:networkData.account, scope:networkData.account, json: true})).rows[0].stored_rate)
+            rate.should.be.at.least(minRate)
+        })
+        it('quote all listed pairs off chain', async function() {
+            const quotes = await networkServices.getQuotes({eos: aliceData.eos, networkAccount: networkData.account, eosAmount: 1})
+            const sysQuotes = quotes.filter(q => q.reserve == reserve1Data.account && q.destSymbol == "SYS")
+            assert.equal(sysQuotes.length, 2)
+
+            await networkAsAlice.getexprate({src: "1.0000 EOS", dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
+            const rate = (await networkData.eos.getTableRows({table:"rate", code:networkData.account, scope:networkData.account, json: true})).rows[0].stored_rate
+            const sizedBuy = sysQuotes.find(q => q.srcAmount == 1)
+            sizedBuy.rate.should.be.above(0)
+            sizedBuy.rate.should.be.at.most(parseFloat(rate) + RATE_PRECISON)
+        })
+        it('disabled reserve is tripped after consecutive failures, and reset on delist', async function() {
+            await reserve6AsAdmin.setenable({enable: 0},{authorization: `${reserve6AdminData.account}@active`});
+            for (const src of ["1.0000 EOS", "1.0001 EOS", "1.0002 EOS"]) {
+                await networkAsAlice.getexprate({src: src, dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
+            }
+            await reserve6AsAdmin.setenable({enable: 1},{authorization: `${reserve6AdminData.account}@active`});
+
+            let health = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "SYS"), table: 'reshealth', json: true})).rows
+            assert.equal(health.length, 1)
+            assert.equal(health[0].reserve, reserve6Data.account)
+            assert.equal(health[0].buy.failures, 3)
+            assert.equal(health[0].buy.last_reason, 2 /* disabled */)
+            assert.equal(health[0].sell.failures, 0)
+
+            /* tripped, so not queried even though it is enabled again */
+            await networkAsAlice.getexprate({src: "1.0003 EOS", dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
+            health = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "SYS"), table: 'reshealth', json: true})).rows
+            assert.equal(health[0].buy.failures, 3)
+
+            await networkAsAdmin.listpairres({add: 0, reserve:reserve6Data.account, token_symbol:"4,SYS", token_contract:tokenData.account}, {authorization: `${networkAdminData.account}@active`});
+            await networkAsAdmin.listpairres({add: 1, reserve:reserve6Data.account, token_symbol:"4,SYS", token_contract:tokenData.account}, {authorization: `${networkAdminData.account}@active`});
+            health = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "SYS"), table: 'reshealth', json: true})).rows
+            assert.equal(health.length, 0)
+        })
+        it('reserve with the legacy rate layout is quoted and never tripped', async function() {
+            await networkAsAdmin.addreserve({reserve:legacyReserveData.account, add:1},{authorization: `${networkAdminData.account}@active`});
+            await networkAsAdmin.listpairres({add: 1, reserve:legacyReserveData.account, token_symbol:"4,SYS", token_contract:tokenData.account}, {authorization: `${networkAdminData.account}@active`});
+
+            for (const src of ["1.0000 EOS", "1.0001 EOS", "1.0002 EOS", "1.0003 EOS"]) {
+                await networkAsAlice.getexprate({src: src, dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
+            }
+            const health = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "SYS"), table: 'reshealth', json: true})).rows
+            assert.equal(health.filter(h => h.reserve == legacyReserveData.account).length, 0)
+
+            await networkAsAdmin.listpairres({add: 0, reserve:legacyReserveData.account, token_symbol:"4,SYS", token_contract:tokenData.account}, {authorization: `${networkAdminData.account}@active`});
+            await networkAsAdmin.addreserve({reserve:legacyReserveData.account, add:0},{authorization: `${networkAdminData.account}@active`});
+        })
+        it('can not set trusted reserve', async function() {
+            const p = networkAsAlice.settrusted({reserve:reserve2Data.account, trusted:1},{authorization: `${aliceData.account}@active`});
+            await ensureContractAssertionError(p, "Missing required authority");
+        })
+        it('trade through a trusted reserve pays the expected dest', async function() {
+            await networkAsAdmin.settrusted({reserve:reserve2Data.account, trusted:1},{authorization: `${networkAdminData.account}@active`});
+            const trusted = (await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'trustedres', json: true})).rows
+            assert.equal(trusted.length, 1)
+
+            await networkAsAlice.getexprate({src: "2.0000 EOS", dest_symbol: "3,TOKA"},{authorization: `${aliceData.account}@active`});
+            const expDestAmount = parseInt((await networkData.eos.getTableRows({table:"rate", code:networkData.account, scope:networkData.account, json: true})).rows[0].dest_amount)
+            const balanceBefore = await getUserBalance({account:aliceData.account, symbol:'TOKA', tokenContract:tokenData.account, eos:mosheData.eos})
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"2.0000 EOS",
+                memo:"3 TOKA," + tokenData.account + ",0.000001"},
+                {authorization: [`${aliceData.account}@active`]});
+
+            const balanceAfter = await getUserBalance({account:aliceData.account, symbol:'TOKA', tokenContract:tokenData.account, eos:mosheData.eos})
+            Math.round((balanceAfter - balanceBefore) * 1000).should.be.at.least(expDestAmount)
+
+            /* trade state is cleared, so the network is not stuck in a trade */
+            const state = (await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'state', json: true})).rows[0]
+            assert.equal(state.flags & 2, 0)
+
+            await networkAsAdmin.settrusted({reserve:reserve2Data.account, trusted:0},{authorization: `${networkAdminData.account}@active`});
+        })
+        it('trade against a quote ticket', async function() {
+            await networkAsAlice.getticket({owner: aliceData.account, src: "2.0000 EOS", dest_symbol: "3,TOKA"},{authorization: `${aliceData.account}@active`});
+            const ticket = (await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'tickets', json: true})).rows[0]
+            assert.equal(ticket.owner, aliceData.account)
+            const balanceBefore = await getUserBalance({account:aliceData.account, symbol:'TOKA', tokenContract:tokenData.account, eos:mosheData.eos})
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({from:aliceData.account, to:networkData.account, quantity:"2.0000 EOS", memo:"ticket"},
+                                 {authorization: [`${aliceData.account}@active`]});
+
+            const balanceAfter = await getUserBalance({account:aliceData.account, symbol:'TOKA', tokenContract:tokenData.account, eos:mosheData.eos})
+            Math.round((balanceAfter - balanceBefore) * 1000).should.be.at.least(Math.round(parseFloat(ticket.dest) * 1000))
+            const tickets = (await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'tickets', json: true})).rows
+            assert.equal(tickets.length, 0)
+        })
+        it('batch mode nets buys against sells at a uniform rate', async function() {
+            await networkAsAdmin.setbatch({token_symbol: "3,TOKA", window: 1},{authorization: `${networkAdminData.account}@active`});
+            const eosBefore = await getUserBalance({account:aliceData.account, symbol:'EOS', tokenContract:tokenData.account, eos:mosheData.eos})
+            const tokaBefore = await getUserBalance({account:aliceData.account, symbol:'TOKA', tokenContract:tokenData.account, eos:mosheData.eos})
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({from:aliceData.account, to:networkData.account, quantity:"2.0000 EOS",
+                                  memo:"3 TOKA," + tokenData.account + ",0.000001"},
+                                 {authorization: [`${aliceData.account}@active`]});
+            await token.transfer({from:aliceData.account, to:networkData.account, quantity:"10.000 TOKA",
+                                  memo:"4 EOS," + tokenData.account + ",0.000001"},
+                                 {authorization: [`${aliceData.account}@active`]});
+            let orders = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(3, "TOKA"), table: 'orders', json: true})).rows
+            assert.equal(orders.length, 2)
+
+            const p = networkAsAlice.clearbatch({token_symbol: "3,TOKA"},{authorization: `${aliceData.account}@active`});
+            await ensureContractAssertionError(p, "batch window not passed");
+
+            await snooze(1500);
+            await networkAsAlice.clearbatch({token_symbol: "3,TOKA"},{authorization: `${aliceData.account}@active`});
+            orders = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(3, "TOKA"), table: 'orders', json: true})).rows
+            assert.equal(orders.length, 0)
+
+            /* both orders are filled or refunded to the internal balances, nothing stays in escrow */
+            for (const sym of [symbolRaw(4, "EOS"), symbolRaw(3, "TOKA")]) {
+                const vault = (await networkData.eos.getTableRows({code: networkData.account, scope: sym, table: 'vault', json: true})).rows
+                const row = vault.find(r => r.owner == aliceData.account)
+                assert.ok(row)
+                await networkAsAlice.vaultwd({owner: aliceData.account, quantity: row.balance}, {authorization: `${aliceData.account}@active`});
+            }
+            const eosAfter = await getUserBalance({account:aliceData.account, symbol:'EOS', tokenContract:tokenData.account, eos:mosheData.eos})
+            const tokaAfter = await getUserBalance({account:aliceData.account, symbol:'TOKA', tokenContract:tokenData.account, eos:mosheData.eos})
+            eosAfter.should.not.equal(eosBefore)
+            tokaAfter.should.not.equal(tokaBefore)
+            const state = (await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'state', json: true})).rows[0]
+            assert.equal(state.flags & 6, 0)
+
+            await networkAsAdmin.setbatch({token_symbol: "3,TOKA", window: 0},{authorization: `${networkAdminData.account}@active`});
+        })
+        it('admin can cancel an open batch into the internal balances', async function() {
+            await networkAsAdmin.setbatch({token_symbol: "3,TOKA", window: 1},{authorization: `${networkAdminData.account}@active`});
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({from:aliceData.account, to:networkData.account, quantity:"1.0000 EOS",
+                                  memo:"3 TOKA," + tokenData.account + ",0.000001"},
+                                 {authorization: [`${aliceData.account}@active`]});
+
+            const p = networkAsAlice.cancelbatch({token_symbol: "3,TOKA"},{authorization: `${aliceData.account}@active`});
+            await ensureContractAssertionError(p, "Missing required authority");
+            await networkAsAdmin.cancelbatch({token_symbol: "3,TOKA"},{authorization: `${networkAdminData.account}@active`});
+
+            const orders = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(3, "TOKA"), table: 'orders', json: true})).rows
+            assert.equal(orders.length, 0)
+            const eosVault = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "EOS"), table: 'vault', json: true})).rows
+            assert.equal(eosVault.find(r => r.owner == aliceData.account).balance, "1.0000 EOS")
+            await networkAsAlice.vaultwd({owner: aliceData.account, quantity: "1.0000 EOS"}, {authorization: `${aliceData.account}@active`});
+
+            /* nothing is open anymore, so batch mode can be left */
+            await networkAsAdmin.setbatch({token_symbol: "3,TOKA", window: 0},{authorization: `${networkAdminData.account}@active`});
+        })
+        it('trades are appended to the change feed', async function() {
+            const seqBefore = await networkServices.getFeedSeq({eos: aliceData.eos, networkAccount: networkData.account})
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({from:aliceData.account, to:networkData.account, quantity:"1.0000 EOS",
+                                  memo:"4 SYS," + tokenData.account + ",0.000001"},
+                                 {authorization: [`${aliceData.account}@active`]});
+
+            const seqAfter = await networkServices.getFeedSeq({eos: aliceData.eos, networkAccount: networkData.account})
+            assert.equal(seqAfter.trade_seq, seqBefore.trade_seq + 1)
+            assert.equal(seqAfter.config_seq, seqBefore.config_seq)
+
+            const trades = await networkServices.getTradesSince({eos: aliceData.eos, networkAccount: networkData.account, seq: seqBefore.trade_seq})
+            assert.equal(trades.length, 1)
+            assert.equal(trades[0].sender, aliceData.account)
+            assert.equal(trades[0].src, "1.0000 EOS")
+        })
+        it('buy above the eos cap of one reserve is split between the reserves', async function() {
+            /* reserve1 and reserve6 both hold SYS, each capped at max_eos_cap_buy of 20 EOS */
+            const seqBefore = await networkServices.getFeedSeq({eos: aliceData.eos, networkAccount: networkData.account})
+            const sysBefore = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({from:aliceData.account, to:networkData.account, quantity:"25.0000 EOS",
+                                  memo:"4 SYS," + tokenData.account + ",0.000001"},
+                                 {authorization: [`${aliceData.account}@active`]});
+
+            const sysAfter = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+            sysAfter.should.be.above(sysBefore)
+
+            const trades = await networkServices.getTradesSince({eos: aliceData.eos, networkAccount: networkData.account, seq: seqBefore.trade_seq})
+            assert.equal(trades.length, 2)
+            assert.notEqual(trades[0].reserve, trades[1].reserve)
+            const paid = trades.reduce((sum, t) => sum + Math.round(parseFloat(t.src) * 10000), 0)
+            assert.equal(paid, 250000)
+        })
+        it('buy of at least the split threshold is split when it gives more than the best reserve', async function() {
+            /* 12 EOS is above SPLIT_MIN_EOS and within the 20 EOS cap, so a single reserve fills it too */
+            await networkAsAlice.getexprate({src: "12.0000 EOS", dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
+            const singleDestAmount = parseInt((await networkData.eos.getTableRows({table:"rate", code:networkData.account, scope:networkData.account, json: true})).rows[0].dest_amount)
+            const seqBefore = await networkServices.getFeedSeq({eos: aliceData.eos, networkAccount: networkData.account})
+            const sysBefore = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({from:aliceData.account, to:networkData.account, quantity:"12.0000 EOS",
+                                  memo:"4 SYS," + tokenData.account + ",0.000001"},
+                                 {authorization: [`${aliceData.account}@active`]});
+
+            /* reserve1 and reserve6 have the same curve, two slices at lower marginal rates beat one whole trade */
+            const sysAfter = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+            const destAmount = Math.round((sysAfter - sysBefore) * 10000)
+            destAmount.should.be.above(singleDestAmount)
+            const trades = await networkServices.getTradesSince({eos: aliceData.eos, networkAccount: networkData.account, seq: seqBefore.trade_seq})
+            assert.equal(trades.length, 2)
+            assert.notEqual(trades[0].reserve, trades[1].reserve)
+            assert.equal(trades.reduce((sum, t) => sum + Math.round(parseFloat(t.dest) * 10000), 0), destAmount)
+        })
+        it('can not get a quote ticket for a token in batch mode', async function() {
+            await networkAsAdmin.setbatch({token_symbol: "3,TOKA", window: 1},{authorization: `${networkAdminData.account}@active`});
+            const p = networkAsAlice.getticket({owner: aliceData.account, src: "2.0000 EOS", dest_symbol: "3,TOKA"},{authorization: `${aliceData.account}@active`});
+            await ensureContractAssertionError(p, "token is in batch mode");
+            await networkAsAdmin.setbatch({token_symbol: "3,TOKA", window: 0},{authorization: `${networkAdminData.account}@active`});
+        })
+        it('trade with a quote ticket of another src reverts', async function() {
+            await networkAsAlice.getticket({owner: aliceData.account, src: "2.0000 EOS", dest_symbol: "3,TOKA"},{authorization: `${aliceData.account}@active`});
+            const token = await aliceData.eos.contract(tokenData.account);
+            const p = token.transfer({from:aliceData.account, to:networkData.account, quantity:"1.0000 EOS", memo:"ticket"},
+                                     {authorization: [`${aliceData.account}@active`]});
+            await ensureContractAssertionError(p, "src does not match the quote ticket");
+        })
+        it('exact output trade pays exactly dest and refunds the rest of src', async function() {
+            const sysBefore = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+            const eosBefore = await getUserBalance({account:aliceData.account, symbol:'EOS', tokenContract:tokenData.account, eos:mosheData.eos})
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"5.0000 EOS",
+                memo:"4 SYS," + tokenData.account + ",0.000001,1.2345"},
+                {authorization: [`${aliceData.account}@active`]});
+
+            const sysAfter = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+            const eosAfter = await getUserBalance({account:aliceData.account, symbol:'EOS', tokenContract:tokenData.account, eos:mosheData.eos})
+            Math.round((sysAfter - sysBefore) * 10000).should.be.equal(12345)
+            const paid = eosBefore - eosAfter
+            paid.should.be.above(0)
+            paid.should.be.below(5)
+        })
+        it('exact output trade reverts when src is not enough for dest', async function() {
+            const token = await aliceData.eos.contract(tokenData.account);
+            const p = token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"0.0010 EOS",
+                memo:"4 SYS," + tokenData.account + ",0.000001,50.0000"},
+                {authorization: [`${aliceData.account}@active`]});
+            await ensureContractAssertionError(p, "src not enough for dest");
+        })
+        it('trade with a compact memo', async function() {
+            const memo = networkServices.encodeCompactMemo({destPrecision: 4, destSymbol: "SYS", minConversionRate: "0.000001"})
+            memo.length.should.be.below(("4 SYS," + tokenData.account + ",0.000001").length)
+            const balanceBefore = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"1.0000 EOS",
+                memo:memo},
+                {authorization: [`${aliceData.account}@active`]});
+
+            const balanceAfter = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+            balanceAfter.should.be.above(balanceBefore)
+        })
+        it('compact memo with an unexpected dest contract reverts', async function() {
+            const memo = networkServices.encodeCompactMemo({destPrecision: 4, destSymbol: "SYS", destTokenAccount: aliceData.account, minConversionRate: "0.000001"})
+            const token = await aliceData.eos.contract(tokenData.account);
+            const p = token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"1.0000 EOS",
+                memo:memo},
+                {authorization: [`${aliceData.account}@active`]});
+            await ensureContractAssertionError(p, "unexpected dest contract");
+        })
+        it('trade internal balances and withdraw them', async function() {
+            const token = await aliceData.eos.contract(tokenData.account);
+            await token.transfer({from:aliceData.account, to:networkData.account, quantity:"2.0000 EOS", memo:"deposit"},
+                                 {authorization: [`${aliceData.account}@active`]});
+            await reserve1AsAdmin.withdraw({to:networkData.account, quantity:"10.0000 SYS", dest_contract:tokenData.account, memo:"deposit"},
+                                           {authorization: `${reserve1AdminData.account}@active`});
+            await reserve6AsAdmin.withdraw({to:networkData.account, quantity:"10.0000 SYS", dest_contract:tokenData.account, memo:"deposit"},
+                                           {authorization: `${reserve6AdminData.account}@active`});
+
+            let eosVault = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "EOS"), table: 'vault', json: true})).rows
+            assert.equal(eosVault.find(r => r.owner == aliceData.account).balance, "2.0000 EOS")
+
+            await networkAsAlice.tradeint({owner: aliceData.account, src: "1.0000 EOS", dest_symbol: "4,SYS", min_conversion_rate: "0.000001"},
+                                          {authorization: `${aliceData.account}@active`});
+
+            eosVault = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "EOS"), table: 'vault', json: true})).rows
+            assert.equal(eosVault.find(r => r.owner == aliceData.account).balance, "1.0000 EOS")
+            const sysVault = (await networkData.eos.getTableRows({code: networkData.account, scope: symbolRaw(4, "SYS"), table: 'vault', json: true})).rows
+            const sysBalance = sysVault.find(r => r.owner == aliceData.account).balance
+            parseFloat(sysBalance).should.be.above(0)
+
+            const balanceBefore = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos})
+            await networkAsAlice.vaultwd({owner: aliceData.account, quantity: sysBalance}, {authorization: `${aliceData.account}@active`});
+            const balanceAfter = await getUserBalance({account:aliceData.account, symbol:'SYS', tokenContract:tokenData.account, eos:mosheData.eos});
+            (balanceAfter - balanceBefore).should.be.closeTo(parseFloat(sysBalance), AMOUNT_PRECISON)
+        })
+        it('can not trade internal balances of a token in batch mode', async function() {
+            await networkAsAdmin.setbatch({token_symbol: "4,SYS", window: 1},{authorization: `${networkAdminData.account}@active`});
+            const p = networkAsAlice.tradeint({owner: aliceData.account, src: "1.0000 EOS", dest_symbol: "4,SYS", min_conversion_rate: "0.000001"},
+                                              {authorization: `${aliceData.account}@active`});
+            await ensureContractAssertionError(p, "token is in batch mode");
+            await networkAsAdmin.setbatch({token_symbol: "4,SYS", window: 0},{authorization: `${networkAdminData.account}@active`});
+        })
+        it('can not trade an exact output of a token in batch mode', async function() {
+            await networkAsAdmin.setbatch({token_symbol: "4,SYS", window: 1},{authorization: `${networkAdminData.account}@active`});
+            const token = await aliceData.eos.contract(tokenData.account);
+            const p = token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"5.0000 EOS",
+                memo:"4 SYS," + tokenData.account + ",0.000001,1.2345"},
+                {authorization: [`${aliceData.account}@active`]});
+            await ensureContractAssertionError(p, "token is in batch mode");
+            await networkAsAdmin.setbatch({token_symbol: "4,SYS", window: 0},{authorization: `${networkAdminData.account}@active`});
+        })
+        it('can not trade internal balances of another account', async function() {
+            const p = networkAsAlice.tradeint({owner: mosheData.account, src: "1.0000 EOS", dest_symbol: "4,SYS", min_conversion_rate: "0.000001"},
+                                              {authorization: `${aliceData.account}@active`});
+            await ensureContractAssertionError(p, "Missing required authority");
+        })
         it('bad memo on trade', async function() {
             const token = await aliceData.eos.contract(tokenData.account);
             const p = token.transfer({
@@ -683,6 +1076,29 @@ describe('as non admin', () => {
                 {authorization: [`${aliceData.account}@active`]});
             await ensureContractAssertionError(p, "rate < min conversion rate");
         })
+        it('check trade reverts on min conversion rate slightly above the rate', async function() {
+            await networkAsAlice.getexprate({src: "5.0000 EOS", dest_symbol: "4,SYS"},{authorization: `${aliceData.account}@active`});
+            const rate = parseFloat((await networkData.eos.getTableRows({table:"rate", code:networkData.account, scope:networkData.account, json: true})).rows[0].stored_rate)
+
+            const token = await aliceData.eos.contract(tokenData.account);
+            const p = token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"5.0000 EOS",
+                memo:"4 SYS," + tokenData.account + "," + (rate * 1.000001).toFixed(12)},
+                {authorization: [`${aliceData.account}@active`]});
+            await ensureContractAssertionError(p, "rate < min conversion rate");
+        })
+        it('check trade reverts on malformed min conversion rate', async function() {
+            const token = await aliceData.eos.contract(tokenData.account);
+            const p = token.transfer({
+                from:aliceData.account,
+                to:networkData.account,
+                quantity:"5.0000 EOS",
+                memo:"4 SYS," + tokenData.account + ",1.2e-3"},
+                {authorization: [`${aliceData.account}@active`]});
+            await ensureContractAssertionError(p, "invalid amount");
+        })
         it('can not call internal action storeexprate', async function() {
             const p = networkAsAdmin.storeexprate({src: "1.000 TOKA", dest_symbol: "4,EOS"},{authorization: `${networkAdminData.account}@active`});
             await ensureContractAssertionError(p, "Missing required authority");
@@ -705,7 +1121,7 @@ describe('as non admin', () => {
                 quantity:"5.0000 SYS",
                 memo:"4 EOS," + tokenData.account + ",0.000001"},
                 {authorization: [`${aliceData.account}@active`]});
-            await ensureContractAssertionError(p, "unexpected src contract");
+            await ensureContractAssertionError(p, "unlisted token");
         })
         it('trade from unknown eos contract with registered eos symbol', async function() {
             const mockToken = await aliceData.eos.contract(mockTokenData.account);
@@ -715,7 +1131,22 @@ describe('as non admin', () => {
                 quantity:"5.0000 EOS",
                 memo:"4 SYS," + tokenData.account + ",0.000001"},
                 {authorization: [`${aliceData.account}@active`]});
-            await ensureContractAssertionError(p, "unexpected src contract");
+            await ensureContractAssertionError(p, "unlisted token");
+        })
+        it('ram report pages through a table', async function() {
+            const listed = (await networkData.eos.getTableRows({code: networkData.account, scope: networkData.account, table: 'reservespert', json: true})).rows
+            const res = await networkAsAlice.ramreport({table: "reservespert", scope: networkData.account, cursor: 0, limit: 1},{authorization: `${aliceData.account}@active`});
+            const output = res.processed.action_traces[0].console
+            output.should.include("ramreport rows=1 ")
+            if (listed.length == 1) output.should.include("next=done")
+            else output.should.not.include("next=done")
+        })
+        it('accepted tokens follow the listed pairs', async function() {
+            const accepted = (await networkData.eos.getTableRows({code: networkData.account, scope: tokenData.account, table: 'accepted', json: true})).rows.map(row => row.sym)
+            accepted.should.include("EOS")
+            accepted.should.include("SYS")
+            const mockAccepted = (await networkData.eos.getTableRows({code: networkData.account, scope: mockTokenData.account, table: 'accepted', json: true})).rows
+            assert.equal(mockAccepted.length, 0)
         })
 
         describe('using services', () => {
@@ -84,11 +84,21 @@ function roundDown(number, decimals) {
     return ( Math.floor( number * Math.pow(10, decimals) ) / Math.pow(10, decimals) );
 }
 
+/* raw value of an eosio symbol, as used for table scopes and primary keys */
+function symbolRaw(precision, code) {
+    let value = BigInt(0)
+    for (let i = code.length - 1; i >= 0; i--) {
+        value = (value << BigInt(8)) | BigInt(code.charCodeAt(i))
+    }
+    return ((value << BigInt(8)) | BigInt(precision)).toString()
+}
+
 module.exports ={
     ensureContractAssertionError,
     snooze,
     getUserBalance,
     renouncePermToOnlyCode,
     addCodeToPerm,
-    roundDown
+    roundDown,
+    symbolRaw
 }
\ No newline at end of file